@@ -0,0 +1,76 @@
+/***************************************************************************
+ *   This file is part of the NeHeP library.                               *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __ALIASTABLE_H__
+#define __ALIASTABLE_H__
+
+#include <magic/mobject.h>
+#include <magic/mpararr.h>
+
+using namespace MagiC;
+
+/** Table for drawing random integers from a discrete distribution in
+ *  constant time.
+ *
+ *  Implements the alias method of Walker, with the numerically stable
+ *  construction of Vose. Building the table for n outcomes takes
+ *  O(n) time, after which each draw takes one random number and one
+ *  comparison, regardless of the number of outcomes.
+ *
+ *  The table is immutable after it is built, so it can be used for
+ *  drawing concurrently from several threads.
+ **/
+class AliasTable : public Object {
+  public:
+					AliasTable		() {}
+
+	/** Builds the table for the given weights. The weights do not
+	 *  need to be normalized, but they must be non-negative and at
+	 *  least one of them must be positive.
+	 **/
+	void			make			(const PackArray<double>& weights);
+
+	/** Draws a random outcome 0..size()-1 with probability
+	 *  proportional to its weight.
+	 **/
+	int				draw			() const;
+
+	/** Returns the number of outcomes. */
+	int				size			() const {return mProb.size();}
+
+	/** Returns the probability of the given outcome, as represented
+	 *  by the table. Useful for verifying the table against the
+	 *  original weights.
+	 **/
+	double			probability		(int i) const;
+
+	/** Implementation for @ref Object. */
+	virtual void	check			() const;
+
+  private:
+	PackArray<double>	mProb;	/**> Probability of keeping the column instead of taking its alias. */
+	PackArray<int>		mAlias;	/**> Alternative outcome of each column. */
+};
+
+#endif
@@ -0,0 +1,263 @@
+/***************************************************************************
+ *   This file is part of the NeHeP library.                               *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __NHP_CHECKPOINT_H__
+#define __NHP_CHECKPOINT_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <magic/mobject.h>
+#include <magic/mstring.h>
+#include <magic/mexception.h>
+
+using namespace MagiC;
+
+// Internals
+class CheckpointThread;
+
+/** Thrown when a checkpoint can not be read or does not fit the
+ *  population.
+ **/
+EXCEPTIONCLASS (checkpoint_error);
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//               C h e c k p o i n t   S t r e a m s                         //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/** A growing memory buffer where the state of a population is
+ *  serialized for a checkpoint.
+ *
+ *  The values are written in the byte order of the machine, without
+ *  any padding, so a checkpoint can be restored only on a machine of
+ *  the same kind.
+ **/
+class CheckpointOStream {
+  public:
+					CheckpointOStream	() : mpData (NULL), mSize (0), mCapacity (0) {}
+					~CheckpointOStream	() {delete [] mpData;}
+
+	/** Appends raw bytes. */
+	void			put					(const void* data, int bytes) {
+		if (bytes <= 0)
+			return;
+		if (mSize+bytes > mCapacity)
+			reserve (mSize+bytes);
+		memcpy (mpData+mSize, data, bytes);
+		mSize += bytes;
+	}
+
+	void			putInt				(int32_t value) {put (&value, sizeof (value));}
+	void			putWord				(uint64_t value) {put (&value, sizeof (value));}
+	void			putDouble			(double value) {put (&value, sizeof (value));}
+	void			putBool				(bool value) {char c=value; put (&c, 1);}
+
+	/** Appends an array of doubles, preceded by its length. */
+	void			putDoubles			(const double* values, int n) {putInt (n); put (values, n*sizeof (double));}
+
+	/** Returns the serialized data. */
+	const char*		data				() const {return mpData;}
+
+	/** Returns the number of bytes written. */
+	int				size				() const {return mSize;}
+
+	/** Empties the buffer, but keeps the memory. */
+	void			clear				() {mSize = 0;}
+
+	/** Drops the data after the given number of bytes. */
+	void			truncate			(int bytes) {if (bytes < mSize) mSize = bytes;}
+
+	/** Replaces bytes that were already written, starting at the
+	 *  given position.
+	 **/
+	void			overwrite			(int position, const void* data, int bytes) {
+		ASSERTWITH (position>=0 && bytes>=0 && bytes <= mSize-position, "Overwrite past the end of the buffer");
+		memcpy (mpData+position, data, bytes);
+	}
+
+	/** Exchanges the contents of two buffers without copying. */
+	void			swap				(CheckpointOStream& other);
+
+	/** Returns a 64-bit checksum of the data written so far. */
+	uint64_t		checksum			() const {return checksum (mpData, mSize);}
+
+	/** Returns a 64-bit checksum of the given bytes. */
+	static uint64_t	checksum			(const char* data, int bytes);
+
+  private:
+	void			reserve				(int bytes);
+
+	char*			mpData;
+	int				mSize;
+	int				mCapacity;
+
+	CheckpointOStream (const CheckpointOStream& o) {FORBIDDEN}
+	CheckpointOStream& operator= (const CheckpointOStream& o) {FORBIDDEN; return *this;}
+};
+
+/** Reads values from a checkpoint written with @ref
+ *  CheckpointOStream. Reading past the end throws @ref
+ *  checkpoint_error.
+ **/
+class CheckpointIStream {
+  public:
+	/** Reads the given memory, which must stay valid while reading. */
+					CheckpointIStream	(const char* data, int size) : rpData (data), mSize (size), mPos (0) {}
+
+	/** Reads raw bytes. */
+	void			get					(void* data, int bytes) {
+		if (bytes <= 0)
+			return;
+		if (bytes > mSize-mPos)
+			throw checkpoint_error ("Checkpoint is truncated");
+		memcpy (data, rpData+mPos, bytes);
+		mPos += bytes;
+	}
+
+	int32_t			getInt				() {int32_t v; get (&v, sizeof (v)); return v;}
+	uint64_t		getWord				() {uint64_t v; get (&v, sizeof (v)); return v;}
+	double			getDouble			() {double v; get (&v, sizeof (v)); return v;}
+	bool			getBool				() {char c; get (&c, 1); return c!=0;}
+
+	/** Reads an array of doubles written with putDoubles(). The
+	 *  length must be the given one.
+	 **/
+	void			getDoubles			(double* values, int n) {
+		if (getInt () != n)
+			throw checkpoint_error ("Checkpoint does not match the structure of the genome");
+		get (values, n*sizeof (double));
+	}
+
+	/** Returns the number of bytes read so far. */
+	int				position			() const {return mPos;}
+
+	/** Returns the number of bytes left. */
+	int				remaining			() const {return mSize-mPos;}
+
+  private:
+	const char*		rpData;
+	int				mSize;
+	int				mPos;
+};
+
+/** Writes a checkpoint to a file synchronously. The data is
+ *  followed by its checksum, and it is written to a temporary file
+ *  that is then renamed over the old checkpoint, so a crash during
+ *  the writing leaves the previous checkpoint intact.
+ *
+ *  @param checksum Should the checksum be appended? Files with a
+ *  layout of their own, such as snapshots, are written without.
+ *
+ *  @throw checkpoint_error if the file could not be written.
+ **/
+void writeCheckpointFile (const String& file, const CheckpointOStream& data, bool checksum=true);
+
+/** Reads a checkpoint written with @ref writeCheckpointFile() to
+ *  the buffer and verifies its checksum.
+ *
+ *  @throw checkpoint_error if the file could not be read or is damaged.
+ **/
+void readCheckpointFile (const String& file, CheckpointOStream& data);
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//               C h e c k p o i n t   W r i t e r                           //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/** Writes checkpoints to files in a background thread, so that the
+ *  evolution does not wait for the disk.
+ *
+ *  The files are written with @ref writeCheckpointFile().
+ *
+ *  If a new checkpoint is submitted while the previous one is still
+ *  waiting to be written, the previous one is dropped, as only the
+ *  latest state is of interest.
+ **/
+class CheckpointWriter {
+  public:
+	/** Starts the writer thread.
+	 *
+	 *  @param checksums Should the files be written with checksums?
+	 *  See @ref writeCheckpointFile().
+	 **/
+					CheckpointWriter	(bool checksums=true);
+
+	/** Writes the pending checkpoint, if any, and stops the thread. */
+					~CheckpointWriter	();
+
+	/** Hands a checkpoint to the writer thread. The contents of the
+	 *  buffer are taken by the writer; the buffer is left with some
+	 *  earlier data that can be cleared and reused.
+	 *
+	 *  @throw checkpoint_error if writing an earlier checkpoint failed.
+	 **/
+	void			submit				(const String& file, CheckpointOStream& data);
+
+	/** Waits until the submitted checkpoints have been written.
+	 *
+	 *  @throw checkpoint_error if writing failed.
+	 **/
+	void			flush				();
+
+	/** Returns the number of checkpoints written. */
+	int				written				() const {return mWritten;}
+
+	/** Returns the number of checkpoints dropped because a newer one
+	 *  was submitted before they were written.
+	 **/
+	int				dropped				() const {return mDropped;}
+
+  private:
+	/** Main loop of the writer thread. */
+	void			writerLoop			();
+
+	/** Throws the error of the writer thread, if any. Called with the
+	 *  lock held; releases it before throwing.
+	 **/
+	void			checkError			();
+
+	CheckpointThread*	mpThread;
+	pthread_mutex_t		mMutex;
+	pthread_cond_t		mWakeup;		/**> Signals a new checkpoint or shutdown. */
+	pthread_cond_t		mDone;			/**> Signals that a checkpoint was written. */
+	CheckpointOStream	mPending;		/**> The checkpoint to be written next. */
+	String				mPendingFile;
+	bool				mHasPending;
+	bool				mWriting;		/**> Is the thread writing a checkpoint? */
+	bool				mQuit;
+	String				mError;			/**> Message of a failed write. */
+	bool				mChecksums;		/**> Are the files written with checksums? */
+	int					mWritten;
+	int					mDropped;
+
+	friend class CheckpointThread;
+
+	CheckpointWriter (const CheckpointWriter& o) {FORBIDDEN}
+	CheckpointWriter& operator= (const CheckpointWriter& o) {FORBIDDEN; return *this;}
+};
+
+#endif
@@ -0,0 +1,200 @@
+/***************************************************************************
+ *   This file is part of the NeHeP library.                               *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __NHP_EVOLOG_H__
+#define __NHP_EVOLOG_H__
+
+#include <stdio.h>
+#include <pthread.h>
+#include <magic/mobject.h>
+#include <magic/mstring.h>
+#include <magic/mmap.h>
+
+using namespace MagiC;
+
+// Internals
+class LoggerThread;
+
+/** Writes the evolution log of a population in a background thread.
+ *
+ *  The population appends records to a lock-free ring buffer, and
+ *  the logger thread drains the buffer to the file. The values are
+ *  formatted to text in the logger thread, so neither the formatting
+ *  nor the disk are on the path of the evolution.
+ *
+ *  There are two kinds of records. A report carries the fitness
+ *  columns of a generation (see @ref SimplePopulation::report()) as
+ *  binary values, and a text record carries anything else written
+ *  to the log, such as the cycle reports of the environment. The
+ *  text can be written through a stdio stream given by @ref
+ *  textStream().
+ *
+ *  The log file is either in the usual text columns, or in a compact
+ *  binary format that is simply the sequence of the records. A
+ *  binary log can be converted to the text columns with @ref
+ *  convert().
+ *
+ *  The buffer is written to the file every N generations, every T
+ *  milliseconds, or only when the log is closed, as chosen with the
+ *  parameters. It is also written whenever it becomes half full.
+ **/
+class EvolutionLogger {
+  public:
+	enum formats	{TEXT=0, BINARY};
+	enum policies	{GENERATIONS=0, TIME, EXIT};
+
+	/** Creates the logger; the file is given with @ref open().
+	 *
+	 *  @param params["EvolutionLog.format"] Format of the log file,
+	 *  "text" or "binary". [Default:text]
+	 *  @param params["EvolutionLog.flush"] When the buffered records
+	 *  are written to the file: every few "generations", after some
+	 *  "time", or at "exit" when the log is closed. [Default:time]
+	 *  @param params["EvolutionLog.generations"] Generations between
+	 *  the writes with the "generations" policy. [Default:10]
+	 *  @param params["EvolutionLog.interval"] Milliseconds between the
+	 *  writes with the "time" policy. [Default:1000]
+	 *  @param params["EvolutionLog.bufferSize"] Size of the ring
+	 *  buffer in bytes, rounded up to a power of two. [Default:1048576]
+	 **/
+						EvolutionLogger	(const StringMap& params);
+
+	/** Closes the log. */
+						~EvolutionLogger	();
+
+	/** Starts logging to the given file, closing the previous one.
+	 *
+	 *  @throw exception if the file can not be opened.
+	 **/
+	void				open			(const String& file);
+
+	/** Writes the remaining records, stops the logger thread and
+	 *  closes the file.
+	 *
+	 *  @throw exception if writing the file failed.
+	 **/
+	void				close			();
+
+	/** Tells if a log file is open. */
+	bool				isOpen			() const {return mpThread != NULL;}
+
+	/** Returns a stdio stream whose output is appended to the log as
+	 *  text records, for use as the device of a @ref TextOStream. The
+	 *  stream is valid until the log is closed.
+	 **/
+	FILE*				textStream		() {return mpText;}
+
+	/** Appends text to the log. */
+	void				text			(const char* data, int bytes);
+
+	/** Appends a generation report: the minimum, average and maximum
+	 *  fitness, optionally followed by the nine mutability statistics
+	 *  of @ref MutabilityRecord. Text written to @ref textStream()
+	 *  before the report stays before it.
+	 **/
+	void				report			(int generation, const double* values, int n);
+
+	/** Tells that a generation has ended, for the "generations"
+	 *  policy.
+	 **/
+	void				endGeneration	();
+
+	/** Waits until everything logged so far has been written to the
+	 *  file.
+	 *
+	 *  @throw exception if writing the file failed.
+	 **/
+	void				flush			();
+
+	/** Returns the number of bytes written to the file. */
+	long				written			() const {return mWritten;}
+
+	/** Converts a binary log to the text columns.
+	 *
+	 *  @throw exception if the files can not be read or written, or
+	 *  the binary log is damaged.
+	 **/
+	static void			convert			(const String& binaryFile, const String& textFile);
+
+  private:
+	/** Appends a record to the ring buffer. Called only from the
+	 *  thread that owns the population.
+	 **/
+	void				put				(int kind, const void* data, int bytes);
+
+	/** Copies bytes to the ring buffer, starting at the given
+	 *  position.
+	 **/
+	void				poke			(unsigned int position, const void* data, int bytes);
+
+	/** Copies bytes out of the ring buffer, starting at the given
+	 *  position.
+	 **/
+	void				peek			(unsigned int position, void* data, int bytes) const;
+
+	/** Wakes up the logger thread to write the buffer. */
+	void				wake			();
+
+	/** Main loop of the logger thread. */
+	void				writerLoop		();
+
+	/** Writes the records in the buffer to the file. */
+	void				drain			();
+
+	/** Throws the error of the logger thread, if any. */
+	void				checkError		();
+
+	int					mFormat;		/**> See 'formats'. */
+	int					mPolicy;		/**> See 'policies'. */
+	int					mGenerations;	/**> Generations between the writes. */
+	int					mInterval;		/**> Milliseconds between the writes. */
+	int					mGeneration;	/**> Generations ended since the last write. */
+
+	FILE*				mpOut;			/**> The log file. */
+	FILE*				mpText;			/**> Stream for text records. */
+	LoggerThread*		mpThread;
+
+	char*				mpRing;			/**> Ring buffer of the records. */
+	char*				mpRecord;		/**> Record being written by the logger thread. */
+	unsigned int		mMask;			/**> Size of the ring buffer - 1. */
+	volatile unsigned int	mHead;		/**> Position where the next record is put. */
+	char				mPadding[64];	/**> Keep the positions in separate cache lines. */
+	volatile unsigned int	mTail;		/**> Position of the next record to write. */
+	unsigned int		mDrained;		/**> Position up to which the file has been written. */
+	long				mWritten;
+
+	pthread_mutex_t		mMutex;
+	pthread_cond_t		mWork;			/**> Signals that the buffer should be written. */
+	pthread_cond_t		mDone;			/**> Signals that the buffer was written. */
+	volatile bool		mWakeup;		/**> Has the logger thread been asked to write? */
+	bool				mQuit;
+	String				mError;			/**> Message of a failed write. */
+
+	friend class LoggerThread;
+
+	EvolutionLogger (const EvolutionLogger& o) {FORBIDDEN}
+	EvolutionLogger& operator= (const EvolutionLogger& o) {FORBIDDEN; return *this;}
+};
+
+#endif
@@ -33,8 +33,12 @@
 #ifndef __EAENVRNMNT_H__
 #define __EAENVRNMNT_H__
 
+#include <pthread.h>
+#include <stdint.h>
 #include <magic/mobject.h>
 #include <magic/mexception.h>
+#include <magic/mpararr.h>
+#include "nhp/checkpoint.h"
 
 using namespace MagiC;
 
@@ -62,6 +66,106 @@ class Ref : public Object {
 // Externals
 class Genome;
 class Individual;
+class GenomeHash;
+
+/** Accumulates the results of evaluations done by one thread.
+ *
+ *  Concurrent evaluators each keep their own record, so the
+ *  evaluations need no locking. At the end of the evaluation cycle,
+ *  the records are combined with @ref EAEnvironment::merge().
+ *
+ *  The item number given with @ref setItem() is the position of the
+ *  evaluated individual in the population. When several individuals
+ *  have the same fitness, the one with the lowest item number is
+ *  considered the best, just as it would be if the individuals were
+ *  evaluated serially in order.
+ **/
+class EvaluationRecord {
+  public:
+					EvaluationRecord	() {reset ();}
+
+	/** Clears the record for a new evaluation cycle. */
+	void			reset				();
+
+	/** Sets the item number of the individual being evaluated. */
+	void			setItem				(int item) {mItem = item;}
+
+	/** Combines another record with this one. */
+	void			add					(const EvaluationRecord& other);
+
+	double			bestfitn;		//< Lowest objective fitness, without noise.
+	double			bestFitness;	//< Lowest subjective fitness, with noise.
+	Individual*		pBest;			//< Individual having the best subjective fitness.
+	int				bestItem;		//< Item number of the best individual.
+	int				evals;			//< Number of evaluations done.
+
+  private:
+	int				mItem;			//< Item number of the individual being evaluated.
+
+	friend class EAEnvironment;
+};
+
+/** A bounded table of fitness values of genotypes, keyed by @ref
+ *  GenomeHash.
+ *
+ *  When the table is full, the least recently used entry is
+ *  replaced. The table is locked internally, so it can be used from
+ *  concurrent evaluators.
+ **/
+class FitnessCache {
+  public:
+	/** Creates a cache holding at most the given number of entries. */
+					FitnessCache		(int capacity);
+					~FitnessCache		();
+
+	/** Looks up the fitness of the genotype. Counts a hit or a miss.
+	 *
+	 *  @return TRUE if the fitness was found.
+	 **/
+	bool			lookup				(const GenomeHash& key, double& fitness);
+
+	/** Stores the fitness of the genotype. */
+	void			store				(const GenomeHash& key, double fitness);
+
+	/** Removes all entries. The hit and miss counts are kept. */
+	void			clear				();
+
+	/** Returns the maximum number of entries. */
+	int				capacity			() const {return mCapacity;}
+
+	/** Returns the current number of entries. */
+	int				size				() const {return mUsed;}
+
+	/** Returns the number of successful lookups. */
+	int				hits				() const {return mHits;}
+
+	/** Returns the number of failed lookups. */
+	int				misses				() const {return mMisses;}
+
+  private:
+	int				find				(const GenomeHash& key, int bucket) const;
+	int				bucketOf			(uint64_t low, uint64_t high) const;
+	void			unlink				(int entry);
+	void			pushFront			(int entry);
+
+	int					mCapacity;
+	int					mUsed;			//< Number of entries in use.
+	int					mHits;
+	int					mMisses;
+	PackArray<uint64_t>	mKeyLow;		//< Keys of the entries.
+	PackArray<uint64_t>	mKeyHigh;
+	PackArray<double>	mFitness;		//< Fitness of the entries.
+	PackArray<int>		mChain;			//< Next entry in the same bucket, or -1.
+	PackArray<int>		mPrev;			//< Previous entry in LRU order, or -1.
+	PackArray<int>		mNext;			//< Next entry in LRU order, or -1.
+	PackArray<int>		mBuckets;		//< First entry of each bucket, or -1.
+	int					mHead;			//< Most recently used entry.
+	int					mTail;			//< Least recently used entry.
+	pthread_mutex_t		mLock;
+
+	FitnessCache (const FitnessCache& o) {FORBIDDEN}
+	FitnessCache& operator= (const FitnessCache& o) {FORBIDDEN; return *this;}
+};
 
 /** The abstract base class for environments ("objective functions")
  *  where the fitness of Individuals is measured.
@@ -84,6 +188,7 @@ class EAEnvironment : public Object {
   public:
 
 					EAEnvironment	();
+					~EAEnvironment	();
 
 	/** Sets the number of evaluations to be done for each individual
 	 *  to determine it's fitness. This is useful only if the fitness
@@ -111,8 +216,74 @@ class EAEnvironment : public Object {
 	 **/
 	void			addnoise		(double stddev) {mNoise = stddev;}
 
+	/** Sets the size of the fitness cache. When the cache is in use,
+	 *  the fitness of a genotype that was evaluated recently is taken
+	 *  from the cache instead of evaluating it again. Zero disables
+	 *  the cache.
+	 *
+	 *  The cache is bypassed when artificial noise is added or
+	 *  several evaluations are done per individual, as the
+	 *  evaluations are then not deterministic. It should not be used
+	 *  with noisy or changing fitness functions either.
+	 **/
+	void			setFitnessCache	(int size);
+
+	/** Returns the fitness cache, or NULL if not in use. */
+	const FitnessCache*	fitnessCache	() const {return mpFitnessCache;}
+
+	/** Evaluates the fitness of an individual and records the best
+	 *  fitness in the environment. Not thread-safe; concurrent
+	 *  evaluators should use the variant with an @ref
+	 *  EvaluationRecord.
+	 **/
 	double			evaluate		(const Individual& indiv);
 
+	/** Evaluates the fitness of an individual and records the best
+	 *  fitness in the given record instead of the environment. Can be
+	 *  called concurrently from several threads as long as each uses
+	 *  its own record and @ref evaluateg() is thread-safe.
+	 **/
+	double			evaluate		(const Individual& indiv, EvaluationRecord& record);
+
+	/** Returns the largest number of individuals that the
+	 *  environment evaluates at once with @ref evaluateBatch(), or 0
+	 *  if it evaluates only one individual at a time with @ref
+	 *  evaluateg(), which is the default.
+	 **/
+	virtual int		batchWidth		() const {return 0;}
+
+	/** Measures the fitnesses of a block of at most @ref batchWidth()
+	 *  individuals with @ref evaluateBatch(), taking them from the
+	 *  fitness cache if possible. Each measured fitness must then be
+	 *  recorded with the evaluate() that takes the measured fitness,
+	 *  in the order of the individuals.
+	 *
+	 *  Can be called concurrently like the evaluate() with a record.
+	 *  Genotypes that occur twice in the same block are both
+	 *  evaluated even if the cache is in use.
+	 *
+	 *  @param fitness The measured fitnesses are stored here.
+	 *  @param evaluated Tells for each individual if it was really
+	 *  evaluated rather than taken from the cache.
+	 **/
+	void			measureBatch	(const Individual* const* indivs, int n,
+									 double* fitness, bool* evaluated);
+
+	/** Records the fitness of an individual measured with @ref
+	 *  measureBatch(), like the evaluate() with a record does for
+	 *  the fitness it measures itself.
+	 *
+	 *  @return The fitness, with the artificial noise if any.
+	 **/
+	double			evaluate		(const Individual& indiv, double fitness, bool evaluated,
+									 EvaluationRecord& record);
+
+	/** Stores the results of concurrent evaluations in the
+	 *  environment. The records must be merged after all the
+	 *  evaluations of the cycle are done, from one thread.
+	 **/
+	void			merge			(const EvaluationRecord& record);
+
 	/** Sets evolution log directory for cycle reports and
 	 *  miscellaneous log files.
 	 **/
@@ -121,7 +292,16 @@ class EAEnvironment : public Object {
 	/** Prints out a generation report to the given brief log stream
 	 *  and more verbose output stream.
 	 **/
-	void			cycleReport		(OStream& log, OStream& out) {mCycles++; cycle_report(log,out);}
+	void			cycleReport		(OStream& log, OStream& out);
+
+	/** Writes the counters and the best fitness to a checkpoint.
+	 *  Environments that change during the evolution can extend
+	 *  this to save their own state.
+	 **/
+	virtual void	saveState		(CheckpointOStream& out) const;
+
+	/** Reads the state written with @ref saveState(). */
+	virtual void	loadState		(CheckpointIStream& in);
 	
 	// Virtual methods
 	
@@ -129,6 +309,14 @@ class EAEnvironment : public Object {
 	 **/
 	virtual void	addFeaturesTo	(Genome& genome) const {;}
 
+	/** Called once with the complete template genome of the
+	 *  population, before any evaluations. Environments can resolve
+	 *  the paths of the genes they read here (see @ref
+	 *  Gentainer::resolve()), to avoid seeking them by name in every
+	 *  evaluation.
+	 **/
+	virtual void	resolveGenes	(const Genome& templ) {;}
+
 	/** Initializes a generation. Not necessary in all models.
 	 **/
 	virtual void	init_cycle		() {mBestFitness = 99999999.0; mpBest = NULL;}
@@ -151,6 +339,23 @@ class EAEnvironment : public Object {
 	 **/
 	virtual double	evaluateg		(const Individual& ind) {MUST_OVERLOAD; return 0.0;}
 
+	/** Evaluates the fitness of a block of individuals, storing
+	 *  them in the given array. Environments that can evaluate many
+	 *  individuals faster at once, for example by computing the
+	 *  fitness function over a matrix of their gene values, overload
+	 *  this together with @ref batchWidth(). The default calls
+	 *  @ref evaluateg() for each individual.
+	 *
+	 *  Must be thread-safe, as the population calls it concurrently
+	 *  for different blocks.
+	 **/
+	virtual void	evaluateBatch	(const Individual* const* indivs, int n, double* fitness);
+
+	/** Measures the fitness of the individual, using the fitness
+	 *  cache if possible. Tells if a real evaluation was done.
+	 **/
+	double			measure			(const Individual& ind, bool& evaluated);
+
 	/** Prints some statistics or something at the end of the evaluation cycle.
 	 **/
 	virtual void	cycle_report	(OStream& log, OStream& out) {;}
@@ -171,6 +376,7 @@ class EAEnvironment : public Object {
 	 **/
 	double			mBestFitness;
 	String			mLogDir; //< Directory for gathering evolution logs.
+	FitnessCache*	mpFitnessCache; //< Fitness cache, or NULL if not in use.
 
 	// mutable ThreadLock	mLock;
 };
@@ -0,0 +1,91 @@
+/***************************************************************************
+ *   This file is part of the NeHeP library.                               *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __NHP_GENEPOOL_H__
+#define __NHP_GENEPOOL_H__
+
+#include <stddef.h>
+
+/** Slab allocator for the many small objects of the genomes.
+ *
+ *  @ref Genstruct and @ref Individual allocate themselves from the
+ *  pool through their class-specific operator new and delete. Blocks
+ *  are taken in multiples of GRANULE bytes from slabs of SLAB_SIZE
+ *  bytes, and freed blocks are kept in a free list of their size
+ *  class for reuse. Objects larger than MAX_SIZE use the global
+ *  allocator.
+ *
+ *  Each thread has a slab and free lists of its own, so allocation
+ *  normally needs no locking, and the genes of a genome replicated in
+ *  one thread lie close to each other in memory. A block may be freed
+ *  in another thread than the one that allocated it; it then moves
+ *  to the free list of the freeing thread. A thread that gathers
+ *  more than two slabs' worth of free blocks of a size class passes
+ *  a slab's worth to a shared depot, and a thread whose free list is
+ *  empty takes blocks from the depot before cutting new ones. When a
+ *  thread exits, its free blocks and the rest of its slab go to the
+ *  depot, so threads created again and again, such as the island
+ *  threads of a @ref Metapopulation, reuse the same memory. The slabs
+ *  are never returned to the system, so the pool keeps the largest
+ *  amount of memory it has needed.
+ *
+ *  The pool is not per-population, because individuals migrate
+ *  between populations and genes outlive the population they were
+ *  created in.
+ *
+ *  Compiling the library with NHP_NO_GENEPOOL defined makes the pool
+ *  forward everything to the global allocator, for example for memory
+ *  debuggers.
+ **/
+class GenePool {
+  public:
+	enum {GRANULE=16, MAX_SIZE=512, SLAB_SIZE=64*1024};
+
+	/** Allocates a block of at least the given size. */
+	static void*		allocate		(size_t size);
+
+	/** Frees a block. The size must be the one given to @ref
+	 *  allocate().
+	 **/
+	static void			release			(void* p, size_t size);
+
+	/** Tells if the library was compiled to use the pool. */
+	static bool			enabled			();
+
+	/** Returns the number of bytes reserved for the slabs of all
+	 *  threads.
+	 **/
+	static long			reserved		();
+};
+
+/** Makes a class, and the classes inheriting it, allocate their
+ *  objects from the @ref GenePool. The class must have a virtual
+ *  destructor, so that the size of the actual class is given to
+ *  delete.
+ **/
+#define NHP_GENEPOOL_ALLOCATED \
+	static void*	operator new	(size_t size) {return GenePool::allocate (size);} \
+	static void		operator delete	(void* p, size_t size) {GenePool::release (p, size);}
+
+#endif
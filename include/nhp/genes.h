@@ -25,8 +25,10 @@
 #ifndef __GENES_H__
 #define __GENES_H__
 
+#include <stdint.h>
 #include <magic/mobject.h>
 #include <magic/mdatastream.h>
+#include <magic/mpararr.h>
 #include "nhp/genetics.h"
 
 // Is it a bool? Is it a double? No! It's the SuperGene!
@@ -109,6 +111,9 @@ class gclass : public Gene { \
 	bool				pointMutate			(const MutationRate& k) {return false;}\
 	void				copy				(const Genstruct& o) {Gene::copy(o);}\
 	Genstruct*			replicate			() const {return new gclass (id);}\
+	void				hash				(GenomeHash& h) const {;}\
+	void				saveState			(CheckpointOStream& out) const {;}\
+	void				loadState			(CheckpointIStream& in) {;}\
 	bool				execute				(const GeneticMsg& msg) const;\
 	void				addPrivateGenes		(Gentainer& g, const StringMap& params);\
 };
@@ -178,6 +183,14 @@ class BinaryGene : public Gene {
 	 *  parameter is usefor for us.
 	 **/
 	virtual bool			pointMutate	(const MutationRate& k);
+
+	/** Implementation for @ref Genstruct. Binary genes mutate with
+	 *  the binary rate times their mutability.
+	 **/
+	virtual int				mutationSite	(double& coef) const {coef=mutability; return MutationSites::BINARY;}
+
+	/** Implementation for @ref Genstruct. Flips the bit. */
+	virtual void			forceMutate		(const MutationRate& k) {mValue = mValue? 0:1;}
 	/** Implementation for @ref Genstruct. The distance is calculated
 	 *  as trivial case of Hamming distance.
 	 **/
@@ -188,6 +201,9 @@ class BinaryGene : public Gene {
 	virtual void			copy		(const Genstruct& other);
 	/** Implementation for @ref Genstruct */
 	virtual Genstruct*		replicate	() const {return new BinaryGene (*this);}
+	virtual void			hash		(GenomeHash& h) const {h.add (uint64_t (mValue));}
+	virtual void			saveState	(CheckpointOStream& out) const {out.putBool (mValue);}
+	virtual void			loadState	(CheckpointIStream& in) {mValue = in.getBool ();}
 	/** Implementation for @ref Genstruct */
 	virtual void			print		(TextOStream& out) const;
 	/** Implementation for @ref Object */
@@ -208,6 +224,109 @@ class BinaryGene : public Gene {
 
 
 
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//                    P a c k e d   B i t   G e n t a i n e r                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/** A sequence of binary values packed in 64-bit words.
+ *
+ *  Behaves like a @ref Gentainer holding a @ref BinaryGene for each
+ *  bit, but without the memory and call overhead of a separate object
+ *  per bit. The bits come first in the sequence and any
+ *  substructures, such as the private genes added with @ref
+ *  addPrivateGenes(), after them. The recombination and mutation work
+ *  on whole words:
+ *
+ *  - Mutation flips each bit with the binary mutation rate, drawing
+ *    the distance to the next flipped bit from the geometric
+ *    distribution instead of drawing a random number for each bit.
+ *  - Crossover copies the segments between the crossover points
+ *    with word masks.
+ *  - Equality counts the equal bits with a population count.
+ *
+ *  The bits can not be accessed by name; use @ref get() or @ref
+ *  getBits() instead.
+ **/
+class PackedBitGentainer : public Gentainer {
+	decl_dynamic (PackedBitGentainer);
+  public:
+
+	/** Standard constructor.
+	 *
+	 *  @param name Name of the structure.
+	 *  @param bits Number of bits.
+	 *  @param initP Probability of value 1 in initialization.
+	 **/
+							PackedBitGentainer	(const GeneticID& name=NULL, int bits=0, double initP=0.5);
+							PackedBitGentainer	(const PackedBitGentainer& orig);
+
+	/** Returns the number of bits. */
+	int						bits		() const {return mBitCount;}
+
+	/** Returns the value of the i:th bit. */
+	bool					get			(int i) const {return (mWords[i>>6] >> (i&63)) & 1;}
+
+	/** Sets the value of the i:th bit. */
+	void					set			(int i, bool value) {
+		if (value)
+			mWords[i>>6] |= uint64_t(1) << (i&63);
+		else
+			mWords[i>>6] &= ~(uint64_t(1) << (i&63));
+	}
+
+	/** Returns n (at most 64) bits starting from the given position
+	 *  as an integer, the first bit being the least significant.
+	 **/
+	uint64_t				getBits		(int first, int n) const;
+
+	/** Returns the number of differing bits in the two sequences. */
+	int						hamming		(const PackedBitGentainer& other) const;
+
+	// Implementations
+
+	virtual void				init		();
+	virtual bool				pointMutate	(const MutationRate& k);
+	/** Implementation for @ref Genstruct. The bits are mutated by the
+	 *  container itself, so it is always a site as a whole.
+	 **/
+	virtual void				collectMutationSites	(MutationSites& sites) {sites.add (this, MutationSites::ALWAYS, 1.0);}
+	virtual void				recombine	(const Genstruct& a, const Genstruct& b);
+	virtual double				equality	(const Genstruct& other) const;
+	virtual Genstruct*			replicate	() const {return new PackedBitGentainer (*this);}
+	virtual void				hash		(GenomeHash& h) const;
+	virtual void				saveState	(CheckpointOStream& out) const;
+	virtual void				loadState	(CheckpointIStream& in);
+	virtual void				copy		(const Genstruct& other);
+	virtual void				print		(TextOStream& out) const;
+	virtual DataOStream&		operator>>	(DataOStream& out) const;
+	virtual void				check		() const;
+
+  protected:
+	virtual int			calc_len	() const {return mBitCount + Gentainer::calc_len ();}
+
+	/** Flips each bit with probability p. Returns true if any bit
+	 *  was flipped.
+	 **/
+	bool				mutateBits	(double p);
+
+	/** Copies bits [from,to) from the other sequence. */
+	void				copyBits	(const PackedBitGentainer& other, int from, int to);
+
+	/** Clears the unused bits at the end of the last word. */
+	void				clearTail	();
+
+	PackArray<uint64_t>	mWords;		/**> The bits, 64 in each word. */
+	int					mBitCount;	/**> Number of bits. */
+	double				mInitP;		/**> Probability of value 1 in initialization. */
+
+  private:
+	PackedBitGentainer& operator= (const PackedBitGentainer& orig) {FORBIDDEN; return *this;}
+};
+
+
+
 //////////////////////////////////////////////////////////////////////////////
 //                                                                          //
 //       _               ----- |                 ----                       //
@@ -380,6 +499,16 @@ class FloatGene : public AnyFloatGene {
 	 **/
 	virtual bool			pointMutate	(const MutationRate& k);
 
+	/** Implementation for @ref Genstruct. Genes with a custom mutator
+	 *  mutate every time, genes with an empty range never.
+	 **/
+	virtual int				mutationSite	(double& coef) const;
+
+	/** Implementation for @ref Genstruct. Adds a Gaussian change to
+	 *  the value, or lets the mutator change it.
+	 **/
+	virtual void			forceMutate		(const MutationRate& k);
+
 	/** Implementation for @ref Genstruct.
 	 *
 	 *  Genetic distance is measured as real-valued distance between
@@ -390,6 +519,9 @@ class FloatGene : public AnyFloatGene {
 	virtual double			equality	(const Genstruct& other) const;
 	virtual void			copy		(const Genstruct& other);
 	virtual Genstruct*		replicate	() const {return new FloatGene (*this);}
+	virtual void			hash		(GenomeHash& h) const {h.add (value);}
+	virtual void			saveState	(CheckpointOStream& out) const {out.putDouble (value); out.putDouble (mVariance);}
+	virtual void			loadState	(CheckpointIStream& in) {value = in.getDouble (); mVariance = in.getDouble ();}
 	virtual void			print		(TextOStream& out) const;
 	virtual void			check		() const;
 	
@@ -417,6 +549,133 @@ class FloatGene : public AnyFloatGene {
 
 
 
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//                  F l o a t   V e c t o r   G e n e                        //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/** A vector of native floating-point values, each of which behaves
+ *  like a @ref FloatGene with the default Gaussian mutation.
+ *
+ *  Large homogeneous genomes of thousands of @ref FloatGene objects
+ *  spend most of their time in virtual calls and in following
+ *  pointers to the individual gene objects. This gene stores the
+ *  values, value ranges and local variances in contiguous arrays
+ *  instead, so mutation, crossover and copying are simple loops over
+ *  the arrays.
+ *
+ *  The vector counts as dim() genes in the length of the genome, but
+ *  the containing @ref Gentainer places its crossovers over its
+ *  substructures, so the vector gets at most one crossover like any
+ *  other gene. The crossover point within the vector is drawn
+ *  uniformly.
+ *
+ *  The elements can not be accessed by name; use @ref getvalue(int)
+ *  instead.
+ **/
+class FloatVectorGene : public Gene {
+	decl_dynamic (FloatVectorGene);
+  public:
+
+	/** Default constructor, FORBIDDEN! Exists only because of RTTI system.
+	 **/
+							FloatVectorGene	() {FORBIDDEN}
+
+	/** Standard constructor.
+	 *
+	 * @param id Name of the gene.
+	 * @param dim Number of elements.
+	 * @param min Lower limit for the values of all elements.
+	 * @param max Upper limit for the values of all elements.
+	 * @param m Mutation coefficient.
+	 **/
+							FloatVectorGene	(const GeneticID& id, int dim, double min, double max,
+											 double m=1.0);
+							FloatVectorGene	(const FloatVectorGene& o) : Gene (o) {
+								shallowCopy (o);
+							}
+
+	/** Returns the number of elements. */
+	int						dim			() const {return mValues.size();}
+
+	/** Returns the value of the i:th element. */
+	double					getvalue	(int i) const {return mValues[i];}
+
+	/** Returns the values of all elements. */
+	const PackArray<double>&	getvalues	() const {return mValues;}
+
+	/** Sets the value of the i:th element. */
+	FloatVectorGene&		set			(int i, double val) {mValues[i] = val; return *this;}
+
+	/** Sets the value range of the i:th element. An empty range
+	 *  makes the element immutable.
+	 **/
+	FloatVectorGene&		setRange	(int i, double min, double max);
+
+	/** Sets the local variance modifier of the i:th element. */
+	FloatVectorGene&		setVariance	(int i, double var) {mVariance[i] = var; return *this;}
+
+	/** Sets a customized mutation operator for the elements, as with
+	 *  @ref FloatGene::setMutator(). As with @ref FloatGene, every
+	 *  element is then mutated regardless of the mutation rate, with
+	 *  its local variance times the mutation variance. The elements
+	 *  are passed to @ref FloatMutator::mutateBatch() in blocks.
+	 **/
+	FloatVectorGene&		setMutator	(FloatMutator* m) {mMutator=m; return *this;}
+
+	// Implementations
+
+	/** Implementation for @ref Genstruct. Initializes each element
+	 *  with a uniformly distributed random value.
+	 **/
+	virtual void			init		();
+
+	/** Implementation for @ref Genstruct. Mutates each element with
+	 *  the floating-point mutation rate, adding a normally
+	 *  distributed change with the mutation variance times the local
+	 *  variance of the element. The result is limited to the value
+	 *  range. If a mutator has been set, it mutates the elements
+	 *  instead.
+	 **/
+	virtual bool			pointMutate	(const MutationRate& k);
+
+	/** Implementation for @ref Genstruct. Makes a single crossover
+	 *  at a uniformly drawn point within the vector. As with @ref
+	 *  Gentainer::recombine(), the elements before the point come
+	 *  from the second parent b and the rest from the first parent a.
+	 **/
+	virtual void			recombine	(const Genstruct& a, const Genstruct& b);
+
+	/** Implementation for @ref Genstruct. Sum of the distances of the
+	 *  elements, as with a set of @ref FloatGene genes.
+	 **/
+	virtual double			equality	(const Genstruct& other) const;
+	virtual void			copy		(const Genstruct& other);
+	virtual Genstruct*		replicate	() const {return new FloatVectorGene (*this);}
+	virtual void			hash		(GenomeHash& h) const;
+	virtual void			saveState	(CheckpointOStream& out) const;
+	virtual void			loadState	(CheckpointIStream& in);
+	virtual void			print		(TextOStream& out) const;
+	virtual DataOStream&	operator>>	(DataOStream& out) const;
+	virtual void			check		() const;
+
+  protected:
+	virtual int				calc_len	() const {return mValues.size();}
+
+	PackArray<double>	mValues;	/**> Genotypic values of the elements. */
+	PackArray<double>	mMin;		/**> Lower limits of the values. */
+	PackArray<double>	mMax;		/**> Upper limits of the values. */
+	PackArray<double>	mVariance;	/**> Local variance modifiers for mutation. */
+	FloatMutator*		mMutator;	/**> Mutation method, NULL for the default. */
+
+  private:
+	void					shallowCopy	(const FloatVectorGene& o);
+	FloatVectorGene&		operator=	(const FloatVectorGene& orig) {FORBIDDEN; return *this;}
+};
+
+
+
 //////////////////////////////////////////////////////////////////////////////
 //                                                                          //
 //        ----  o     ----- |                 ----                          //
@@ -434,6 +693,9 @@ class FloatGene : public AnyFloatGene {
  *  The encoding has two modes: linear and Gray-encoded. In linear
  *  mode the value is simply a sum of bits: SUM(i=0..n-1) b(i)*2^i,
  *  where b(i) is the i:th bit in the genetic sequence b.
+ *
+ *  The value is decoded whenever the bits change, so @ref getvalue()
+ *  only returns the decoded value.
  **/
 class BitFloatGene : public AnyFloatGene {
   public:
@@ -460,18 +722,19 @@ class BitFloatGene : public AnyFloatGene {
 								shallowCopy (o);
 							}
 
-	virtual double			getvalue		() const;
-	BitFloatGene*			setGrayCoding	(bool isg=true) {mGrayCoded=isg; return NULL;}
+	virtual double			getvalue		() const {return mValue;}
+	BitFloatGene*			setGrayCoding	(bool isg=true) {mGrayCoded=isg; decode (); return NULL;}
 	
 	// Implementations
 		
 	/** Initializes the bits totally randomly. */
-	virtual void			init		() {mBits.init();}
+	virtual void			init		() {mBits.init(); decode ();}
 	
-	/** The point mutation forwards the mutation to the @ref Gentainer
-	 *  holding the @ref BinaryGene bits that encode the integer value.
+	/** The point mutation forwards the mutation to the @ref
+	 *  PackedBitGentainer holding the bits that encode the integer
+	 *  value.
 	 **/
-	virtual bool			pointMutate	(const MutationRate& k) {return mBits.pointMutate (k);}
+	virtual bool			pointMutate	(const MutationRate& k);
 
 	/** The genetic distance is calculated as the Hamming distance
 	 *  between the bits that encode the integer value. This might
@@ -479,17 +742,31 @@ class BitFloatGene : public AnyFloatGene {
 	 *  more important than others. It might be more appropriate to
 	 *  use the difference between getvalue() decoded values.
 	 **/
-	virtual double			equality	(const Genstruct& o) const {mBits.equality(o); return 0.0;}
+	virtual double			equality	(const Genstruct& o) const {
+		return mBits.equality (static_cast<const BitFloatGene&>(o).mBits);
+	}
 	virtual void			copy		(const Genstruct& other);
 	virtual Genstruct*		replicate	() const {return new BitFloatGene (*this);}
+	virtual void			hash		(GenomeHash& h) const {mBits.hash (h);}
+	virtual void			saveState	(CheckpointOStream& out) const {mBits.saveState (out);}
+	virtual void			loadState	(CheckpointIStream& in) {mBits.loadState (in); decode ();}
 	virtual void			print		(TextOStream& out) const;
 	virtual void			recombine	(const Genstruct& a, const Genstruct& b);
 	virtual void			check		() const;
 
   protected:
-	/** Actual @ref BinaryGene sequence encoding the floating-point value.
+	/** Decodes the value from the bits. */
+	double					decodeBits	() const;
+
+	/** Updates the decoded value after the bits have changed. */
+	void					decode		() {mValue = decodeBits ();}
+
+	/** Actual bit sequence encoding the floating-point value.
 	 **/
-	Gentainer		mBits;
+	PackedBitGentainer	mBits;
+
+	/** The value decoded from mBits. */
+	double			mValue;
 
 	/** Number of bits in the genetic representation of the
 	 *  floating-point value. This could be calculated from the mBits
@@ -635,6 +912,14 @@ class IntGene : public AnyIntGene {
 	 **/
 	virtual bool			pointMutate	(const MutationRate& k);
 
+	/** Implementation for @ref Genstruct. Integer genes mutate with
+	 *  the integer rate times their mutability.
+	 **/
+	virtual int				mutationSite	(double& coef) const {coef=mutability; return MutationSites::INT;}
+
+	/** Implementation for @ref Genstruct. Draws a new value. */
+	virtual void			forceMutate		(const MutationRate& k) {init ();}
+
 	/** Implementation for @ref Genstruct. The distance measure for
 	 *  two integer genes is 0.0 if they are equal, and 1.0 if they
 	 *  are different.
@@ -642,6 +927,9 @@ class IntGene : public AnyIntGene {
 	virtual double			equality	(const Genstruct& other) const;
 	virtual void			copy		(const Genstruct& other);
 	virtual Genstruct*		replicate	() const {return new IntGene (*this);}
+	virtual void			hash		(GenomeHash& h) const {h.add (uint64_t (mValue));}
+	virtual void			saveState	(CheckpointOStream& out) const {out.putInt (mValue);}
+	virtual void			loadState	(CheckpointIStream& in) {mValue = in.getInt ();}
 	virtual void			print		(TextOStream& out) const;
 	virtual void			check		() const;
 
@@ -694,9 +982,10 @@ class BitIntGene : public AnyIntGene {
 								shallowCopy (o);
 							}
 
-	/** Returns the decoded phenotypic value of the gene.
+	/** Returns the decoded phenotypic value of the gene. The value is
+	 *  decoded whenever the bits change.
 	 **/
-	virtual int				getvalue		() const;
+	virtual int				getvalue		() const {return mValue;}
 
 	/** Sets the Gray coding mode on (true) or off (false).
 	 *
@@ -707,34 +996,48 @@ class BitIntGene : public AnyIntGene {
 	 *
 	 * @return Returns self.
 	 **/
-	BitIntGene*				setGrayCoding	(bool gray=true) {mGrayCoded=gray; return this;}
+	BitIntGene*				setGrayCoding	(bool gray=true) {mGrayCoded=gray; decode (); return this;}
 	
 	// Implementations
 
 	/** Initializes the bits totally randomly. */
-	virtual void			init		() {mBits.init();}
+	virtual void			init		() {mBits.init(); decode ();}
 
-	/** The point mutation forwards the mutation to the @ref Gentainer
-	 *  holding the @ref BinaryGene bits that encode the integer value.
+	/** The point mutation forwards the mutation to the @ref
+	 *  PackedBitGentainer holding the bits that encode the integer
+	 *  value.
 	 **/
-	virtual bool			pointMutate	(const MutationRate& k) {return mBits.pointMutate (k);}
+	virtual bool			pointMutate	(const MutationRate& k);
 
 	/** The genetic distance is calculated as the Hamming distance
 	 *  between the bits that encode the integer value. If the values
 	 *  of the bits do not have an equal significanse for the
 	 *  phenotype, this way of calculating may not be what you want.
 	 **/
-	virtual double			equality	(const Genstruct& o) const {return mBits.equality(o);}
+	virtual double			equality	(const Genstruct& o) const {
+		return mBits.equality (static_cast<const BitIntGene&>(o).mBits);
+	}
 	virtual void			copy		(const Genstruct& other);
 	virtual Genstruct*		replicate	() const {return new BitIntGene (*this);}
+	virtual void			hash		(GenomeHash& h) const {mBits.hash (h);}
+	virtual void			saveState	(CheckpointOStream& out) const {mBits.saveState (out);}
+	virtual void			loadState	(CheckpointIStream& in) {mBits.loadState (in); decode ();}
 	virtual void			print		(TextOStream& out) const;
 	virtual void			recombine	(const Genstruct& a, const Genstruct& b);
 	virtual void			check		() const;
 
   protected:
+	/** Decodes the value from the bits. */
+	int						decodeBits	() const;
+
+	/** Updates the decoded value after the bits have changed. */
+	void					decode		() {mValue = decodeBits ();}
 
 	/** Binary gene vector. */
-	Gentainer	mBits;
+	PackedBitGentainer	mBits;
+
+	/** The value decoded from mBits. */
+	int			mValue;
 
 	/** Number of bits in the vector. This can be calculated from the
 	 *  mBits @ref Gentainer, but that would be slow, so we cache the
@@ -792,6 +1095,10 @@ class InterGene : public Gene {
 	virtual bool			execute		(const GeneticMsg& msg) const;
 	virtual void			print		(TextOStream& out) const;
 	virtual bool			pointMutate	(const MutationRate& k) {return false;}
+	virtual int				mutationSite	(double& coef) const {coef=0.0; return MutationSites::NONE;}
+	/** Implementation for @ref Genstruct. The gene has no values of its own. */
+	virtual void			saveState	(CheckpointOStream& out) const {;}
+	virtual void			loadState	(CheckpointIStream& in) {;}
 
   private:
 	void					shallowCopy	(const InterGene& o) {targetGene=o.targetGene;}
@@ -42,9 +42,13 @@
 #ifndef __GENETICS_H__
 #define __GENETICS_H__
 
+#include <stdint.h>
 #include <magic/mobject.h>
 #include <magic/mstring.h>
 #include <magic/mmap.h>
+#include <magic/mpararr.h>
+#include "nhp/checkpoint.h"
+#include "nhp/genepool.h"
 
 using namespace MagiC;
 
@@ -142,6 +146,72 @@ class GeneticMsg {
 /** Hmm, could this be active? Hmm, could this be genetically encoded?
 	Hmm, many deep questions. **/
 
+/** Compiled location of a gene within a @ref Gentainer.
+ *
+ *  The path is the sequence of substructure indices leading from the
+ *  container to the gene. It is created once with @ref
+ *  Gentainer::resolve(), typically from the template genome of a
+ *  population, and can then be used with @ref
+ *  Gentainer::getGene(const GenePath&) for any genome having the
+ *  same structure. The lookup involves no string comparisons.
+ **/
+class GenePath : public Object {
+  public:
+					GenePath		() {}
+
+	/** Returns the number of steps in the path. */
+	int				depth			() const {return mSteps.size();}
+
+	/** Returns the substructure index of the given step. */
+	int				operator[]		(int i) const {return mSteps[i];}
+
+  private:
+	PackArray<int>	mSteps;
+
+	friend class Gentainer;
+};
+
+/** 128-bit hash of the contents of a @ref Genstruct, computed with
+ *  @ref Genstruct::hash().
+ *
+ *  Two structures with the same gene values have the same hash, so
+ *  it can be used as a key for remembering the fitness of a
+ *  genotype. Structures that can not tell their contents invalidate
+ *  the hash.
+ **/
+class GenomeHash {
+  public:
+					GenomeHash		() {mLow=0x9E3779B97F4A7C15ULL; mHigh=0xC2B2AE3D27D4EB4FULL; mValid=true;}
+
+	/** Adds a word to the hash. */
+	void			add				(uint64_t word);
+
+	/** Adds a floating-point value to the hash. */
+	void			add				(double value);
+
+	/** Adds a string to the hash. */
+	void			add				(const String& text);
+
+	/** Marks the hash unusable. */
+	void			invalidate		() {mValid=false;}
+
+	/** Tells if all the hashed structures could be hashed. */
+	bool			isValid			() const {return mValid;}
+
+	/** Returns the lower half of the hash. */
+	uint64_t		low				() const {return mLow;}
+
+	/** Returns the upper half of the hash. */
+	uint64_t		high			() const {return mHigh;}
+
+	bool			operator==		(const GenomeHash& o) const {return mLow==o.mLow && mHigh==o.mHigh;}
+
+  private:
+	uint64_t		mLow;
+	uint64_t		mHigh;
+	bool			mValid;
+};
+
 
 //////////////////////////////////////////////////////////////////////////////
 //                                                                          //
@@ -163,12 +233,14 @@ class MutationRate {
 	double			mFloatVariance;
 	bool			mOneBitMutation;
 	bool			mAutoAdaptation;
+	bool			mSkipSampling;
 	//FloatMutator*	mFloatMutator;
   public:
 						MutationRate	() {
 							mBinaryRate=mIntRate=mFloatRate=mFloatVariance=0.0;
 							mOneBitMutation=false;
 							mAutoAdaptation=false;
+							mSkipSampling=false;
 						}
 
 						MutationRate	(const MutationRate& o) {
@@ -186,6 +258,7 @@ class MutationRate {
 							mFloatVariance = o.mFloatVariance * m.mFloatVariance;
 							mOneBitMutation = o.mOneBitMutation || m.mOneBitMutation;
 							mAutoAdaptation = o.mAutoAdaptation || m.mAutoAdaptation;
+							mSkipSampling = o.mSkipSampling || m.mSkipSampling;
 						}
 	
 	/** Reads the mutation rates from the given gentainer
@@ -230,10 +303,89 @@ class MutationRate {
 	/** Returns the state of autoadaptivity */
 	bool				autoAdaptation	() const {return mAutoAdaptation;}
 
+	/** Setting this to TRUE makes @ref Gentainer objects mutate
+	 *  their genes with geometric skip-sampling (see @ref
+	 *  MutationSites) instead of visiting every gene.
+	 **/
+	void				skipSampling	(bool ss) {mSkipSampling=ss;}
+
+	/** Writes the rates to a checkpoint. */
+	void				saveState		(CheckpointOStream& out) const;
+
+	/** Reads the rates written with @ref saveState(). */
+	void				loadState		(CheckpointIStream& in);
+
+	/** Returns the skip-sampling mode flag. */
+	bool				skipSampling	() const {return mSkipSampling;}
+
   private:
 	MutationRate& operator= (const MutationRate& orig) {FORBIDDEN; return *this;}
 };
 
+/** Flattened list of the mutation sites within a @ref Gentainer, for
+ *  mutating it with geometric skip-sampling.
+ *
+ *  Most genes mutate with a fixed probability: the mutation rate of
+ *  their kind times their own mutability coefficient. The sites of
+ *  each kind are kept in their own list. Instead of drawing a random
+ *  number for every site, the distance to the next candidate site is
+ *  drawn from the geometric distribution with the largest probability
+ *  p_max of the list. A candidate with probability p is then
+ *  mutated with probability p/p_max. Each site is thus mutated
+ *  independently with exactly its own probability, and the number of
+ *  random draws is proportional to the number of mutations rather
+ *  than to the number of genes.
+ *
+ *  Structures that do not mutate with a fixed probability, such as
+ *  genes with a custom mutator or self-adjusting containers, are
+ *  listed as ALWAYS sites, and their pointMutate() is called every
+ *  time.
+ *
+ *  The largest coefficients are taken when the list is built. If a
+ *  coefficient has grown since, the candidates are still handled
+ *  correctly up to p_max, and the owner rebuilds the list for the
+ *  next mutation.
+ **/
+class MutationSites {
+  public:
+	/** Kinds of mutation sites. BINARY, INT and FLOAT sites mutate
+	 *  with the binary, integer and floating-point mutation rates of
+	 *  @ref MutationRate. NONE sites never mutate.
+	 **/
+	enum kinds {BINARY=0, INT, FLOAT, ALWAYS, NONE, number_of_kinds=NONE};
+
+						MutationSites	();
+
+	/** Adds a site of the given kind. */
+	void				add				(Genstruct* site, int kind, double coefficient);
+
+	/** Mutates the sites with the given rates.
+	 *
+	 *  @return TRUE if any site mutated.
+	 **/
+	bool				mutate			(const MutationRate& k);
+
+	/** Tells if the list should be rebuilt: some coefficient was
+	 *  found larger than when the list was built, or the structure
+	 *  of some @ref Gentainer has changed since.
+	 **/
+	bool				isStale			() const;
+
+	/** Marks all lists stale. Called when the structure of any @ref
+	 *  Gentainer changes, as the lists of the containers above it
+	 *  point to its substructures.
+	 **/
+	static void			structureChanged	();
+
+  private:
+	double				rateOf			(const MutationRate& k, int kind) const;
+
+	PackArray<Genstruct*>	mSites [number_of_kinds];	/**> Sites of each kind. */
+	double					mMaxCoef [number_of_kinds];	/**> Largest coefficient of each kind. */
+	bool					mStale;						/**> Has some coefficient grown? */
+	long					mVersion;					/**> Structure version when the list was built. */
+};
+
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -254,6 +406,8 @@ EXCEPTIONCLASS (invalid_gene_name);
 class Genstruct : public Object {
 	decl_dynamic (Genstruct);
   public:
+	/** The structures are allocated from the @ref GenePool. */
+	NHP_GENEPOOL_ALLOCATED
 
 	/** Creates the structure with the given name. The name can be
 	 * used to access the structure from @ref Gentainer containers.
@@ -328,6 +482,52 @@ class Genstruct : public Object {
 	 * occurred.
 	 **/
 	virtual bool				pointMutate	(const MutationRate& r) {MUST_OVERLOAD; return false;}
+
+	/** Tells how the structure mutates, for @ref MutationSites.
+	 *
+	 * @param coefficient Returns the coefficient of the mutation rate.
+	 *
+	 * @return Kind of the mutation site (see @ref
+	 * MutationSites::kinds). The default is ALWAYS, which is always
+	 * correct but gives no speedup.
+	 **/
+	virtual int					mutationSite	(double& coefficient) const {coefficient=1.0; return MutationSites::ALWAYS;}
+
+	/** Mutates the structure unconditionally, as @ref pointMutate()
+	 * does when the mutation probability hits. Called only for
+	 * structures that are sites of the BINARY, INT or FLOAT kinds.
+	 **/
+	virtual void				forceMutate		(const MutationRate& r) {pointMutate (r);}
+
+	/** Adds the mutation sites of the structure to the list. The
+	 * default adds the structure itself as one site.
+	 **/
+	virtual void				collectMutationSites	(MutationSites& sites);
+
+	/** Adds the contents of the structure to the hash. Structures
+	 * with equal gene values must give equal hashes. The default
+	 * invalidates the hash, as it does not know the contents.
+	 **/
+	virtual void				hash		(GenomeHash& h) const {h.invalidate ();}
+
+	/** Adds the shape of the structure to the hash: the class, the
+	 * name and the length of each substructure, but not the
+	 * values. Structures that can be restored from each other's
+	 * checkpoints have equal signatures.
+	 **/
+	virtual void				signature	(GenomeHash& h) const;
+
+	/** Writes the values of the structure to a checkpoint. The
+	 * default throws @ref checkpoint_error, as it does not know the
+	 * contents; stateless structures should overload this and @ref
+	 * loadState() with empty methods.
+	 **/
+	virtual void				saveState	(CheckpointOStream& out) const;
+
+	/** Reads the values written with @ref saveState() by a
+	 * structure of the same shape.
+	 **/
+	virtual void				loadState	(CheckpointIStream& in);
 	
 	/** Makes this structure a recombination of given parent
 	 * structures. If no internal recombination actualizes within the
@@ -442,6 +642,7 @@ class Gentainer : public Genstruct {
 						Gentainer	(const GeneticID& name = NULL);
 
 						Gentainer	(const Gentainer& orig);
+						~Gentainer	() {delete mpSites;}
 
 	/** Appends a new substructure to the structure. */
 	void				add			(Genstruct* newstruct);
@@ -473,7 +674,7 @@ class Gentainer : public Genstruct {
 	 * container. When it is enabled, mutation-rate genes are inserted
 	 * in the genome and used as coefficient for all mutation orders.
 	 **/
-	void				selfadjust	(bool val=true) {self_adjust=val;}
+	void				selfadjust	(bool val=true) {self_adjust=val; invalidateSites ();}
 
 	/** Sets the local recombination rate coefficient. */
 	void				recombRate	(double rate) {mRecombRate=rate;}
@@ -483,7 +684,27 @@ class Gentainer : public Genstruct {
 	virtual void				init		();
 	virtual void				addPrivateGenes	(Gentainer& g, const StringMap& params);
 	virtual const Genstruct*	getGene		(const GeneticID& name) const;
+
+	/** Compiles the location of the gene with the given ID. The gene
+	 *  is searched in the same order as with @ref getGene(), but only
+	 *  through substructures that are Gentainers.
+	 *
+	 *  @throw invalid_gene_name if the gene was not found.
+	 **/
+	GenePath					resolve		(const GeneticID& name) const;
+
+	/** Fetches a gene by a path returned by @ref resolve(). The
+	 *  container must have the same structure as the one the path
+	 *  was resolved in.
+	 **/
+	const Genstruct*			getGene		(const GenePath& path) const;
+
 	virtual bool				pointMutate	(const MutationRate& k);
+	virtual void				collectMutationSites	(MutationSites& sites);
+	virtual void				hash		(GenomeHash& h) const;
+	virtual void				signature	(GenomeHash& h) const;
+	virtual void				saveState	(CheckpointOStream& out) const;
+	virtual void				loadState	(CheckpointIStream& in);
 	virtual void				recombine	(const Genstruct& a, const Genstruct& b);
 	virtual double				equality	(const Genstruct& other) const;
 	virtual Genstruct*			replicate	() const;
@@ -497,6 +718,22 @@ class Gentainer : public Genstruct {
   protected:
 	virtual int			calc_len	() const;
 
+	/** Seeks the named gene and stores its path in steps, starting
+	 *  from the given depth.
+	 **/
+	bool				findPath	(const GeneticID& name, PackArray<int>& steps, int depth) const;
+
+	/** Mutates the substructures with the given rates, either one by
+	 *  one or with skip-sampling.
+	 **/
+	bool				mutateSubstructs	(const MutationRate& k);
+
+	/** Drops the cached mutation sites; called when the structure
+	 *  changes. The sites cached by the containers above this one
+	 *  become stale, too.
+	 **/
+	void				invalidateSites		() {delete mpSites; mpSites=NULL; MutationSites::structureChanged ();}
+
 	/** Substructures. */
 	Array<Genstruct>	substructs;
 
@@ -506,6 +743,11 @@ class Gentainer : public Genstruct {
 	/** Recombination rate coefficient. Default: 1 */
 	double				mRecombRate;
 
+	/** Flattened mutation sites of the substructures, built when
+	 *  first needed for skip-sampling.
+	 **/
+	MutationSites*		mpSites;
+
   private:
 	Gentainer& operator= (const Gentainer& orig) {FORBIDDEN; return *this;}
 };
@@ -571,6 +813,10 @@ class Genome : public Gentainer {
 	virtual void				print		(TextOStream& out) const;
 	/** Implementation for @ref Genstruct. */
 	virtual void				addPrivateGenes (Gentainer& g, const StringMap& pars);
+	/** Implementation for @ref Genstruct. Saves also the kinghoods. */
+	virtual void				saveState	(CheckpointOStream& out) const;
+	/** Implementation for @ref Genstruct. */
+	virtual void				loadState	(CheckpointIStream& in);
 
 	/** Implementation for @ref Object. */
 	virtual DataOStream&		operator>>	(DataOStream& out) const;
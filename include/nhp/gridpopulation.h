@@ -1,6 +1,189 @@
-#include <population.h>
+/***************************************************************************
+ *   This file is part of the NeHeP library.                               *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
 
+#ifndef __GRIDPOPULATION_H__
+#define __GRIDPOPULATION_H__
 
-class GridSimplePopulation : public AnySimplePopulation {
+#include "nhp/population.h"
+#include "nhp/workerpool.h"
+#include "nhp/random.h"
+
+// Externals
+class EvaluationRecord;
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//               G r i d   P o p u l a t i o n                               //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/** A cellular population, where the individuals live in the cells of
+ *  a two-dimensional torus and mate only with their neighbours.
+ *
+ *  The cells are stored in row-major order, and their fitnesses are
+ *  kept in a separate array, so selecting a parent reads only a few
+ *  nearby numbers instead of visiting the individuals. The selection
+ *  of each cell is a tournament in its von Neumann (4 neighbours) or
+ *  Moore (8 neighbours) neighbourhood, including the cell itself, so
+ *  a generation takes linear time in the size of the grid.
+ *
+ *  The update is synchronous: the offspring are created in a second
+ *  grid, while the current one is only read, so the rows can be
+ *  handed to the worker threads in any order. Each offspring has its
+ *  own random stream, so the result does not depend on the number of
+ *  threads. A cell that is the best in its neighbourhood survives
+ *  to the next generation intact, if local elitism is enabled.
+ **/
+class GridPopulation : public Population {
   public:
+	enum neighbourhoods {VON_NEUMANN=0, MOORE};
+
+	/** Standard constructor.
+	 *
+	 *  @param params["GridPopulation.width"] Number of columns in the
+	 *  grid. [Default:16]
+	 *  @param params["GridPopulation.height"] Number of rows in the
+	 *  grid. [Default:16]
+	 *  @param params["GridPopulation.neighbourhood"] Cells a cell can
+	 *  mate with: "vonneumann" or "moore". [Default:vonneumann]
+	 *  @param params["GridPopulation.localElites"] Should a cell that
+	 *  is the best in its neighbourhood survive? [Default:1]
+	 *  @param params["Selection.q"] Size of the tournament for
+	 *  selecting each parent. [Default:2]
+	 *  @param params["SimplePopulation.threads"] As for @ref
+	 *  SimplePopulation. [Default:0]
+	 *  @param params["SimplePopulation.scheduler"] As for @ref
+	 *  SimplePopulation. [Default:stealing]
+	 *  @param params["SimplePopulation.seed"] As for @ref
+	 *  SimplePopulation. [Default:0]
+	 **/
+							GridPopulation	(EAEnvironment& envr, const StringMap& params);
+							~GridPopulation	();
+
+	/** Evolves the population.
+	 *
+	 *  @param generations Number of generations the population should be evolved.
+	 *
+	 *  @param trg_fitn The evolution is terminated if the attained
+	 *  fitness goes smaller than this value. Special value -1 tells
+	 *  not to use this rule.
+	 *
+	 *  @return The smallest fitness in the last generation.
+	 **/
+	double					evolve			(int generations, double trg_fitn=-1);
+
+	/** Returns the number of columns. */
+	int						width			() const {return mWidth;}
+
+	/** Returns the number of rows. */
+	int						height			() const {return mHeight;}
+
+	/** Returns the number of cells. */
+	int						size			() const {return mWidth*mHeight;}
+
+	/** Returns an individual by its index number, row*width+column. */
+	const Individual&		operator[]		(int i) const {return (*mpCells)[i];}
+
+	/** Returns an individual by its row and column. */
+	const Individual&		cell			(int row, int col) const {return (*mpCells)[row*mWidth+col];}
+
+	/** Returns the fitness of an individual in the last evaluation. */
+	double					fitness			(int i) const {return mFitness[i];}
+
+	/** Returns the neighbourhood, see 'neighbourhoods'. */
+	int						neighbourhood	() const {return mNeighbourhood;}
+
+	/** Returns the number of cells in a neighbourhood, including the
+	 *  cell itself.
+	 **/
+	int						neighbours		() const {return mRowOffset.size();}
+
+	/** Returns the index of the k:th cell in the neighbourhood of
+	 *  the i:th cell. The grid wraps around at the edges.
+	 **/
+	int						neighbour		(int i, int k) const;
+
+	/** Returns the evaluation threads. */
+	const WorkerPool&		getWorkerPool	() const {return *mpWorkerPool;}
+
+	/** Returns the number of times the population has been evaluated. */
+	int						getAge			() const {return mAge;}
+
+	/** Returns the root random stream of the population. */
+	const RandomStream&		random			() const {return mRandom;}
+
+	/** Purposes of the streams split from the root stream. */
+	enum streams {OFFSPRING_STREAM=1, EVALUATION_STREAM, INIT_STREAM};
+
+	/** Dumps the fitnesses of the grid to given output, one row per line.
+	 **/
+	void					print			(TextOStream& out) const;
+
+	/** Writes an one-line generation report to the given logging stream.
+	 **/
+	void					report			(TextOStream& log) const;
+
+	/** Implementation for @ref Object. */
+	virtual void			check			() const;
+
+  private:
+	/** Evaluates all cells in the worker threads. */
+	void					evaluate		();
+
+	/** Evaluates the cells in range [begin, end). */
+	void					evaluate		(int begin, int end, EvaluationRecord& record);
+
+	/** Creates the next generation of the cells in rows [begin, end). */
+	void					breed			(int begin, int end);
+
+	/** Selects a parent for the i:th cell with a tournament in its
+	 *  neighbourhood.
+	 **/
+	int						select			(int i) const;
+
+	/** Tells if the i:th cell is at least as good as all of its neighbours. */
+	bool					isLocalElite	(int i) const;
+
+	int						mWidth;				/**> Number of columns. */
+	int						mHeight;			/**> Number of rows. */
+	int						mNeighbourhood;		/**> See 'neighbourhoods'. */
+	PackArray<int>			mRowOffset;			/**> Row offsets of the neighbourhood. */
+	PackArray<int>			mColOffset;			/**> Column offsets of the neighbourhood. */
+	int						mTournament;		/**> Tournament size. */
+	bool					mLocalElites;		/**> Do the best cells of their neighbourhoods survive? */
+	Array<Individual>*		mpCells;			/**> The current generation, row-major. */
+	Array<Individual>*		mpNext;				/**> Buffer for the next generation. */
+	PackArray<double>		mFitness;			/**> Fitness of each cell, for the selection. */
+	PackArray<char>			mSurvives;			/**> Does the cell survive to the next generation? */
+	FitnessStats			mFitnessStats;		/**> Statistics of the last evaluation. */
+	SelectionPrms			mSelectionParams;	/**> Selection parameters of the individuals. */
+	WorkerPool*				mpWorkerPool;		/**> Worker threads for evaluation and breeding. */
+	EvaluationRecord*		mpEvalRecords;		/**> Evaluation results of each worker. */
+	unsigned int			mSeed;				/**> Seed of the random streams, 0=from the global generator. */
+	RandomStream			mRandom;			/**> Root of the random streams of the population. */
+
+	friend class GridTask;
 };
+
+#endif
@@ -7,6 +7,7 @@
 
 //Externals
 class EAEnvironment;
+class EvaluationRecord;
 class SimplePopulation;
 class SelectionMatrix;
 class Selector;
@@ -32,6 +33,8 @@ class SelectionPrms;
 class Individual : public Comparable {
 	decl_dynamic (Individual);
   public:
+	/** The individuals are allocated from the @ref GenePool. */
+	NHP_GENEPOOL_ALLOCATED
 
 							Individual		();
 	explicit				Individual		(const Individual& prototype);
@@ -80,6 +83,19 @@ class Individual : public Comparable {
 	
 	double					evaluate		(EAEnvironment& envr, bool force=false);
 
+	/** Evaluates the fitness like the other evaluate(), but records
+	 *  the results in the given per-thread record instead of the
+	 *  environment. See @ref EAEnvironment::merge().
+	 **/
+	double					evaluate		(EAEnvironment& envr, EvaluationRecord& record, bool force=false);
+
+	/** Sets the fitness from a measurement made with @ref
+	 *  EAEnvironment::measureBatch(), like the above evaluate() would
+	 *  when the individual has not been evaluated yet.
+	 **/
+	double					evaluate		(EAEnvironment& envr, EvaluationRecord& record,
+											 double measured, bool evaluated);
+
 	// Lets the individual to give it's preference for the given individual
 	//double					select			(const RefArray<Individual>& opop, int j) const;
 
@@ -137,6 +153,14 @@ class Individual : public Comparable {
 	/** Passthrough to the @ref Genome of the Individual. */
 	const Genstruct*	getGene				(const GeneticID& n) const {return genome.getGene(n);}
 	/** Passthrough to the @ref Genome of the Individual. */
+	const Genstruct*	getGene				(const GenePath& p) const {return genome.getGene(p);}
+	/** Passthrough to the @ref Genome of the Individual. */
+	void				hash				(GenomeHash& h) const {genome.hash(h);}
+	/** Passthrough to the @ref Genome of the Individual. */
+	void				signature			(GenomeHash& h) const {genome.signature(h);}
+	/** Returns the genome, for examining its structure. */
+	const Genome&		getGenome			() const {return genome;}
+	/** Passthrough to the @ref Genome of the Individual. */
 	static void			addGenesTo			(Genome& g, const StringMap& params);
 	/** Passthrough to the @ref Genome of the Individual. */
 	void				addking				() {genome.addking();}
@@ -152,6 +176,15 @@ class Individual : public Comparable {
 	/** Brief printout. */
 	void					print			(TextOStream& out) const;
 
+	/** Writes the fitness, age and genome to a checkpoint. */
+	void					saveState		(CheckpointOStream& out) const;
+
+	/** Reads the state written with @ref saveState() by an
+	 *  individual of the same shape. The selector reads its
+	 *  self-adaptive parameters from the restored genome.
+	 **/
+	void					loadState		(CheckpointIStream& in);
+
 	/** Implementation for @ref Object. Verbose printout. */
 	virtual DataOStream&	operator>>		(DataOStream& out) const;
 
@@ -165,6 +198,11 @@ class Individual : public Comparable {
 	/** Adds 1 to age. */
 	void					grow_older		();
 
+	/** Implementation of the evaluate() methods; record is NULL for
+	 *  serial evaluation.
+	 **/
+	double					evaluate		(EAEnvironment& envr, EvaluationRecord* record, bool force);
+
 	/** The phenotypical features of the specimen.
 	 **/
 	Map<String,Object>		mFeatures;
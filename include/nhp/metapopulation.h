@@ -25,7 +25,12 @@
 #ifndef __METAPOPULATION_H__
 #define __METAPOPULATION_H__
 
-#include <population.h>
+#include <magic/mthread.h>
+#include "nhp/population.h"
+#include "nhp/simplepopula.h"
+
+// Internals
+class IslandThread;
 
 ///////////////////////////////////////////////////////////////////////////////
 //                                                                           //
@@ -37,27 +42,216 @@
 //                                                                           //
 ///////////////////////////////////////////////////////////////////////////////
 
-/******************************************************************************
- * Base class for metapopulation models.
- *****************************************************************************/
+/** A lock-free queue of migrating individuals between two islands
+ *  of a @ref Metapopulation.
+ *
+ *  Exactly one thread may push to the queue and one thread pop from
+ *  it. Neither ever waits for the other: push() fails when the queue
+ *  is full and pop() returns NULL when it is empty.
+ *
+ *  The queue takes the ownership of the individuals pushed to it and
+ *  gives it to the caller of pop(). Individuals still in the queue
+ *  are deleted with it.
+ **/
+class MigrantQueue {
+  public:
+	/** Creates the queue. The capacity is rounded up to one less
+	 *  than a power of two.
+	 **/
+						MigrantQueue	(int capacity);
+						~MigrantQueue	();
+
+	/** Adds an individual to the end of the queue. Called only from
+	 *  the producer thread.
+	 *
+	 *  @return FALSE if the queue was full, in which case the caller
+	 *  keeps the ownership of the individual.
+	 **/
+	bool				push			(Individual* migrant);
+
+	/** Removes the first individual from the queue. Called only from
+	 *  the consumer thread.
+	 *
+	 *  @return The individual, or NULL if the queue was empty.
+	 **/
+	Individual*			pop				();
+
+	/** Returns the maximum number of individuals in the queue. */
+	int					capacity		() const {return mMask;}
+
+  private:
+	Individual**		mpSlots;
+	int					mMask;			/**> Number of slots-1, for wrapping the indices. */
+	volatile int		mHead;			/**> Next slot to pop; written only by the consumer. */
+	char				mPadding[64];	/**> Keep the indices in separate cache lines. */
+	volatile int		mTail;			/**> Next slot to push; written only by the producer. */
+
+	MigrantQueue (const MigrantQueue& o) {FORBIDDEN}
+	MigrantQueue& operator= (const MigrantQueue& o) {FORBIDDEN; return *this;}
+};
+
+/** Island model of parallel evolution: a set of @ref SimplePopulation
+ *  islands that evolve concurrently, each in its own thread, and
+ *  exchange their best individuals now and then.
+ *
+ *  Every few generations each island sends copies of its elites to
+ *  its neighbour islands. The topology of the islands is a
+ *  unidirectional ring, a two-dimensional torus or a fully connected
+ *  graph. The migrants travel through a @ref MigrantQueue for each
+ *  pair of connected islands, and they are taken in by the
+ *  receiving island at the start of its next generation, replacing
+ *  its last offspring. An island never waits for the others: it does
+ *  not matter if it is ahead of or behind its neighbours, and if a
+ *  queue is full, the migrants are dropped.
+ *
+ *  The islands are evaluated concurrently, so each must have an
+ *  environment of its own. The global @ref MutabilityRecord should
+ *  not be enabled either.
+ **/
 class Metapopulation : public Population {
   public:
-				Metapopulation (EAEnvironment& envr,
-								const StringMap& params)
-						: Population (envr, params) {
-				}
+	enum topologies {RING=0, TORUS, FULL};
+
+	/** Standard constructor. Creates one island for each
+	 *  environment. The parameters are passed on to the islands.
+	 *
+	 *  @param envrs Environments of the islands. They must outlive
+	 *  the metapopulation.
+	 *
+	 *  @param params["Metapopulation.topology"] How the islands are
+	 *  connected: "ring", "torus" or "full". [Default:ring]
+	 *  @param params["Metapopulation.interval"] Number of generations
+	 *  between the migrations, 0 for none. [Default:10]
+	 *  @param params["Metapopulation.migrants"] Number of elites an
+	 *  island sends to each neighbour. Must not exceed the number of
+	 *  elites of the islands. [Default:1]
+	 *  @param params["Metapopulation.queueSize"] Number of migrants
+	 *  that can wait for a slow island between each pair of
+	 *  islands. [Default:4*migrants]
+	 *  @param params["SimplePopulation.threads"] As for @ref
+	 *  SimplePopulation, but per island. [Default:processors/islands]
+	 *  @param params["SimplePopulation.seed"] As for @ref
+	 *  SimplePopulation; island i is seeded with seed+i. [Default:0]
+	 *  @param params["Checkpoint.file"] As for @ref SimplePopulation;
+	 *  island i writes its checkpoints to the file with ".i"
+	 *  appended. [Default:empty]
+	 *  @param params["Snapshot.file"] As for @ref SimplePopulation;
+	 *  island i writes its snapshots to the files with ".i"
+	 *  appended. [Default:empty]
+	 **/
+							Metapopulation	(Array<EAEnvironment>& envrs,
+											 const StringMap& params);
+	virtual					~Metapopulation	();
+
+	/** Evolves all the islands for the given number of generations
+	 *  and returns when they are done.
+	 *
+	 *  @param trg_fitn The evolution of all islands is terminated
+	 *  when any of them reaches a fitness smaller than this
+	 *  value. Special value -1 tells not to use this rule.
+	 *
+	 *  @return The smallest fitness in the last generation of the islands.
+	 **/
+	double					evolve			(int generations, double trg_fitn=-1);
+
+	/** Returns the number of islands. */
+	int						islands			() const {return mIslands.size();}
+
+	/** Returns an island by its index number. */
+	const SimplePopulation&	island			(int i) const {return mIslands[i];}
+
+	/** Returns an island by its index number. */
+	SimplePopulation&		island			(int i) {return mIslands[i];}
+
+	/** Returns the topology, see 'topologies'. */
+	int						topology		() const {return mTopology;}
 
-	virtual		~Metapopulation (){}
+	/** Returns the number of islands the given island sends its migrants to. */
+	int						neighbours		(int i) const {return mEdgeStart[i+1]-mEdgeStart[i];}
+
+	/** Returns the k:th neighbour of the given island. */
+	int						neighbour		(int i, int k) const {return mEdgeTarget[mEdgeStart[i]+k];}
+
+	/** Returns the total number of migrants sent so far. */
+	int						sent			() const;
+
+	/** Returns the total number of migrants dropped so far because a
+	 *  queue was full or the receiving island had no room for them.
+	 **/
+	int						dropped			() const;
+
+	/** Implementation for @ref Object. */
+	virtual void			check			() const;
 
   protected:
+	/** Constructor for the inheritors that fix the topology. */
+							Metapopulation	(Array<EAEnvironment>& envrs,
+											 const StringMap& params,
+											 int topology);
+
+	/** Sends the migrants of an island to its neighbours. By default,
+	 *  each neighbour gets a copy of each of the best individuals.
+	 *  Called from the thread of the island.
+	 **/
+	virtual void			emigrate		(int island);
+
+	/** Sends a copy of the individual from the island to its k:th
+	 *  neighbour, or drops it if the queue is full.
+	 **/
+	void					send			(int island, int k, const Individual& migrant);
+
+	/** Number of migrants sent to each neighbour. */
+	int						migrants		() const {return mMigrants;}
+
+  private:
+	/** Creates the islands and the queues between them. */
+	void					build			(Array<EAEnvironment>& envrs,
+											 const StringMap& params, int topology);
+
+	/** Lists the neighbours of each island in the topology. */
+	void					connect			();
+
+	/** Takes in the migrants that have arrived to an island. */
+	void					immigrate		(int island);
+
+	/** Evolves one island; run in the thread of the island. */
+	void					evolveIsland	(int island, int generations, double trg_fitn);
+
+	Array<SimplePopulation>	mIslands;		/**> The islands. */
+	int						mTopology;		/**> How the islands are connected. */
+	int						mInterval;		/**> Generations between migrations. */
+	int						mMigrants;		/**> Migrants per neighbour. */
+	PackArray<int>			mEdgeStart;		/**> Index of the first outgoing edge of each island, and the total number of edges. */
+	PackArray<int>			mEdgeTarget;	/**> Receiving island of each edge. */
+	Array<MigrantQueue>		mQueues;		/**> Queue of each edge. */
+	PackArray<int>			mSent;			/**> Migrants sent by each island; written only by its thread. */
+	PackArray<int>			mDropped;		/**> Migrants dropped by each island; written only by its thread. */
+	PackArray<double>		mMinFitness;	/**> Smallest fitness of each island in its last generation. */
+	volatile bool			mStop;			/**> Tells the islands to stop before the next generation. */
+	pthread_mutex_t			mLock;			/**> Protects the error message. */
+	String					mError;			/**> Message of an exception thrown in an island. */
+
+	friend class IslandThread;
 };
 
-/******************************************************************************
- * Metapopulation with uniform probability for migration from any
- * patch to another patch.
- *****************************************************************************/
+/** Metapopulation with uniform probability for migration from any
+ *  island to another island. Each migrant goes to a randomly chosen
+ *  island.
+ **/
 class NonspatialMetapopulation : public Metapopulation {
+  public:
+	/** Standard constructor. As for @ref Metapopulation, except that
+	 *  the topology is always fully connected.
+	 **/
+							NonspatialMetapopulation	(Array<EAEnvironment>& envrs,
+														 const StringMap& params)
+									: Metapopulation (envrs, params, FULL) {}
+
   protected:
+	/** Implementation for @ref Metapopulation. Sends each migrant to
+	 *  one randomly chosen island.
+	 **/
+	virtual void			emigrate		(int island);
 };
 
 #endif
@@ -2,6 +2,7 @@
 #define __MUTATOR_H__
 
 #include <magic/mmath.h>
+#include "nhp/random.h"
 
 /** Interface for @ref FloatGene mutation operators.
  **/
@@ -22,6 +23,21 @@ class FloatMutator {
 	 *  actual mutation method.
 	 **/
 	virtual double	mutate	(double x, double min, double max, double variance) const{FORBIDDEN}
+
+	/** Mutates n values at once. The default calls mutate() for each
+	 *  value; inheritors can do it faster.
+	 *
+	 *  @param x The current values, replaced with the mutated ones.
+	 *  @param min Minimum values.
+	 *  @param max Maximum values.
+	 *  @param variance Distribution parameters of the values, as in
+	 *  mutate().
+	 **/
+	virtual void	mutateBatch	(double* x, const double* min, const double* max, int n,
+								 const double* variance) const {
+		for (int i=0; i<n; i++)
+			x[i] = mutate (x[i], min[i], max[i], variance[i]);
+	}
 };
 
 /** The standard normally distributed @ref FloatGene mutator. It
@@ -49,12 +65,33 @@ class ConstantMutator : public FloatMutator {
 			// Default mutation
 			double delta;
 			do {
-				delta = gaussrnd (mVariance);
+				delta = rndGauss (mVariance);
 			} while (pp+delta<min || pp+delta>max);
 			pp += delta;
 		}
 		return pp;
 	}
+
+	/** As mutate(), but draws the changes of all values as one
+	 *  batch of truncated normal numbers.
+	 **/
+	virtual void	mutateBatch	(double* x, const double* min, const double* max, int n,
+								 const double* variance) const {
+		const int block = 128;
+		double lo [block], hi [block], delta [block];
+		for (int start=0; start<n; start+=block) {
+			const int m = (n-start < block)? n-start : block;
+			for (int j=0; j<m; j++) {
+				// An empty range gives a zero change
+				bool open = max[start+j] > min[start+j];
+				lo[j] = open? min[start+j]-x[start+j] : 0.0;
+				hi[j] = open? max[start+j]-x[start+j] : 0.0;
+			}
+			rndFillTruncatedGaussian (delta, lo, hi, m, mVariance);
+			for (int j=0; j<m; j++)
+				x[start+j] += delta[j];
+		}
+	}
 };
 
 /** @ref FloatGene mutator for mutating mutation rates.
@@ -75,7 +112,7 @@ class MutationMutator : public FloatMutator {
 	 **/
 	virtual double	mutate	(double p, double min, double max, double variance) const {
 		//TRACE2 ("p=%f, v=%f", p, variance);
-		double pp = 1/(1+(1-p)/p*exp(-gaussrnd(mPhi)));
+		double pp = 1/(1+(1-p)/p*exp(-rndGauss(mPhi)));
 		if (pp<min)
 			pp=min;
 		return pp;
@@ -102,7 +139,7 @@ class MutationSimpleMutator : public FloatMutator {
 	 **/
 	virtual double	mutate	(double p, double min, double max, double variance) const {
 		//TRACE2 ("p=%f, v=%f", p, variance);
-		double pp = p*exp(mTau*gaussrnd(1));
+		double pp = p*exp(mTau*rndGauss(1));
 		if (pp<min)
 			pp=min;
 		return pp;
@@ -119,7 +156,7 @@ class CircularMutator : public FloatMutator {
 	 *  not used here; instead the value given in the constructor is used.
 	 **/
 	virtual double	mutate	(double p, double min, double max, double variance) const {
-		return 1/(1+(1-p)/p*exp(-mPhi*gaussrnd(1)));
+		return 1/(1+(1-p)/p*exp(-mPhi*rndGauss(1)));
 	}
 };
 
@@ -68,6 +68,10 @@ class Population : public Object {
 	/** Returns the output logging stream.
 	 **/
 	OStream&				getOStream		() {return mOuts;}
+
+	/** Returns the environment where the population evolves.
+	 **/
+	EAEnvironment&			environment		() const {return *rpEnvironment;}
 	
 	// Actions
 	
@@ -128,6 +132,9 @@ class FitnessStats : public Object {
 	/** Adds one fitness measurement. */
 	void				add			(double fitness);
 
+	/** Adds all measurements collected in another statistic. */
+	void				add			(const FitnessStats& other);
+
 	/** Returns the smallest fitness measured so far. */
 	double				minFitness	() const {return mMinFitness;}
 
@@ -140,6 +147,12 @@ class FitnessStats : public Object {
 	/** Prints the statistic to the given output stream in a formatted way.
 	 **/
 	void				print		(TextOStream& out) const;
+
+	/** Writes the statistic to a checkpoint. */
+	void				saveState	(CheckpointOStream& out) const;
+
+	/** Reads the statistic written with @ref saveState(). */
+	void				loadState	(CheckpointIStream& in);
 };
 
 
@@ -0,0 +1,141 @@
+/***************************************************************************
+ *   This file is part of the NeHeP library.                               *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __NHP_PROFILER_H__
+#define __NHP_PROFILER_H__
+
+#include <magic/mobject.h>
+#include <magic/mtextstream.h>
+
+using namespace MagiC;
+
+/** Timing and counting of the phases of a generation.
+ *
+ *  The library code marks its phases with the @ref NHP_PROFILE_PHASE
+ *  and @ref NHP_PROFILE_COUNT macros. When the library is compiled
+ *  with NHP_PROFILE defined, they record the wall-clock time, the CPU
+ *  time and the number of calls of each phase, and the counters, in
+ *  a record of the calling thread. Without NHP_PROFILE the macros
+ *  compile to nothing, and the statistics stay zero.
+ *
+ *  The statistics are collected from all threads of the program, up
+ *  to MAX_THREADS threads at a time. The record of a thread that
+ *  exits is given to the next new thread, so threads created again
+ *  and again, such as the island threads of a @ref Metapopulation,
+ *  share the records. The threads beyond MAX_THREADS are not
+ *  profiled, and a warning is printed when that first happens.
+ *  Nested phases are timed separately, so for example the time of
+ *  MUTATE is also included in BREED.
+ *
+ *  The statistics are global, so the reading and the reset should
+ *  be done while no population is evolving.
+ **/
+class Profiler {
+  public:
+	enum phases {EVALUATE=0,		/**< Evaluation of the population. */
+				 SORT,				/**< Ordering the population by fitness. */
+				 SELECTION_MATRIX,	/**< Calculating the selection probabilities. */
+				 BREED,				/**< Creating the next generation. */
+				 SELECT,			/**< Selecting the parents of an offspring. */
+				 RECOMBINE,			/**< Recombining the parents. */
+				 MUTATE,			/**< Mutating an offspring. */
+				 INCARNATE,			/**< Incarnating an offspring. */
+				 ELITES,			/**< Keeping the elites. */
+				 PHASES};
+
+	enum counters {EVALUATIONS=0,	/**< Fitness evaluations. */
+				   CACHE_HITS,		/**< Fitnesses taken from the fitness cache. */
+				   MUTATIONS,		/**< Individuals whose genome was changed by mutation. */
+				   COUNTERS};
+
+	enum {MAX_THREADS=64};
+
+	/** Tells if the library was compiled with NHP_PROFILE. */
+	static bool			enabled			();
+
+	/** Zeroes the statistics of all threads and the count of the
+	 *  threads that were not profiled.
+	 **/
+	static void			reset			();
+
+	/** Returns the wall-clock time of a phase in seconds.
+	 *
+	 *  @param thread Index of the thread record, or -1 for the sum
+	 *  over all threads. A record can have had several owners, one
+	 *  after another.
+	 **/
+	static double		wallTime		(int phase, int thread=-1);
+
+	/** Returns the CPU time of a phase in seconds; see @ref wallTime(). */
+	static double		cpuTime			(int phase, int thread=-1);
+
+	/** Returns the number of times a phase was entered; see @ref wallTime(). */
+	static long			calls			(int phase, int thread=-1);
+
+	/** Returns the value of a counter; see @ref wallTime(). */
+	static long			counter			(int counter, int thread=-1);
+
+	/** Returns the number of thread records that have been used. */
+	static int			threads			();
+
+	static const char*	phaseName		(int phase);
+	static const char*	counterName		(int counter);
+
+	/** Prints the statistics of each phase and counter, summed over
+	 *  the threads, and the busiest thread of each phase.
+	 **/
+	static void			print			(TextOStream& out);
+
+	/** Adds to a counter of the calling thread. */
+	static void			count			(int counter, long n);
+};
+
+/** Times a phase from its construction to its destruction. Use
+ *  through @ref NHP_PROFILE_PHASE.
+ **/
+class ProfileScope {
+  public:
+					ProfileScope	(int phase);
+					~ProfileScope	();
+
+  private:
+	int				mPhase;
+	double			mWallStart;
+	double			mCpuStart;
+};
+
+#define NHP_PROFILE_CONCAT2(a,b)	a##b
+#define NHP_PROFILE_CONCAT(a,b)		NHP_PROFILE_CONCAT2(a,b)
+
+#ifdef NHP_PROFILE
+/** Times the rest of the enclosing block as the given phase. */
+#define NHP_PROFILE_PHASE(phase)	ProfileScope NHP_PROFILE_CONCAT(profileScope, __LINE__) (phase)
+/** Adds n to the given counter. */
+#define NHP_PROFILE_COUNT(counter,n)	Profiler::count (counter, n)
+#else
+#define NHP_PROFILE_PHASE(phase)
+#define NHP_PROFILE_COUNT(counter,n)	((void) 0)
+#endif
+
+#endif
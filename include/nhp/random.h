@@ -0,0 +1,220 @@
+/***************************************************************************
+ *   This file is part of the NeHeP library.                               *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __NHP_RANDOM_H__
+#define __NHP_RANDOM_H__
+
+#include <stdint.h>
+#include <magic/mobject.h>
+#include <magic/mmath.h>
+#include "nhp/checkpoint.h"
+
+using namespace MagiC;
+
+/** An independent stream of pseudo-random numbers.
+ *
+ *  The genetic operators normally draw their random numbers from the
+ *  global generator of MagiC, which can not be used from several
+ *  threads at once. A thread can instead make a stream current with
+ *  @ref RandomScope, after which the random functions below draw from
+ *  the stream in that thread.
+ *
+ *  The generator is the counter-based Philox4x32-10 of Salmon et
+ *  al. Each output block is a keyed bijection of a block counter, so
+ *  the stream has no state other than its key and position.
+ *  Independent streams are derived with @ref split(), for example one
+ *  for each generation and offspring, and equal derivations give
+ *  equal sequences regardless of the thread that uses them.
+ **/
+class RandomStream {
+  public:
+					RandomStream	(uint64_t seed=0) {this->seed (seed);}
+
+	/** Restarts the stream from the given seed. */
+	void			seed			(uint64_t seed);
+
+	/** Returns a new stream derived from this one and the given
+	 *  numbers. Different numbers give independent streams. The
+	 *  position of this stream does not affect the result, and this
+	 *  stream is not advanced.
+	 **/
+	RandomStream	split			(uint64_t a, uint64_t b=0, uint64_t c=0) const;
+
+	/** Returns the next 64 random bits. */
+	uint64_t		next			() {
+		if (mUsed >= 2)
+			refill ();
+		return mBlock[mUsed++];
+	}
+
+	/** Returns a uniformly distributed number in range [0,1). */
+	double			uniform			() {return (next () >> 11) * (1.0/9007199254740992.0);}
+
+	/** Returns a uniformly distributed integer in range [0,n). */
+	int				integer			(int n) {return int (uniform () * n);}
+
+	/** Returns a normally distributed number with mean 0 and the
+	 *  given standard deviation.
+	 **/
+	double			gaussian		(double sd);
+
+	/** Fills the array with uniformly distributed numbers in range
+	 *  [0,1). Gives the same numbers as calling uniform() for each
+	 *  element, but generates whole blocks straight to the array.
+	 **/
+	void			fillUniform		(double* out, int n);
+
+	/** Fills the array with normally distributed numbers with mean 0
+	 *  and the given standard deviation.
+	 **/
+	void			fillGaussian	(double* out, int n, double sd);
+
+	/** Fills the array with normally distributed numbers with mean 0
+	 *  and the given standard deviation, truncated to the ranges
+	 *  [lo[i], hi[i]]. The ranges must contain 0 or be wide enough to
+	 *  be hit in reasonable time; an empty range gives lo[i].
+	 **/
+	void			fillTruncatedGaussian	(double* out, const double* lo, const double* hi,
+											 int n, double sd);
+
+	/** Writes the position of the stream to a checkpoint. */
+	void			saveState		(CheckpointOStream& out) const;
+
+	/** Continues from the position written with @ref saveState(). */
+	void			loadState		(CheckpointIStream& in);
+
+	/** Returns the stream current in the calling thread, or NULL if
+	 *  the global generator is to be used.
+	 **/
+	static RandomStream*	current	() {return tpCurrent;}
+
+  private:
+	/** Computes the block at the current counter and advances it. */
+	void			refill			();
+
+	uint32_t		mKey[2];		/**> Key of the stream. */
+	uint64_t		mCounter;		/**> Number of the next block. */
+	uint64_t		mBlock[2];		/**> The current block of output. */
+	int				mUsed;			/**> Number of used words in the block. */
+	double			mSpare;			/**> Second value of the last Box-Muller pair. */
+	bool			mHasSpare;
+
+	static __thread RandomStream*	tpCurrent;
+
+	friend class RandomScope;
+};
+
+/** Makes a @ref RandomStream current in the calling thread for the
+ *  lifetime of the scope object. Scopes can be nested.
+ **/
+class RandomScope {
+  public:
+					RandomScope		(RandomStream& stream) : mpPrevious (RandomStream::tpCurrent) {
+						RandomStream::tpCurrent = &stream;
+					}
+					~RandomScope	() {RandomStream::tpCurrent = mpPrevious;}
+
+  private:
+	RandomStream*	mpPrevious;
+
+	RandomScope (const RandomScope& o) {FORBIDDEN}
+	RandomScope& operator= (const RandomScope& o) {FORBIDDEN; return *this;}
+};
+
+/** Returns a uniformly distributed number in range [0,1) from the
+ *  current stream of the thread, or from the global generator.
+ **/
+inline double rndUniform ()
+{
+	RandomStream* s = RandomStream::current ();
+	return s? s->uniform () : frnd ();
+}
+
+/** Returns a uniformly distributed integer in range [0,n) from the
+ *  current stream of the thread, or from the global generator.
+ **/
+inline int rndInt (int n)
+{
+	RandomStream* s = RandomStream::current ();
+	return s? s->integer (n) : rnd (n);
+}
+
+/** Returns a normally distributed number from the current stream of
+ *  the thread, or from the global generator.
+ **/
+inline double rndGauss (double sd)
+{
+	RandomStream* s = RandomStream::current ();
+	return s? s->gaussian (sd) : gaussrnd (sd);
+}
+
+/** Fills the array with uniformly distributed numbers in range
+ *  [0,1) from the current stream of the thread, or from the global
+ *  generator.
+ **/
+inline void rndFillUniform (double* out, int n)
+{
+	RandomStream* s = RandomStream::current ();
+	if (s)
+		s->fillUniform (out, n);
+	else
+		for (int i=0; i<n; i++)
+			out[i] = frnd ();
+}
+
+/** Fills the array with normally distributed numbers from the current
+ *  stream of the thread, or from the global generator.
+ **/
+inline void rndFillGaussian (double* out, int n, double sd)
+{
+	RandomStream* s = RandomStream::current ();
+	if (s)
+		s->fillGaussian (out, n, sd);
+	else
+		for (int i=0; i<n; i++)
+			out[i] = gaussrnd (sd);
+}
+
+/** Fills the array with truncated normal numbers from the current
+ *  stream of the thread, or from the global generator. See @ref
+ *  RandomStream::fillTruncatedGaussian().
+ **/
+inline void rndFillTruncatedGaussian (double* out, const double* lo, const double* hi,
+									  int n, double sd)
+{
+	RandomStream* s = RandomStream::current ();
+	if (s)
+		s->fillTruncatedGaussian (out, lo, hi, n, sd);
+	else
+		for (int i=0; i<n; i++) {
+			double d = lo[i];
+			if (lo[i] < hi[i])
+				do {
+					d = gaussrnd (sd);
+				} while (d<lo[i] || d>hi[i]);
+			out[i] = d;
+		}
+}
+
+#endif
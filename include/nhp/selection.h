@@ -4,6 +4,7 @@
 #include <magic/mmatrix.h>
 #include <magic/mrefarray.h>
 #include "nhp/individual.h"
+#include "nhp/aliastable.h"
 
 // Externals
 class SimplePopulation;
@@ -35,10 +36,36 @@ class SelectionSituation;
 class SelectionMatrix : public Object {
   public:
 
+	/** Methods for drawing pairs from the matrix.
+	 *
+	 *  ALIAS draws each pair in constant time from an @ref AliasTable
+	 *  built once for the matrix.
+	 *
+	 *  SCAN walks through the cumulative probabilities of the matrix
+	 *  for each pair, which takes O(N^2) time for a population of N
+	 *  individuals. It is kept as a reference for verifying the
+	 *  faster method.
+	 *
+	 *  RANKS does not build the matrix at all, if possible. When no
+	 *  @ref Selector of the population is pairwise (see @ref
+	 *  Selector::isPairwise()), every row of the matrix is the same
+	 *  vector of rank weights w, and the probability of a pair (a,b)
+	 *  is proportional to w(a)w(b). The parents are then drawn
+	 *  independently from an alias table of the N rank weights,
+	 *  which takes O(N) time and memory in addition to sorting the
+	 *  population. If some selector is pairwise, falls back to ALIAS.
+	 *
+	 *  Note that when the selectors choose one selection method at
+	 *  random for each cell of the matrix (which is the default),
+	 *  the rank weights are the expected weights over the methods.
+	 **/
+	enum samplers {SCAN=0, ALIAS, RANKS};
+
 	/** Standard constructor.
 	 *
+	 *  @param sampler Method for drawing the pairs, see 'samplers'.
 	 **/
-	explicit	SelectionMatrix		(const SelectionSituation& situation);
+	explicit	SelectionMatrix		(const SelectionSituation& situation, int sampler=RANKS);
 				~SelectionMatrix	() {}
 	
 	/** Selects a random pair of individuals from the
@@ -48,6 +75,14 @@ class SelectionMatrix : public Object {
 	 *  @param b Ordered (!) population index number of the first, selecting parent.
 	 **/
 	void	selectRandomPair		(int& a, int& b) const;
+
+	/** Returns the probability of selecting the given pair. */
+	double	pairProbability			(int a, int b) const;
+
+	/** Returns the method used for drawing the pairs. This is ALIAS
+	 *  if RANKS was requested but was not possible.
+	 **/
+	int		sampler					() const {return mSampler;}
 	
 	/** Implementation for @ref Object. */
 	TextOStream&	operator>>		(TextOStream& out) const {return mSelection >> out;}
@@ -58,11 +93,31 @@ class SelectionMatrix : public Object {
 	 **/
 	void	calculateMatrix			(const SelectionSituation& situation);
 
+	/** Calculates the rank weights for the RANKS sampler. Returns
+	 *  false if the selection can not be factored into them.
+	 **/
+	bool	calculateRankWeights	(const SelectionSituation& situation);
+
   private:
 	SelectionMatrix();
 
 	/** Resulting selection matrix */
 	Matrix	mSelection;
+
+	/** Method for drawing the pairs, see 'samplers'. */
+	int			mSampler;
+
+	/** Pair distribution of the matrix in row-major order, for
+	 *  the ALIAS sampler.
+	 **/
+	AliasTable	mPairTable;
+
+	/** Rank weights and their sum for the RANKS sampler. */
+	Vector		mRankWeights;
+	double		mRankWeightSum;
+
+	/** Distribution of a single parent for the RANKS sampler. */
+	AliasTable	mRankTable;
 	
 	friend class Selector;
 };
@@ -267,6 +322,24 @@ class Selector : public SelectionPrms {
 	double					select			(const SelectionSituation& situation,
 											 int self_i, int other_j) const;
 
+	/** Tells if the affinity of the individual towards others
+	 *  depends on the individual itself, and not only on the rank of
+	 *  the other and the global selection parameters of the
+	 *  population.
+	 *
+	 *  The built-in selection methods are not pairwise unless the
+	 *  selection parameters or method weights are self-adaptive. An
+	 *  inheritor that overloads @ref selectWithMethod() so that it
+	 *  depends on i must overload this too.
+	 **/
+	virtual bool			isPairwise		(const SelectionSituation& situation) const;
+
+	/** Returns the expected affinity towards the j:th fittest
+	 *  individual over the selection methods. Meaningful only if the
+	 *  selector is not pairwise.
+	 **/
+	double					rankWeight		(const SelectionSituation& situation, int j) const;
+
 	/** Tells how many times the individual has got some. (Hmm, shouldn't
 	 *  this kind of information be private??).
 	**/
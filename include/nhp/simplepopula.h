@@ -26,6 +26,12 @@
 #define __SIMPLEPOPULA_H__
 
 #include "population.h"
+#include "workerpool.h"
+#include "random.h"
+#include "checkpoint.h"
+#include "snapshot.h"
+#include "evolog.h"
+#include "profiler.h"
 
 #include <magic/mthread.h>
 
@@ -45,6 +51,51 @@ class SimplePopulation : public Population {
   public:
 
 	/** Standard constructor.
+	 *
+	 *  @param params["SimplePopulation.threads"] Number of threads
+	 *  evaluating the individuals, 0 for one per processor. [Default:0]
+	 *  @param params["SimplePopulation.chunkSize"] Number of
+	 *  individuals handed to a thread at a time, 0 for
+	 *  automatic. [Default:0]
+	 *  @param params["SimplePopulation.scheduler"] How the
+	 *  individuals are distributed to the threads: "stealing" or
+	 *  "chunked". See @ref WorkerPool. [Default:stealing]
+	 *  @param params["Selection.sampler"] How the parent pairs are
+	 *  drawn: "ranks", "alias" or "scan". See @ref
+	 *  SelectionMatrix. [Default:ranks]
+	 *  @param params["FitnessCache.size"] Number of genotypes whose
+	 *  fitness the environment remembers, 0 for no caching. See @ref
+	 *  EAEnvironment::setFitnessCache(). [Default:0]
+	 *  @param params["SimplePopulation.strategy"] How the population
+	 *  evolves: "generational" with @ref EAStrategy or "steadystate"
+	 *  with @ref SteadyStateStrategy. [Default:generational]
+	 *  @param params["SimplePopulation.seed"] Seed for the random
+	 *  streams of the population. The initialization, the selection,
+	 *  the offspring and the evaluation noise of each individual
+	 *  have their own streams, so a run is repeatable regardless of
+	 *  the number of threads; 0 takes the
+	 *  seed from the global random generator. See @ref
+	 *  EAStrategy::recombine(). [Default:0]
+	 *  @param params["Checkpoint.file"] File where the population is
+	 *  checkpointed periodically during evolve(), empty for no
+	 *  checkpoints. The files are written in a background
+	 *  thread. [Default:empty]
+	 *  @param params["Checkpoint.interval"] Number of generations
+	 *  between the checkpoints. [Default:10]
+	 *  @param params["Snapshot.file"] Name of the snapshot files
+	 *  written periodically during evolve(), empty for no
+	 *  snapshots. The first "%d" in the name is replaced with the
+	 *  generation; the name is otherwise used as is. [Default:empty]
+	 *  @param params["Snapshot.interval"] Number of generations
+	 *  between the snapshots. The snapshot is taken when the
+	 *  generation has been evaluated, and written in the
+	 *  background. [Default:10]
+	 *  @param params["EvolutionLog.*"] How the evolution log given to
+	 *  evolve() is buffered and written. See @ref EvolutionLogger.
+	 *  @param params["Profiler.report"] If 1, the generation reports
+	 *  end with the wall-clock time of each phase in milliseconds and
+	 *  the counters of the generation. Only has effect when the library
+	 *  is compiled with NHP_PROFILE. See @ref Profiler. [Default:0]
 	 **/
 								SimplePopulation (EAEnvironment& envr, const StringMap& params);
 
@@ -54,6 +105,9 @@ class SimplePopulation : public Population {
 	 *
 	 *  @param generations Number of generations the population should be evolved.
 	 *  @param savefile File where the evolution log should be saved.
+	 *  The log is written in the background by an @ref
+	 *  EvolutionLogger, and it has been written completely when
+	 *  evolve() returns.
 	 *
 	 *  @param trg_fitn The evolution is terminated if the attained
 	 *  fitness goes smaller than this value. Special value -1 tells
@@ -76,11 +130,25 @@ class SimplePopulation : public Population {
 	 **/
 	int							size			() const {return mpPopulation->size();}
 
+	/** Returns the number of elites, which are the first individuals
+	 *  of the population after a generation.
+	 **/
+	int							elites			() const {return mElites;}
+
+	/** Replaces an individual in the population with the given one,
+	 *  which is then owned by the population. The new individual is
+	 *  incarnated and gets the selection parameters of the
+	 *  population, but it is evaluated only in the next generation.
+	 **/
+	void						replace			(int i, Individual* individual);
+
 	/** Dumps the population to given output in a formatted manner.
 	 **/
 	void						print			(TextOStream& out) const;
 
-	/** Writes an one-line generation report to the given logging stream.
+	/** Writes an one-line generation report to the given logging
+	 *  stream. When the stream is the evolution log of an evolve()
+	 *  with a log file, the report is only queued to the logger.
 	 **/
 	void						report			(TextOStream& log) const;
 
@@ -88,11 +156,34 @@ class SimplePopulation : public Population {
 	 **/
 	const EAStrategy&			getstrategy		() const {return *mpStrategy;}
 
+	/** Returns the evaluation threads. Their timing statistics tell
+	 *  how long the last evaluation took and how long the threads were
+	 *  idle during it.
+	 **/
+	const WorkerPool&			getWorkerPool	() const {return *mpWorkerPool;}
+
 	/** Returns the number of times the population has been evaluated
 	 *  (i.e. the generation)
 	**/
 	int							getAge			() const {return mAge;}
 
+	/** Returns the seed of the random streams, 0 if not set. */
+	unsigned int				seed			() const {return mSeed;}
+
+	/** Returns the root random stream of the population. The streams
+	 *  of the individual operations are split from it, see @ref
+	 *  RandomStream::split().
+	 **/
+	const RandomStream&			random			() const {return mRandom;}
+
+	/** Purposes of the streams split from the root stream.
+	 *  ISLAND_STREAM is for the thread evolving the population in a
+	 *  @ref Metapopulation. INIT_STREAM is for the initialization of
+	 *  the individuals and SELECTION_STREAM for the selection
+	 *  matrix of each generation.
+	 **/
+	enum streams {OFFSPRING_STREAM=1, EVALUATION_STREAM, ISLAND_STREAM, INIT_STREAM, SELECTION_STREAM};
+
 	/** Returns a non-const reference to the global mutation rate.
 	 **/
 	MutationRate&				mutRate			() {return mGlobalMutationRate;}
@@ -104,12 +195,64 @@ class SimplePopulation : public Population {
 	 **/
 	SelectionPrms&				selParams		() {return mSelectionParams;}
 
+	/** Returns the method for drawing parents from the selection
+	 *  matrix, see @ref SelectionMatrix::samplers.
+	 **/
+	int							selectionSampler	() const {return mSelectionSampler;}
+
 	/** Resets the stored fitness averages of multiply measured
 	 *  individuals. Useful when changing the objective function (old
 	 *  fitness values would be invalid).
 	 **/
 	void						resetFitnesses	();
 
+	/** Writes the complete state of the population to a checkpoint:
+	 *  the structure signature of the genome, the age, the mutation
+	 *  rates, the fitness statistics, the random streams, the state
+	 *  of the environment and the individuals.
+	 *
+	 *  The state of the global random generator of MagiC is not
+	 *  included, so a restored run repeats the original only if the
+	 *  population has a seed.
+	 **/
+	void						saveState		(CheckpointOStream& out) const;
+
+	/** Writes a checkpoint file synchronously. */
+	void						checkpoint		(const String& file) const;
+
+	/** Restores the state of the population from a checkpoint
+	 *  file. The population must have been created with the same
+	 *  environment and parameters as the one that wrote the
+	 *  checkpoint; only the values are restored, not the structure.
+	 *
+	 *  @throw checkpoint_error if the file is damaged or was written
+	 *  by a population of different shape.
+	 **/
+	void						restore			(const String& file);
+
+	/** Writes the individuals to a snapshot file, for analysis with
+	 *  @ref SnapshotReader or for starting another run with @ref
+	 *  warmStart().
+	 **/
+	void						snapshot		(const String& file) const;
+
+	/** Replaces the individuals with the ones in the snapshot. If the
+	 *  snapshot has fewer individuals than the population, the rest
+	 *  are kept; extra individuals in the snapshot are ignored. The
+	 *  age and the other state of the population are not changed.
+	 *
+	 *  The genomes are read directly from the mapped snapshot.
+	 *
+	 *  @throw checkpoint_error if the snapshot was written from
+	 *  individuals with a different genome structure.
+	 **/
+	void						warmStart		(const SnapshotReader& snapshot);
+
+	/** Returns the background writer of the periodic checkpoints, or
+	 *  NULL if they are not enabled.
+	 **/
+	const CheckpointWriter*		checkpointWriter	() const {return mpCheckpointWriter;}
+
 	/** Implementation for @ref Object. */
 	virtual void				check			() const;
 	
@@ -124,7 +267,16 @@ class SimplePopulation : public Population {
 	 *  in the given environment.
 	 **/
 	void					evaluate		(EAEnvironment& envr, TextOStream& out);
-	void					evaluate		(int i, EAEnvironment& environment, TextOStream& out);
+
+	/** Evaluates the individuals in range [begin, end). Called from
+	 *  the worker threads, each with its own record.
+	 **/
+	void					evaluate		(int begin, int end, EAEnvironment& environment, EvaluationRecord& record);
+
+	/** Writes a periodic snapshot, if one is due. Called by the
+	 *  strategy when the generation has been evaluated.
+	 **/
+	void					periodicSnapshot	();
 		
  	/** Implementation for @ref Population. Add population-dependent
 	 *  features to a genome. I suppose there might be some use for
@@ -142,11 +294,30 @@ class SimplePopulation : public Population {
 	bool					mUseGlobalMu;		/**> Global portion of the number of potential parents (mu). The semantics are dependent on the evolutionary strategy used. */
 	bool					mUseGlobalQ;		/**> Global q parameter for tournament selection. */
 	bool					mUseGlobalEtaPlus;	/**> Global etaPlus parameter for linear ranking selection. */
+	int						mSelectionSampler;	/**> Method for drawing parents from the selection matrix. */
 	ThreadLock				mThreadLock;        /**> For locking data. */
+	WorkerPool*				mpWorkerPool;		/**> Worker threads for evaluating the individuals. */
+	EvaluationRecord*		mpEvalRecords;		/**> Evaluation results of each worker in the current generation. */
+	int						mChunkSize;			/**> Number of individuals handed to a worker at a time, 0=automatic. */
+	unsigned int			mSeed;				/**> Seed of the random streams, 0=from the global generator. */
+	RandomStream			mRandom;			/**> Root of the random streams of the population. */
+	String					mCheckpointFile;	/**> File for the periodic checkpoints, empty=none. */
+	int						mCheckpointInterval;/**> Generations between the checkpoints. */
+	CheckpointWriter*		mpCheckpointWriter;	/**> Writes the periodic checkpoints in the background. */
+	CheckpointOStream		mCheckpointBuffer;	/**> Buffer for serializing the periodic checkpoints. */
+	EvolutionLogger*		mpLogger;			/**> Writes the evolution log in the background. */
+	String					mSnapshotFile;		/**> Name of the periodic snapshots, empty=none. */
+	int						mSnapshotInterval;	/**> Generations between the snapshots. */
+	CheckpointWriter*		mpSnapshotWriter;	/**> Writes the periodic snapshots in the background. */
+	CheckpointOStream		mSnapshotBuffer;	/**> Buffer for building the periodic snapshots. */
+	bool					mProfileReport;		/**> Should the reports include the profile of the generation? */
+	mutable double			mPhaseMark [Profiler::PHASES];		/**> Phase times at the previous report. */
+	mutable long			mCounterMark [Profiler::COUNTERS];	/**> Counters at the previous report. */
 	
 	friend class EAStrategy;
+	friend class SteadyStateStrategy;
 	friend class Selector;
-	friend class EvaluationWorker;
+	friend class EvaluationTask;
 };
 
 #endif
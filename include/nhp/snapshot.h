@@ -0,0 +1,284 @@
+/***************************************************************************
+ *   This file is part of the NeHeP library.                               *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __NHP_SNAPSHOT_H__
+#define __NHP_SNAPSHOT_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <magic/mobject.h>
+#include <magic/mstring.h>
+#include <magic/mpararr.h>
+#include "nhp/checkpoint.h"
+
+using namespace MagiC;
+
+class Genstruct;
+class Individual;
+
+// Internals
+struct SnapshotHeader;
+struct SnapshotGene;
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//               S n a p s h o t   W r i t e r                               //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/** Writes a snapshot of a generation to a file that @ref
+ *  SnapshotReader can map to memory and query without reading it.
+ *
+ *  The file consists of a header, a directory of the genes, a column
+ *  of the fitness values and a fixed-size record for each individual.
+ *  The record is the checkpoint of the individual (see @ref
+ *  Individual::saveState()), so all individuals must have the same
+ *  genome structure. The directory tells the position of each gene
+ *  within the record.
+ *
+ *  The data is written in the byte order of the machine. The file is
+ *  written to a temporary file that is renamed in place by @ref
+ *  close(), so readers never see a half-written snapshot.
+ *
+ *  The snapshot can also be built in a memory buffer, to be written
+ *  to the file in the background with a @ref CheckpointWriter that
+ *  adds no checksums.
+ *
+ *  Usage:
+ *
+ *  SnapshotWriter writer ("gen100.snap", pop[0], pop.size(), 100);
+ *  for (int i=0; i<pop.size(); i++)
+ *      writer.add (pop[i]);
+ *  writer.close ();
+ **/
+class SnapshotWriter {
+  public:
+	/** Starts writing a snapshot.
+	 *
+	 *  @param prototype An individual with the genome structure of
+	 *  all the individuals; the directory is built from it.
+	 *  @param individuals Number of individuals to be added.
+	 *  @param generation Age of the population, for information.
+	 *
+	 *  @throw checkpoint_error if the file could not be created or
+	 *  the genome contains genes that can not be checkpointed.
+	 **/
+						SnapshotWriter	(const String& file, const Individual& prototype,
+										 int individuals, int generation=0);
+
+	/** Starts building a snapshot at the end of the buffer, which
+	 *  must stay alive until @ref close(). The file is used only in
+	 *  the error messages.
+	 *
+	 *  @throw checkpoint_error if the genome contains genes that can
+	 *  not be checkpointed.
+	 **/
+						SnapshotWriter	(CheckpointOStream& buffer, const String& file,
+										 const Individual& prototype, int individuals,
+										 int generation=0);
+
+	/** Removes the unfinished file, or the unfinished data from the
+	 *  buffer, if @ref close() was not called.
+	 **/
+						~SnapshotWriter	();
+
+	/** Appends the next individual.
+	 *
+	 *  @throw checkpoint_error if the individual has a different
+	 *  structure than the prototype, or writing fails.
+	 **/
+	void				add				(const Individual& individual);
+
+	/** Writes the fitness column and moves the snapshot in place, or
+	 *  finishes the snapshot in the buffer.
+	 *
+	 *  @throw checkpoint_error if fewer individuals were added than
+	 *  promised, or writing fails.
+	 **/
+	void				close			();
+
+  private:
+	/** Writes the header, the directory and the names, and leaves
+	 *  room for the fitness column.
+	 **/
+	void				start			(const Individual& prototype, int generation);
+
+	/** Adds the directory entries of the structure and its
+	 *  substructures, located at the given offset in the record.
+	 **/
+	void				layout			(const Genstruct& gene, int offset, int parent);
+
+	/** Writes to the file or the buffer, throwing on errors. */
+	void				write			(const void* data, size_t bytes);
+
+	String				mFile;
+	String				mTemp;
+	FILE*				mpOut;
+	CheckpointOStream*	rpBuffer;		/**> Buffer of the snapshot, if not written to a file. */
+	int					mBase;			/**> Start of the snapshot in the buffer. */
+	int					mIndividuals;	/**> Promised number of individuals. */
+	int					mAdded;			/**> Number of individuals added so far. */
+	int					mRecordSize;	/**> Size of the serialized individual. */
+	int					mStride;		/**> Record size padded to 8 bytes. */
+	uint64_t			mFitnessOffset;	/**> Position of the fitness column in the snapshot. */
+	CheckpointOStream	mRecord;		/**> Buffer for serializing one individual. */
+	CheckpointOStream	mDirectory;		/**> SnapshotGene entries. */
+	CheckpointOStream	mNames;			/**> Names of the genes, referred to by the directory. */
+	PackArray<double>	mFitness;		/**> Fitness column, written at the end. */
+
+	SnapshotWriter (const SnapshotWriter& o) {FORBIDDEN}
+	SnapshotWriter& operator= (const SnapshotWriter& o) {FORBIDDEN; return *this;}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//               S n a p s h o t   R e a d e r                               //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/** Read-only access to a snapshot written with @ref SnapshotWriter.
+ *
+ *  The file is mapped to memory, so opening even a very large
+ *  snapshot is immediate, and only the pages that are touched are
+ *  read from the disk. The fitness column and the values of the
+ *  simple genes are read in place without deserializing the
+ *  individuals.
+ *
+ *  Usage:
+ *
+ *  SnapshotReader snap ("gen100.snap");
+ *  int x = snap.findGene ("x");
+ *  for (int i=0; i<snap.individuals(); i++)
+ *      printf ("%g %g\n", snap.fitness(i), snap.getDouble(i, x));
+ **/
+class SnapshotReader {
+  public:
+	/** How the value of a gene is stored in the record. */
+	enum kinds {CONTAINER=0,	/**< Gentainer, no value of its own. */
+				DOUBLE,			/**< A double, see @ref getDouble(). */
+				INT,			/**< A 32-bit int, see @ref getInt(). */
+				BOOL,			/**< A byte, see @ref getInt(). */
+				DOUBLES,		/**< An array of doubles, see @ref getDouble(). */
+				OTHER			/**< Only readable with @ref decode(). */
+	};
+
+	/** Maps the snapshot file to memory.
+	 *
+	 *  @throw checkpoint_error if the file can not be mapped or is not
+	 *  a valid snapshot.
+	 **/
+						SnapshotReader	(const String& file);
+						~SnapshotReader	();
+
+	/** Returns the number of individuals. */
+	int					individuals		() const;
+
+	/** Returns the age of the population when the snapshot was written. */
+	int					generation		() const;
+
+	/** Tells if the snapshot was written from individuals with the
+	 *  same genome structure as the given one.
+	 **/
+	bool				matches			(const Individual& prototype) const;
+
+	/** Returns the fitness of an individual. */
+	double				fitness			(int i) const {return rpFitness[i];}
+
+	/** Returns the fitness column of all the individuals. */
+	const double*		fitnesses		() const {return rpFitness;}
+
+	/** Returns the age of an individual. */
+	int					age				(int i) const;
+
+	/** Returns the number of genes in the directory, including the
+	 *  containers. The genome itself is gene 0.
+	 **/
+	int					genes			() const;
+
+	/** Returns the name of a gene. */
+	String				geneName		(int gene) const;
+
+	/** Returns the names of the containers of a gene and the gene,
+	 *  separated with slashes.
+	 **/
+	String				genePath		(int gene) const;
+
+	/** Returns the kind of a gene, see 'kinds'. */
+	int					geneKind		(int gene) const;
+
+	/** Returns the number of values of a DOUBLES gene, 1 for the other
+	 *  kinds with a value and 0 for CONTAINER.
+	 **/
+	int					geneCount		(int gene) const;
+
+	/** Returns the index of the first gene with the given name, in
+	 *  depth-first order, or -1 if there is none.
+	 **/
+	int					findGene		(const String& name) const;
+
+	/** Reads the value of a DOUBLE, INT or BOOL gene, or the k:th value
+	 *  of a DOUBLES gene, in place.
+	 **/
+	double				getDouble		(int i, int gene, int k=0) const;
+
+	/** Reads the value of an INT or BOOL gene in place. */
+	int					getInt			(int i, int gene) const;
+
+	/** Decodes a gene of any kind to the given structure, which must
+	 *  have the shape of the gene, for example a replicate of the
+	 *  gene of the prototype individual.
+	 **/
+	void				decode			(int i, int gene, Genstruct& into) const;
+
+	/** Copies the fitness, age and genome of an individual to the
+	 *  given one, which must match the snapshot (see @ref matches()).
+	 *  The state is read directly from the mapped record.
+	 **/
+	void				load			(int i, Individual& into) const;
+
+	/** Returns the record of an individual; see @ref
+	 *  Individual::saveState() for its format.
+	 **/
+	const char*			record			(int i) const {return rpRecords + size_t (i)*mStride;}
+
+	/** Returns the size of the serialized individual in the record. */
+	int					recordSize		() const;
+
+  private:
+	const SnapshotGene&	entry			(int gene) const;
+
+	void*				mpMap;
+	size_t				mMapSize;
+	const SnapshotHeader* rpHeader;
+	const SnapshotGene*	rpGenes;
+	const char*			rpNames;
+	const double*		rpFitness;
+	const char*			rpRecords;
+	size_t				mStride;
+
+	SnapshotReader (const SnapshotReader& o) {FORBIDDEN}
+	SnapshotReader& operator= (const SnapshotReader& o) {FORBIDDEN; return *this;}
+};
+
+#endif
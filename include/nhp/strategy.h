@@ -1,6 +1,8 @@
 #ifndef __STRATEGY_H__
 #define __STRATEGY_H__
 
+#include <pthread.h>
+
 ///////////////////////////////////////////////////////////////////////////////
 //                                                                           //
 //           -----   _    ----                                               //
@@ -41,7 +43,7 @@ class EAStrategy {
 	 *
 	 *  @param log Logging stream for brief evolution logs.
 	 **/
-	void			evolve			(EAEnvironment& envr, TextOStream& out, TextOStream& log);
+	virtual void	evolve			(EAEnvironment& envr, TextOStream& out, TextOStream& log);
 	
 	/** Adds strategy-dependent features to the given genome.
 	 **/
@@ -49,11 +51,21 @@ class EAStrategy {
 
 	/** Prints some strategic information to the given stream.
 	 **/
-	void			print			(TextOStream& out);
+	virtual void	print			(TextOStream& out);
 
 	/** Forms the next generation, usually by recombining parent
 	 *  individuals as offspring.
 	 *
+	 *  The offspring are created in the worker threads of the
+	 *  population. Each offspring draws its random numbers from its
+	 *  own @ref RandomStream, split from the root stream of the
+	 *  population by the generation and the index of the offspring,
+	 *  so the result
+	 *  does not depend on the number of threads or on how the work is
+	 *  divided. Self-adaptive mutation rates and mutability
+	 *  recording update shared statistics, so with them the
+	 *  offspring are created serially with the global generator.
+	 *
 	 *  @param pop_order The population of individuals in an array
 	 *  that is ordered according to their fitnesses.
 	 *
@@ -65,12 +77,16 @@ class EAStrategy {
 	void			recombine		(const SelectionSituation& situation,
 									 const SelectionMatrix& selmat);
 
+	/** Creates the i:th individual of the next generation. */
+	void			makeOffspring	(int i, const SelectionSituation& situation,
+									 const SelectionMatrix& selmat);
+
 	/** @ref OStream flags for outputting some trace information.
 	 **/
 	enum traceflags {TRACE_RECOMBINATION=10, TRACE_MUTATION};
 
 	/** Implementation for @ref Object */
-	void			check			() const;
+	virtual void	check			() const;
 	
   protected:
 	/** The population that is being evolved with this strategy. */
@@ -83,6 +99,78 @@ class EAStrategy {
 	bool allow_same_parents;
 };
 
+/** Asynchronous steady-state strategy.
+ *
+ *  Instead of waiting for the whole generation to be evaluated
+ *  before selecting, each worker thread of the population repeatedly
+ *  breeds an offspring from two tournament-selected parents,
+ *  evaluates it and inserts it into the population in place of a
+ *  worse member, and then starts with the next offspring at
+ *  once. A worker never waits for the evaluations of the others, so
+ *  all processors stay busy even if the evaluation times vary a lot.
+ *
+ *  The population is locked only for selecting the parents and
+ *  recombining them, and for the insertion. As the offspring are
+ *  inserted in the order the evaluations finish, the run is not
+ *  repeatable with several threads.
+ *
+ *  One call of @ref evolve() creates as many offspring as there are
+ *  individuals in the population.
+ **/
+class SteadyStateStrategy : public EAStrategy {
+  public:
+	enum replacements {REPLACE_WORST=0, REPLACE_TOURNAMENT};
+
+	/** Attaches the strategy to the given population.
+	 *
+	 *  @param params["SteadyState.tournament"] Size of the tournament
+	 *  for selecting each parent. [Default:2]
+	 *  @param params["SteadyState.replace"] Which member an offspring
+	 *  replaces: "worst" for the worst of the population or
+	 *  "tournament" for the worst of a tournament of the same size
+	 *  as for the parents. The offspring is inserted only if it is at
+	 *  least as good as the member. [Default:worst]
+	 **/
+					SteadyStateStrategy		(SimplePopulation& popula, const StringMap& params);
+	virtual			~SteadyStateStrategy	();
+
+	/** Implementation for @ref EAStrategy. Evaluates the
+	 *  individuals not yet evaluated, then breeds, evaluates and
+	 *  inserts a population-full of offspring.
+	 **/
+	virtual void	evolve					(EAEnvironment& envr, TextOStream& out, TextOStream& log);
+
+	/** Implementation for @ref EAStrategy. */
+	virtual void	print					(TextOStream& out);
+
+	/** Breeds, evaluates and inserts offspring with the given
+	 *  numbers. Called from the worker threads.
+	 **/
+	void			breed					(int begin, int end, int worker, EAEnvironment& envr);
+
+	/** Returns the number of offspring inserted so far. */
+	int				inserted				() const {return mInserted;}
+
+	/** Returns the number of offspring discarded so far because they
+	 *  were worse than the member they would have replaced.
+	 **/
+	int				discarded				() const {return mDiscarded;}
+
+  private:
+	/** Selects a parent with a tournament. Called with the lock held. */
+	int				selectParent			() const;
+
+	/** Selects the member to be replaced. Called with the lock held. */
+	int				selectVictim			() const;
+
+	int					mTournament;	/**> Tournament size. */
+	int					mReplacement;	/**> See 'replacements'. */
+	Array<Individual>	mOffspring;		/**> Offspring being bred by each worker. */
+	pthread_mutex_t		mLock;			/**> Protects the population. */
+	int					mInserted;
+	int					mDiscarded;
+};
+
 
 //
 // Timing in strategy
@@ -23,6 +23,7 @@
  ***************************************************************************/
 
 #include "nhp/gaenvrnmt.h"
+#include "nhp/genes.h"
 #include <magic/mtable.h>
 #include <magic/mmath.h>
 #include <magic/mmap.h>
@@ -41,6 +42,9 @@ class BinaryTestEAEnv : public EAEnvironment {
 	// Should be bool-table but gcc doesn't like them
 	PackTable<int>	targets;
 	int				mObjective;
+	Array<GenePath>	mGenePaths;	// Paths of the genes x0..xn (or x if packed), if resolved
+	bool			mPacked;	// Are the bits in one PackedBitGentainer
+	PackedBitGentainer	mTarget;	// The first target as packed bits
   public:
 
 	/** Creates a binary test environment.
@@ -55,10 +59,19 @@ class BinaryTestEAEnv : public EAEnvironment {
 	/** Changes objective to another target (usually 0 or 1).
 	 **/
 	void			changeObjective				(int target);
+
+	/** Sets the genome representation: if true, the bits are stored
+	 *  in one @ref PackedBitGentainer named "x" instead of separate
+	 *  @ref BinaryGene genes x0..xn. The packed representation is
+	 *  much faster for large dimensions. Must be set before creating
+	 *  the population.
+	 **/
+	void			setPacked					(bool packed=true) {mPacked=packed;}
 	
 	// Implementations
 	
 	virtual void	addFeaturesTo				(Genome& genome) const;
+	virtual void	resolveGenes				(const Genome& templ);
 	virtual void	init_cycle					() {;}
 	virtual double	evaluateg					(const Individual& genome);
 	virtual void	cycle_report				(OStream& log, OStream& out);
@@ -82,7 +95,18 @@ class FloatTestEAEnv : public EAEnvironment {
 	/** Standard constructor.
 	 *
 	 *  @param params Dynamic parameters in a @ref String @ref
-	 *  Map. Important only for defining ["BitFloatGene.grayCoding"].
+	 *  Map. Important only for defining ["BitFloatGene.grayCoding"]
+	 *  and ["FloatTestEAEnv.batchWidth"], the number of individuals
+	 *  evaluated at once, or 0 to evaluate them one at a time. The
+	 *  blocks are calculated with @ref calcBatch() without calling
+	 *  @ref evaluateg(), so subclasses that override evaluateg()
+	 *  must leave this 0. See @ref
+	 *  EAEnvironment::evaluateBatch(). [Default:0]
+	 *  @param params["FloatTestEAEnv.kernels"] How the blocks are
+	 *  calculated: "exact" gives the same results as @ref calc(),
+	 *  "fast" uses the fastest approximate @ref TestKernels of the
+	 *  processor, and "scalar", "avx2" or "avx512" the given
+	 *  ones. [Default:exact]
 	 *
 	 *  @param dim Dimension of the search space, i.e. number of
 	 *  floating-point genes in the genome. Genes will gave value
@@ -105,25 +129,45 @@ class FloatTestEAEnv : public EAEnvironment {
 	 **/
 	double	calc						(const Vector& v, int f);
 
+	/** Calculates the value of test function for a block of input
+	 *  vectors, like @ref calc() does for one.
+	 *
+	 *  @param x Matrix of the input vectors, with a row for each
+	 *  dimension: x[i*n+k] is the i:th element of the k:th vector.
+	 *  @param n Number of vectors.
+	 *  @param f ID of test function.
+	 *  @param result The values are stored here.
+	 **/
+	void	calcBatch					(const double* x, int n, int f, double* result);
+
+	/** Sets the kernels used by @ref calcBatch(), see @ref
+	 *  TestKernels::isas. The processor must support them.
+	 **/
+	void	setKernels					(int isa);
+
 	/** Changes the objective.
 	 **/
 	void			changeObjective		(int o) {mObjective=o;}
 
-	/** Sets the gene type: name ESFLOAT is @ref FloatGene and name
-	 *  BITFLOAT is @ref BitFloatGene (with 16 bits).
+	/** Sets the gene type: name ESFLOAT is @ref FloatGene, name
+	 *  BITFLOAT is @ref BitFloatGene (with 16 bits) and name VECFLOAT
+	 *  is a single @ref FloatVectorGene "x" of dimension dim.
 	 **/
 	void			setGeneType			(int vt) {mGeneType=vt;}
 	
 	// Implementations
 	
 	virtual void	addFeaturesTo			(Genome& genome) const;
+	virtual void	resolveGenes			(const Genome& templ);
 	virtual void	init_cycle				() {;}
 	virtual double	evaluateg				(const Individual& genome);
+	virtual int		batchWidth				() const {return mBatchWidth;}
+	virtual void	evaluateBatch			(const Individual* const* indivs, int n, double* fitness);
 	virtual void	cycle_report			(OStream& log, OStream& out) {;}
 
 	enum testfunctions {Sphere=0, Ellipsoid, NegSphere, ZeroMin,
 						F4, F5, F6, F7, F8, /* Number of functions: */ functions};
-	enum genetypes {ESFLOAT=0, BITFLOAT};
+	enum genetypes {ESFLOAT=0, BITFLOAT, VECFLOAT};
 
   protected:
 	/** Dimension of search space. */
@@ -140,6 +184,11 @@ class FloatTestEAEnv : public EAEnvironment {
 
 	int		mObjective;
 	int		mGeneType;
+	int		mBatchWidth;
+	int		mKernels;
+
+	/** Paths of the genes x0..x(dim-1) (or x with VECFLOAT), if resolved. */
+	Array<GenePath>	mGenePaths;
 
 	const StringMap& mParams;
 	
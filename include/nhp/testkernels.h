@@ -0,0 +1,83 @@
+/***************************************************************************
+ *   This file is part of the NeHeP library.                               *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __NHP_TESTKERNELS_H__
+#define __NHP_TESTKERNELS_H__
+
+/** Fast kernels of the test functions of @ref FloatTestEAEnv for
+ *  blocks of input vectors.
+ *
+ *  The kernels compute the functions for several vectors at once with
+ *  the SIMD instructions of the processor, and the sines and cosines
+ *  with polynomial approximations instead of the math library. The
+ *  results differ from @ref FloatTestEAEnv::calc() by rounding
+ *  errors, about 1E-15 relative to the sum, so they should not be
+ *  mixed with the exact results in the same run.
+ *
+ *  The instruction set is chosen at run time. The scalar kernels use
+ *  the same approximations and work on any processor.
+ **/
+class TestKernels {
+  public:
+	enum isas {EXACT=0,		/**< The functions of the math library, see @ref FloatTestEAEnv::calcBatch(). */
+			   SCALAR,		/**< Approximations without SIMD. */
+			   AVX2,		/**< 4 vectors at a time with AVX2 and FMA. */
+			   AVX512,		/**< 8 vectors at a time with AVX-512F. */
+			   ISAS};
+
+	/** Tells if the processor can run the kernels of the given
+	 *  instruction set.
+	 **/
+	static bool			supported		(int isa);
+
+	/** Returns the fastest instruction set supported by the processor. */
+	static int			best			();
+
+	/** Returns the name of an instruction set, as used in the
+	 *  parameters: "exact", "scalar", "avx2" or "avx512".
+	 **/
+	static const char*	name			(int isa);
+
+	/** Returns the instruction set with the given name, "fast" for
+	 *  @ref best(), or -1 if the name is unknown.
+	 **/
+	static int			find			(const char* name);
+
+	/** Calculates a test function for a block of input vectors.
+	 *
+	 *  @param isa Instruction set, other than EXACT, that must be
+	 *  supported.
+	 *  @param func ID of the test function, see @ref
+	 *  FloatTestEAEnv::testfunctions.
+	 *  @param x Matrix of the input vectors, with a row for each
+	 *  dimension: x[i*n+k] is the i:th element of the k:th vector.
+	 *  @param dim Dimension of the vectors.
+	 *  @param n Number of vectors.
+	 *  @param result The values are stored here.
+	 **/
+	static void			calc			(int isa, int func, const double* x, int dim, int n,
+										 double* result);
+};
+
+#endif
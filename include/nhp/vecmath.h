@@ -0,0 +1,121 @@
+/***************************************************************************
+ *   This file is part of the NeHeP library.                               *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __NHP_VECMATH_H__
+#define __NHP_VECMATH_H__
+
+#include <stdint.h>
+
+/** Branch-free approximations of elementary functions for batch
+ *  loops.
+ *
+ *  The functions of the math library are opaque calls, and even an
+ *  inlined sqrt() keeps a branch to the library for setting errno,
+ *  which keeps the compiler from vectorizing loops that use them.
+ *  These inline versions use only arithmetic and bit operations, with
+ *  no comparisons and no conversions between integers and floating
+ *  point, so loops over arrays are vectorized with -O3 already for
+ *  plain SSE2. The relative error is below 1E-10 in the documented
+ *  ranges, which is plenty for generating random numbers.
+ **/
+
+/** Natural logarithm of a positive, finite, normalized x. */
+inline double vecLog (double x)
+{
+	union {double d; uint64_t w;} bits, exponent;
+	bits.d = x;
+
+	// Split to exponent and mantissa in [sqrt(1/2), sqrt(2)). The
+	// subtraction borrows to the top bit if the mantissa is above
+	// sqrt(2), and the exponent is converted to double by placing it
+	// in the low bits of 2^52.
+	uint64_t mantissa = bits.w & 0x000FFFFFFFFFFFFFULL;
+	uint64_t big      = (0x6A09E667F3BCCULL - mantissa) >> 63;
+	exponent.w = 0x4330000000000000ULL | ((bits.w >> 52) + big);
+	double e = exponent.d - (4503599627370496.0 + 1023.0);
+	bits.w = mantissa | ((1023 - big) << 52);
+	double m = bits.d;
+
+	// log(m) = 2 atanh(s), s = (m-1)/(m+1), |s| < 0.172
+	double s  = (m-1.0)/(m+1.0);
+	double s2 = s*s;
+	double p  = 1.0/13;
+	p = p*s2 + 1.0/11;
+	p = p*s2 + 1.0/9;
+	p = p*s2 + 1.0/7;
+	p = p*s2 + 1.0/5;
+	p = p*s2 + 1.0/3;
+	p = p*s2 + 1.0;
+	return 2.0*s*p + e*0.69314718055994531;
+}
+
+/** Square root of a non-negative, finite x. */
+inline double vecSqrt (double x)
+{
+	union {double d; uint64_t w;} bits;
+	bits.d = x;
+
+	// Initial guess of 1/sqrt(x) from the bits, refined with four
+	// Newton steps. For x=0 the guess stays finite, so the result is 0.
+	bits.w = 0x5FE6EB50C7B537A9ULL - (bits.w >> 1);
+	double y = bits.d;
+	y = y*(1.5 - 0.5*x*y*y);
+	y = y*(1.5 - 0.5*x*y*y);
+	y = y*(1.5 - 0.5*x*y*y);
+	y = y*(1.5 - 0.5*x*y*y);
+	return x*y;
+}
+
+/** Sine and cosine of x in range [-pi, pi]. */
+inline void vecSinCos (double x, double& sine, double& cosine)
+{
+	// Evaluate the half angle, |h| <= pi/2, with Taylor polynomials
+	// and double it
+	double h  = 0.5*x;
+	double h2 = h*h;
+
+	double s = -1.0/1307674368000.0;			// -1/15!
+	s = s*h2 + 1.0/6227020800.0;				//  1/13!
+	s = s*h2 - 1.0/39916800.0;					// -1/11!
+	s = s*h2 + 1.0/362880.0;					//  1/9!
+	s = s*h2 - 1.0/5040.0;						// -1/7!
+	s = s*h2 + 1.0/120.0;						//  1/5!
+	s = s*h2 - 1.0/6.0;							// -1/3!
+	s = h + h*h2*s;
+
+	double c = 1.0/20922789888000.0;			//  1/16!
+	c = c*h2 - 1.0/87178291200.0;				// -1/14!
+	c = c*h2 + 1.0/479001600.0;					//  1/12!
+	c = c*h2 - 1.0/3628800.0;					// -1/10!
+	c = c*h2 + 1.0/40320.0;						//  1/8!
+	c = c*h2 - 1.0/720.0;						// -1/6!
+	c = c*h2 + 1.0/24.0;						//  1/4!
+	c = c*h2 - 0.5;								// -1/2!
+	c = 1.0 + h2*c;
+
+	sine   = 2.0*s*c;
+	cosine = c*c - s*s;
+}
+
+#endif
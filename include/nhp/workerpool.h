@@ -0,0 +1,177 @@
+/***************************************************************************
+ *   This file is part of the NeHeP library.                               *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __WORKERPOOL_H__
+#define __WORKERPOOL_H__
+
+#include <pthread.h>
+#include <magic/mobject.h>
+#include <magic/mthread.h>
+
+using namespace MagiC;
+
+// Internals
+class PoolThread;
+struct WorkerDeque;
+
+/** Interface for a job that a @ref WorkerPool can execute in parallel.
+ *
+ *  The job is a range of items (for example, indices of individuals
+ *  in a population) that the pool splits into chunks and hands out
+ *  to its worker threads.
+ **/
+class PoolTask {
+  public:
+	virtual			~PoolTask		() {}
+
+	/** Processes the items in range [begin, end). Called
+	 *  concurrently from several threads, but never with overlapping
+	 *  ranges.
+	 *
+	 *  @param worker Index of the calling worker, 0..threads()-1. It
+	 *  can be used for indexing per-thread data without locking.
+	 **/
+	virtual void	process			(int begin, int end, int worker) {MUST_OVERLOAD}
+};
+
+/** Locks a mutex for the lifetime of the scope object, so that the
+ *  mutex is released also when an exception leaves the scope.
+ **/
+class MutexLock {
+  public:
+					MutexLock		(pthread_mutex_t& mutex) : mrMutex (mutex) {pthread_mutex_lock (&mrMutex);}
+					~MutexLock		() {pthread_mutex_unlock (&mrMutex);}
+
+  private:
+	pthread_mutex_t&	mrMutex;
+
+	MutexLock (const MutexLock& o) : mrMutex (o.mrMutex) {FORBIDDEN}
+	MutexLock& operator= (const MutexLock& o) {FORBIDDEN; return *this;}
+};
+
+/** A fixed-size set of long-lived threads for running @ref PoolTask
+ *  jobs.
+ *
+ *  The threads are created once, when the pool is created, and they
+ *  sleep between jobs. This avoids creating and joining a thread for
+ *  each individual in each generation.
+ *
+ *  The thread calling @ref run() takes part in the work as worker 0,
+ *  so a pool of one thread runs everything in the calling thread.
+ *
+ *  Two schedulers are available. CHUNKED hands out chunks from a
+ *  shared counter. STEALING gives each worker its own deque of
+ *  items, and a worker that runs out of items steals half of the
+ *  remaining items of a randomly chosen other worker. Stealing
+ *  keeps the workers busy until the end of the job when the cost of
+ *  the items varies a lot.
+ **/
+class WorkerPool {
+  public:
+	enum schedulers {CHUNKED=0, STEALING};
+
+	/** Creates the pool.
+	 *
+	 *  @param threads Number of workers, including the calling
+	 *  thread. Zero or negative value means the number of online
+	 *  processors.
+	 *
+	 *  @param scheduler How the items are distributed to the
+	 *  workers, see 'schedulers'.
+	 **/
+					WorkerPool		(int threads=0, int scheduler=STEALING);
+					~WorkerPool		();
+
+	/** Runs the task for items 0..n-1 and returns when all of them
+	 *  have been processed.
+	 *
+	 *  @param chunk Maximum number of items a worker processes at a
+	 *  time. Zero means automatic size.
+	 **/
+	void			run				(PoolTask& task, int n, int chunk=0);
+
+	/** Returns the number of workers, including the calling thread. */
+	int				threads			() const {return mThreadCount;}
+
+	/** Sets the scheduler used by the following jobs. */
+	void			setScheduler	(int scheduler);
+
+	/** Returns the current scheduler. */
+	int				scheduler		() const {return mScheduler;}
+
+	/** Returns the wall-clock time of the last job in seconds. */
+	double			runTime			() const {return mRunTime;}
+
+	/** Returns the total time the workers were idle during the last
+	 *  job in seconds, summed over all workers. This includes waiting
+	 *  for the slowest worker at the end of the job.
+	 **/
+	double			idleTime		() const;
+
+	/** Returns the number of online processors in the system. */
+	static int		processors		();
+
+  private:
+	/** Main loop of the helper threads. */
+	void			workerLoop		(int worker);
+
+	/** Takes chunks from the current job until it is exhausted. */
+	void			work			(int worker);
+
+	/** Works with the chunked scheduler. */
+	void			workChunked		(int worker);
+
+	/** Works with the work-stealing scheduler. */
+	void			workStealing	(int worker);
+
+	/** Steals half of the items of the victim to the thief's deque. */
+	bool			steal			(int victim, int thief);
+
+	int					mThreadCount;	/**> Number of workers, including the caller. */
+	int					mScheduler;		/**> Current scheduler. */
+	PoolThread**		mpThreads;		/**> Helper threads 1..mThreadCount-1. */
+	WorkerDeque*		mpDeques;		/**> Item deques and statistics of each worker. */
+
+	pthread_mutex_t		mMutex;			/**> Protects the job state below. */
+	pthread_cond_t		mWakeup;		/**> Signals a new job or shutdown. */
+	pthread_cond_t		mDone;			/**> Signals that a helper finished the job. */
+
+	PoolTask*			mpTask;			/**> The current job. */
+	int					mItems;			/**> Number of items in the current job. */
+	int					mChunk;			/**> Chunk size of the current job. */
+	volatile int		mNext;			/**> Next item to hand out; advanced atomically. */
+	volatile int		mRemaining;		/**> Number of unprocessed items; decreased atomically. */
+	double				mRunTime;		/**> Duration of the last job. */
+	int					mJob;			/**> Job sequence number, for waking up the helpers. */
+	int					mBusy;			/**> Number of helpers still working on the job. */
+	bool				mQuit;			/**> Shutdown flag. */
+	String				mError;			/**> Message of an exception thrown by a helper. */
+
+	friend class PoolThread;
+
+	WorkerPool (const WorkerPool& o) {FORBIDDEN}
+	WorkerPool& operator= (const WorkerPool& o) {FORBIDDEN; return *this;}
+};
+
+#endif
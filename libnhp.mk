@@ -43,13 +43,22 @@ include $(SRCDIR)/build/magicdef.mk
 # Source files
 ################################################################################
 
-sources =	gaenvrnmt.cc genes.cc genetics.cc individual.cc population.cc \
-		selection.cc simplepopula.cc testenv.cc
+sources =	aliastable.cc checkpoint.cc evolog.cc gaenvrnmt.cc genepool.cc \
+		genes.cc genetics.cc gridpopulation.cc individual.cc \
+		metapopulation.cc population.cc profiler.cc random.cc selection.cc \
+		simplepopula.cc snapshot.cc testenv.cc testkernels.cc workerpool.cc
 
-headers =	gaenvrnmt.h genes.h genetics.h gridpopulation.h individual.h \
-		metapopulation.h mutator.h mutrecord.h population.h \
-		selection.h simplepopula.h simplepopulation.h strategy.h \
-		testenv.h
+headers =	aliastable.h checkpoint.h evolog.h gaenvrnmt.h genepool.h genes.h \
+		genetics.h gridpopulation.h individual.h metapopulation.h \
+		mutator.h mutrecord.h population.h profiler.h random.h selection.h \
+		simplepopula.h simplepopulation.h snapshot.h strategy.h testenv.h \
+		testkernels.h vecmath.h workerpool.h
+
+# Uncomment to time the phases of the generations; see nhp/profiler.h
+# CXXFLAGS += -DNHP_PROFILE
+
+# Uncomment to allocate the genes with the global allocator; see nhp/genepool.h
+# CXXFLAGS += -DNHP_NO_GENEPOOL
 
 
 headersubdir = nhp
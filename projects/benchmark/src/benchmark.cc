@@ -0,0 +1,591 @@
+/***************************************************************************
+ *   This file is part of the NeHeP library.                               *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <magic/mapplic.h>
+#include <magic/mtextstream.h>
+#include <nhp/testenv.h>
+#include <nhp/simplepopula.h>
+#include <nhp/selection.h>
+#include <nhp/genes.h>
+#include <nhp/testkernels.h>
+#include <nhp/genepool.h>
+
+/*******************************************************************************
+ * Benchmark of the genetic operators and the generation loop.
+ *
+ * Every case is run over a grid of genome lengths and population
+ * sizes, for each test environment. The results are written as
+ * tab-separated columns with a header line, one line per case and
+ * grid point, so that the results of different releases can be
+ * compared with a script:
+ *
+ *   case env genes population iterations seconds ns_per_op
+ *
+ * Parameters (in benchmark.cfg or on the command line):
+ *
+ *   Benchmark.genes      Genome lengths to run. [Default:10,100,1000]
+ *   Benchmark.sizes      Population sizes to run. [Default:20,100,500]
+ *   Benchmark.envs       Test environments: "float" (FloatGene), "bitfloat"
+ *                        (BitFloatGene) and "binary". [Default:float,bitfloat,binary]
+ *   Benchmark.minTime    Minimum time of a measurement in milliseconds. [Default:200]
+ *   Benchmark.output     File for the results. [Default:benchmark.tsv]
+ *   Benchmark.tolerance  Largest accepted relative error of the approximate
+ *                        test function kernels. [Default:1E-12]
+ *   Benchmark.poolRounds Rounds of the allocation stress check. [Default:10]
+ *
+ * Before the timings, the results of the approximate @ref TestKernels are
+ * checked against the exact FloatTestEAEnv::calc(). With the "float"
+ * environment, the kernels are also timed for blocks of as many vectors
+ * as there are individuals, with env "kernel".
+ *
+ * The @ref GenePool is checked by building genomes in one thread and
+ * deleting them in another, with new threads in every round, as the
+ * island threads of a Metapopulation do. The memory reserved by the pool
+ * must not grow after the first round. The building of whole populations
+ * is timed as "Population::build"; for example Benchmark.genes=500 and
+ * Benchmark.sizes=10000 time a population of 10000 individuals with 500
+ * genes each.
+ *
+ * Other parameters are passed to the populations.
+ ******************************************************************************/
+
+/** An operation whose time is measured. */
+class Operation {
+  public:
+	virtual			~Operation	() {}
+
+	/** Runs the operation the given number of times. */
+	virtual void	run			(int iterations) = 0;
+};
+
+/** Sink for the results of the operations, so that the compiler can't
+ *  optimize them away.
+ **/
+static volatile double	sink;
+
+static double clockTime ()
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec*1E-9;
+}
+
+/** Parses a comma-separated list of numbers. */
+static void parseList (const String& list, PackArray<int>& values)
+{
+	values.make (0);
+	const char* p = (CONSTR) list;
+	while (*p) {
+		char* end;
+		long value = strtol (p, &end, 10);
+		ASSERTWITH (end != p && value > 0, format ("Invalid number list '%s'", (CONSTR) list));
+		values.resize (values.size()+1);
+		values[values.size()-1] = int (value);
+		p = (*end == ',')? end+1 : end;
+	}
+}
+
+/*******************************************************************************
+ * Runs the operation with growing number of iterations until one
+ * measurement takes at least the minimum time, and writes the result.
+ ******************************************************************************/
+class Runner {
+  public:
+					Runner		(TextOStream& out, double minTime) : mrOut (out), mMinTime (minTime) {
+						mrOut << "case\tenv\tgenes\tpopulation\titerations\tseconds\tns_per_op\n";
+					}
+
+	/** The grid point of the following measurements. */
+	void			setPoint	(const String& env, int genes, int population) {
+						mEnv = env;
+						mGenes = genes;
+						mPopulation = population;
+					}
+
+	void			measure		(const String& name, Operation& op) {
+						// Warm up the caches and the allocator
+						op.run (1);
+
+						int iterations = 1;
+						double seconds;
+						while (true) {
+							double start = clockTime ();
+							op.run (iterations);
+							seconds = clockTime () - start;
+							if (seconds >= mMinTime || iterations >= (1<<30))
+								break;
+
+							// Aim a little over the minimum time
+							int next = (seconds > 0.0)? int (iterations * 1.2 * mMinTime / seconds) : iterations*10;
+							iterations = (next > iterations*10)? iterations*10 : (next > iterations)? next : iterations*2;
+						}
+
+						mrOut.printf ("%s\t%s\t%d\t%d\t%d\t%.6f\t%.1f\n", (CONSTR) name, (CONSTR) mEnv,
+									  mGenes, mPopulation, iterations, seconds, seconds*1E9/iterations);
+						mrOut.flush ();
+						sout.printf ("%-40s %-8s %5d genes %5d individuals %12.1f ns\n", (CONSTR) name, (CONSTR) mEnv,
+									 mGenes, mPopulation, seconds*1E9/iterations);
+					}
+
+  private:
+	TextOStream&	mrOut;
+	double			mMinTime;
+	String			mEnv;
+	int				mGenes;
+	int				mPopulation;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//                       O p e r a t i o n s                                 //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/** Finds the last gene of the genome by its name. */
+class GetGeneOp : public Operation {
+	const Genome&	mrGenome;
+	String			mName;
+  public:
+					GetGeneOp	(const Genome& genome, const String& name) : mrGenome (genome), mName (name) {}
+	virtual void	run			(int n) {
+		for (int i=0; i<n; i++)
+			sink = (mrGenome.getGene (mName) != NULL);
+	}
+};
+
+/** Decodes the value of each BitFloatGene of the genome. */
+class GetValueOp : public Operation {
+	PackArray<const BitFloatGene*>	mGenes;
+  public:
+					GetValueOp	(const Genome& genome, int genes) : mGenes (genes) {
+		for (int g=0; g<genes; g++)
+			mGenes[g] = dynamic_cast<const BitFloatGene*> (genome.getGene (format ("x%d", g)));
+	}
+	virtual void	run			(int n) {
+		double sum = 0.0;
+		for (int i=0; i<n; i++)
+			for (int g=0; g<mGenes.size(); g++)
+				sum += mGenes[g]->getvalue ();
+		sink = sum;
+	}
+};
+
+/** Recombines two individuals of the population. */
+class RecombineOp : public Operation {
+	const SimplePopulation&	mrPop;
+	Genome					mChild;
+  public:
+					RecombineOp	(const SimplePopulation& pop) : mrPop (pop), mChild (pop[0].getGenome()) {}
+	virtual void	run			(int n) {
+		for (int i=0; i<n; i++)
+			mChild.recombine (mrPop[i%2].getGenome(), mrPop[1-i%2].getGenome());
+	}
+};
+
+/** Point mutates a genome with the mutation rates of the population. */
+class MutateOp : public Operation {
+	SimplePopulation&	mrPop;
+	Genome				mChild;
+  public:
+					MutateOp	(SimplePopulation& pop) : mrPop (pop), mChild (pop[0].getGenome()) {}
+	virtual void	run			(int n) {
+		for (int i=0; i<n; i++)
+			sink = mChild.pointMutate (mrPop.mutRate());
+	}
+};
+
+/** Copies the genome of an individual over another genome. */
+class CopyOp : public Operation {
+	const SimplePopulation&	mrPop;
+	Genome					mChild;
+  public:
+					CopyOp		(const SimplePopulation& pop) : mrPop (pop), mChild (pop[0].getGenome()) {}
+	virtual void	run			(int n) {
+		for (int i=0; i<n; i++)
+			mChild.copy (mrPop[1].getGenome());
+	}
+};
+
+/** Creates and destroys a replica of an individual. */
+class IndividualOp : public Operation {
+	const Individual&	mrPrototype;
+  public:
+					IndividualOp	(const Individual& prototype) : mrPrototype (prototype) {}
+	virtual void	run				(int n) {
+		for (int i=0; i<n; i++)
+			delete new Individual (mrPrototype);
+	}
+};
+
+/** Builds and destroys a population of replicas of an individual. */
+class BuildOp : public Operation {
+	const Individual&	mrPrototype;
+	int					mSize;
+  public:
+					BuildOp		(const Individual& prototype, int size) : mrPrototype (prototype), mSize (size) {}
+	virtual void	run			(int n) {
+		for (int i=0; i<n; i++) {
+			Array<Individual> population;
+			population.make (mSize);
+			for (int j=0; j<mSize; j++)
+				population.put (new Individual (mrPrototype), j);
+		}
+	}
+};
+
+/** Calculates the selection matrix of the population. */
+class SelectionMatrixOp : public Operation {
+	const SelectionSituation&	mrSituation;
+	int							mSampler;
+  public:
+					SelectionMatrixOp	(const SelectionSituation& situation, int sampler)
+							: mrSituation (situation), mSampler (sampler) {}
+	virtual void	run					(int n) {
+		for (int i=0; i<n; i++) {
+			SelectionMatrix matrix (mrSituation, mSampler);
+			sink = matrix.sampler ();
+		}
+	}
+};
+
+/** Draws parent pairs from a selection matrix. */
+class SampleOp : public Operation {
+	const SelectionMatrix&	mrMatrix;
+  public:
+					SampleOp	(const SelectionMatrix& matrix) : mrMatrix (matrix) {}
+	virtual void	run			(int n) {
+		int a, b, sum = 0;
+		for (int i=0; i<n; i++) {
+			mrMatrix.selectRandomPair (a, b);
+			sum += a+b;
+		}
+		sink = sum;
+	}
+};
+
+/** Evolves the population for whole generations. */
+class EvolveOp : public Operation {
+	SimplePopulation&	mrPop;
+  public:
+					EvolveOp	(SimplePopulation& pop) : mrPop (pop) {}
+	virtual void	run			(int n) {
+		mrPop.evolve (n);
+	}
+};
+
+/** Calculates a test function for a block of vectors. */
+class KernelOp : public Operation {
+	FloatTestEAEnv&		mrEnv;
+	const double*		mpX;
+	int					mN;
+	int					mFunc;
+	PackArray<double>	mResult;
+  public:
+					KernelOp	(FloatTestEAEnv& env, const double* x, int n, int func)
+							: mrEnv (env), mpX (x), mN (n), mFunc (func), mResult (n) {}
+	virtual void	run			(int n) {
+		for (int i=0; i<n; i++)
+			mrEnv.calcBatch (mpX, mN, mFunc, mResult.getData ());
+		sink = mResult[0];
+	}
+};
+
+/** The test functions whose kernels are timed. */
+static const int	kernelFunctions []		= {FloatTestEAEnv::Sphere, FloatTestEAEnv::F4,
+											   FloatTestEAEnv::F5, FloatTestEAEnv::F6};
+static const char*	kernelFunctionNames []	= {"Sphere", "F4", "F5", "F6"};
+
+/*******************************************************************************
+ * Fills a matrix of vectors with random values in the range of the genes
+ * of FloatTestEAEnv.
+ ******************************************************************************/
+static void randomVectors (PackArray<double>& x, int dim, int n)
+{
+	x.make (dim*n);
+	for (int j=0; j<dim*n; j++)
+		x[j] = 8*frnd () - 4;
+}
+
+/*******************************************************************************
+ * Checks the results of the approximate kernels against the exact
+ * calculation of each test function, and fails if the largest relative
+ * error is over the tolerance.
+ ******************************************************************************/
+void checkKernels (const StringMap& params)
+{
+	double tolerance = getOrDefault (params, "Benchmark.tolerance", String(1E-12)).toDouble ();
+
+	// An odd number of vectors, so that the partial registers are tested too
+	const int dim = 1000, n = 67;
+	PackArray<double> x;
+	randomVectors (x, dim, n);
+
+	FloatTestEAEnv env (params, dim);
+	PackArray<double> result (n);
+	Vector v (dim);
+	bool ok = true;
+	for (int isa=TestKernels::SCALAR; isa<TestKernels::ISAS; isa++) {
+		if (!TestKernels::supported (isa)) {
+			sout.printf ("Kernel accuracy %-8s not supported\n", TestKernels::name (isa));
+			continue;
+		}
+		env.setKernels (isa);
+		for (int f=0; f<FloatTestEAEnv::functions; f++) {
+			env.calcBatch (x.getData (), n, f, result.getData ());
+
+			double maxError = 0.0;
+			for (int k=0; k<n; k++) {
+				for (int i=0; i<dim; i++)
+					v[i] = x[i*n+k];
+				double exact = env.calc (v, f);
+				double error = fabs (result[k]-exact) / ((fabs (exact) > 1.0)? fabs (exact) : 1.0);
+				if (error > maxError)
+					maxError = error;
+			}
+			sout.printf ("Kernel accuracy %-8s function %d: %.3g %s\n", TestKernels::name (isa), f,
+						 maxError, (maxError <= tolerance)? "ok" : "FAILED");
+			ok = ok && maxError <= tolerance;
+		}
+	}
+	ASSERTWITH (ok, "The test function kernels are not accurate enough");
+}
+
+/*******************************************************************************
+ * Genomes passed from the building thread to the deleting thread of the pool
+ * check.
+ ******************************************************************************/
+struct PoolCheck {
+	const Genome*	prototype;
+	Array<Genome>	genomes;
+};
+
+static void* buildGenomes (void* data)
+{
+	PoolCheck& check = *static_cast<PoolCheck*> (data);
+	for (int i=0; i<check.genomes.size(); i++)
+		check.genomes.put (new Genome (*check.prototype), i);
+	return NULL;
+}
+
+static void* deleteGenomes (void* data)
+{
+	PoolCheck& check = *static_cast<PoolCheck*> (data);
+	for (int i=0; i<check.genomes.size(); i++)
+		delete check.genomes.cut (i);
+	return NULL;
+}
+
+/*******************************************************************************
+ * Builds genomes in one thread and deletes them in another, with new threads
+ * in every round, and fails if the memory reserved by the gene pool grows
+ * after the first round.
+ ******************************************************************************/
+void checkPool (const StringMap& params)
+{
+	int rounds = getOrDefault (params, "Benchmark.poolRounds", String(10)).toInt ();
+
+	Genome prototype;
+	FloatTestEAEnv env (params, 100);
+	env.addFeaturesTo (prototype);
+
+	PoolCheck check;
+	check.prototype = &prototype;
+	check.genomes.make (1000);
+
+	long first = 0;
+	for (int r=0; r<rounds; r++) {
+		pthread_t thread;
+		pthread_create (&thread, NULL, buildGenomes, &check);
+		pthread_join (thread, NULL);
+		pthread_create (&thread, NULL, deleteGenomes, &check);
+		pthread_join (thread, NULL);
+		if (r==0)
+			first = GenePool::reserved ();
+	}
+
+	long last = GenePool::reserved ();
+	sout.printf ("Gene pool %s: %ld bytes after the first round, %ld after %d rounds %s\n",
+				 GenePool::enabled ()? "enabled" : "disabled", first, last, rounds,
+				 (last <= first)? "ok" : "FAILED");
+	ASSERTWITH (last <= first, "The gene pool leaks memory between threads");
+}
+
+/*******************************************************************************
+ * Times the test function kernels at one grid point.
+ ******************************************************************************/
+void benchmarkKernels (Runner& runner, int genes, int size, const StringMap& params)
+{
+	PackArray<double> x;
+	randomVectors (x, genes, size);
+
+	FloatTestEAEnv env (params, genes);
+	runner.setPoint ("kernel", genes, size);
+	for (int isa=0; isa<TestKernels::ISAS; isa++) {
+		if (!TestKernels::supported (isa))
+			continue;
+		env.setKernels (isa);
+		for (int f=0; f<4; f++) {
+			KernelOp op (env, x.getData (), size, kernelFunctions[f]);
+			runner.measure (format ("FloatTestEAEnv::calcBatch.%s.%s", TestKernels::name (isa),
+									kernelFunctionNames[f]), op);
+		}
+	}
+}
+
+/*******************************************************************************
+ * Runs all the cases at one grid point.
+ ******************************************************************************/
+void benchmarkPopulation (Runner& runner, EAEnvironment& env, const String& envName,
+						  int genes, int size, const StringMap& params)
+{
+	SimplePopulation pop (env, params);
+	pop.mOuts.setDevice (NULL);
+
+	// Evaluate the population once, so that it can be ordered
+	pop.evolve (1);
+
+	runner.setPoint (envName, genes, size);
+	const Genome& genome = pop[0].getGenome ();
+
+	GetGeneOp getGene (genome, format ("x%d", genes-1));
+	runner.measure ("Gentainer::getGene", getGene);
+
+	if (envName == "bitfloat") {
+		GetValueOp getValue (genome, genes);
+		runner.measure ("BitFloatGene::getvalue", getValue);
+	}
+
+	RecombineOp recombine (pop);
+	runner.measure ("Gentainer::recombine", recombine);
+
+	MutateOp mutate (pop);
+	runner.measure ("Gentainer::pointMutate", mutate);
+
+	CopyOp copy (pop);
+	runner.measure ("Gentainer::copy", copy);
+
+	IndividualOp individual (pop[0]);
+	runner.measure ("Individual::Individual", individual);
+
+	BuildOp build (pop[0], size);
+	runner.measure ("Population::build", build);
+
+	{
+		SelectionSituation situation (pop);
+		const char* samplerNames [] = {"ranks", "alias", "scan"};
+		const int samplers [] = {SelectionMatrix::RANKS, SelectionMatrix::ALIAS, SelectionMatrix::SCAN};
+		for (int s=0; s<3; s++) {
+			SelectionMatrixOp construct (situation, samplers[s]);
+			runner.measure (format ("SelectionMatrix::SelectionMatrix.%s", samplerNames[s]), construct);
+
+			SelectionMatrix matrix (situation, samplers[s]);
+			SampleOp sample (matrix);
+			runner.measure (format ("SelectionMatrix::selectRandomPair.%s", samplerNames[s]), sample);
+		}
+	}
+
+	EvolveOp evolve (pop);
+	runner.measure ("SimplePopulation::evolve", evolve);
+}
+
+void benchmarkPoint (Runner& runner, const String& envName, int genes, int size, const StringMap& baseParams)
+{
+	StringMap params;
+	params += baseParams;
+	params.set ("SimplePopulation.size", String (size));
+	params.set ("EAStrategy.silent", "1");
+
+	EAEnvironment* env;
+	if (envName == "binary")
+		env = new BinaryTestEAEnv (genes);
+	else {
+		FloatTestEAEnv* fenv = new FloatTestEAEnv (params, genes, FloatTestEAEnv::Sphere);
+		fenv->setGeneType ((envName=="bitfloat")? FloatTestEAEnv::BITFLOAT : FloatTestEAEnv::ESFLOAT);
+		env = fenv;
+	}
+
+	benchmarkPopulation (runner, *env, envName, genes, size, params);
+	delete env;
+}
+
+/*******************************************************************************
+ *
+ ******************************************************************************/
+Main ()
+{
+	assertmode = ASSERT_CRASH;
+	sout << "NeHeP benchmark\n";
+
+	// Load config file if available
+	String configs;
+	loadString (configs, "benchmark.cfg");
+
+	StringMap params;
+	splitpairs (params, configs, '=', '\n');
+
+	// Then add the command-line parameters on top of those
+	params += mParamMap;
+	sout << toString(params) << "\n";
+
+	///////////////////////////////////////////////////////////////////////////////
+
+	PackArray<int> genes, sizes;
+	parseList (getOrDefault (params, "Benchmark.genes", "10,100,1000"), genes);
+	parseList (getOrDefault (params, "Benchmark.sizes", "20,100,500"), sizes);
+
+	String envList = getOrDefault (params, "Benchmark.envs", "float,bitfloat,binary");
+	Array<String> envs;
+	for (const char* p = (CONSTR) envList; *p; ) {
+		const char* end = p;
+		while (*end && *end != ',')
+			end++;
+		String env = String (p).mid (0, end-p);
+		ASSERTWITH (env=="float" || env=="bitfloat" || env=="binary",
+					format ("Unknown Benchmark.envs entry '%s'", (CONSTR) env));
+		envs.add (new String (env));
+		p = *end? end+1 : end;
+	}
+
+	checkKernels (params);
+	checkPool (params);
+
+	double minTime = getOrDefault (params, "Benchmark.minTime", String(200)).toInt () / 1000.0;
+	TextOStream out;
+	out.setDevice (new File (getOrDefault (params, "Benchmark.output", "benchmark.tsv"), IO_Writable));
+	Runner runner (out, minTime);
+
+	for (int e=0; e<envs.size(); e++)
+		for (int g=0; g<genes.size(); g++)
+			for (int s=0; s<sizes.size(); s++) {
+				// The operators need at least two individuals
+				ASSERTWITH (sizes[s] >= 2, "Benchmark.sizes must be at least 2");
+				benchmarkPoint (runner, envs[e], genes[g], sizes[s], params);
+				if (envs[e] == "float")
+					benchmarkKernels (runner, genes[g], sizes[s], params);
+			}
+}
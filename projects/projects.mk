@@ -38,7 +38,7 @@ include $(SRCDIR)/build/magicdef.mk
 ################################################################################
 # Recursively call sub-makes for modules
 ################################################################################
-makemodules = autoadapt prisoners
+makemodules = autoadapt benchmark metapopulation prisoners
 
 ################################################################################
 # Include build rules
@@ -0,0 +1,116 @@
+/***************************************************************************
+ *   This file is part of the NeHeP library.                               *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <magic/mmath.h>
+#include "nhp/aliastable.h"
+#include "nhp/random.h"
+
+/*******************************************************************************
+ * Builds the table with the method of Vose.
+ *
+ * The weights are scaled so that their average is 1. Each column of the
+ * table is then filled with one "small" outcome (weight below 1) and the
+ * missing part is taken from a "large" outcome, whose weight is reduced
+ * accordingly. Rounding errors may leave some outcomes unpaired at the
+ * end; their columns are full.
+ ******************************************************************************/
+void AliasTable::make (const PackArray<double>& weights)
+{
+	int n = weights.size ();
+	ASSERTWITH (n>0, "Empty distribution for AliasTable");
+
+	mProb.make (n);
+	mAlias.make (n);
+
+	double sum = 0.0;
+	for (int i=0; i<n; i++) {
+		ASSERTWITH (weights[i] >= 0.0, "Negative weight for AliasTable");
+		sum += weights[i];
+	}
+	ASSERTWITH (sum > 0.0, "Zero total weight for AliasTable");
+
+	// The work lists of small and large outcomes share one array;
+	// small ones grow from the beginning and large ones from the end.
+	PackArray<int> work (n);
+	int smalls = 0, larges = n;
+	for (int i=0; i<n; i++) {
+		mProb[i] = weights[i]*n/sum;
+		if (mProb[i] < 1.0)
+			work[smalls++] = i;
+		else
+			work[--larges] = i;
+	}
+
+	while (smalls>0 && larges<n) {
+		int s = work[--smalls];
+		int l = work[larges];
+
+		mAlias[s] = l;
+		mProb[l] = (mProb[l] + mProb[s]) - 1.0;
+
+		if (mProb[l] < 1.0) {
+			// The large one became small; it moves to the other list
+			larges++;
+			work[smalls++] = l;
+		}
+	}
+
+	// Only rounding errors remain
+	while (larges<n) {
+		mProb[work[larges]] = 1.0;
+		mAlias[work[larges]] = work[larges];
+		larges++;
+	}
+	while (smalls>0) {
+		mProb[work[--smalls]] = 1.0;
+		mAlias[work[smalls]] = work[smalls];
+	}
+}
+
+int AliasTable::draw () const
+{
+	int    n   = mProb.size ();
+	double u   = rndUniform ()*n;
+	int    col = int (u);
+	if (col >= n)
+		col = n-1;
+
+	return (u-col < mProb[col])? col : mAlias[col];
+}
+
+double AliasTable::probability (int i) const
+{
+	double p = mProb[i];
+	for (int col=0; col<mProb.size(); col++)
+		if (mAlias[col]==i && col!=i)
+			p += 1.0 - mProb[col];
+	return p/mProb.size();
+}
+
+void AliasTable::check () const
+{
+	ASSERT (mProb.size() == mAlias.size());
+	for (int i=0; i<mProb.size(); i++)
+		ASSERT (mAlias[i]>=0 && mAlias[i]<mProb.size());
+}
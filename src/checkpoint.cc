@@ -0,0 +1,256 @@
+/***************************************************************************
+ *   This file is part of the NeHeP library.                               *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <magic/mthread.h>
+#include "nhp/checkpoint.h"
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//               C h e c k p o i n t   S t r e a m s                         //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+void CheckpointOStream::reserve (int bytes)
+{
+	int capacity = (mCapacity>0)? mCapacity : 4096;
+	while (capacity < bytes)
+		capacity *= 2;
+
+	char* data = new char [capacity];
+	if (mSize>0)
+		memcpy (data, mpData, mSize);
+	delete [] mpData;
+	mpData    = data;
+	mCapacity = capacity;
+}
+
+void CheckpointOStream::swap (CheckpointOStream& other)
+{
+	char* data     = mpData;
+	int   size     = mSize;
+	int   capacity = mCapacity;
+	mpData         = other.mpData;
+	mSize          = other.mSize;
+	mCapacity      = other.mCapacity;
+	other.mpData    = data;
+	other.mSize     = size;
+	other.mCapacity = capacity;
+}
+
+/*******************************************************************************
+ * FNV-1a over the bytes. This only detects damaged or truncated files, it
+ * is no protection against deliberate changes.
+ ******************************************************************************/
+uint64_t CheckpointOStream::checksum (const char* data, int bytes)
+{
+	uint64_t h = 0xCBF29CE484222325ULL;
+	for (int i=0; i<bytes; i++) {
+		h ^= (unsigned char) data[i];
+		h *= 0x100000001B3ULL;
+	}
+	return h;
+}
+
+void writeCheckpointFile (const String& file, const CheckpointOStream& data, bool checksum)
+{
+	String temp = file;
+	temp += ".tmp";
+
+	FILE* out = fopen (temp, "wb");
+	if (!out)
+		throw checkpoint_error (format ("Checkpoint file '%s' couldn't be opened: %s",
+										(CONSTR) temp, strerror (errno)));
+
+	bool ok = fwrite (data.data (), 1, data.size (), out) == size_t (data.size ());
+	if (checksum) {
+		uint64_t sum = data.checksum ();
+		ok = (fwrite (&sum, sizeof (sum), 1, out) == 1) && ok;
+	}
+	ok = (fflush (out) == 0) && ok;
+	ok = (fsync (fileno (out)) == 0) && ok;
+	ok = (fclose (out) == 0) && ok;
+
+	if (!ok || rename (temp, file) != 0) {
+		String error = strerror (errno);
+		remove (temp);
+		throw checkpoint_error (format ("Checkpoint file '%s' couldn't be written: %s",
+										(CONSTR) file, (CONSTR) error));
+	}
+}
+
+void readCheckpointFile (const String& file, CheckpointOStream& data)
+{
+	FILE* in = fopen (file, "rb");
+	if (!in)
+		throw checkpoint_error (format ("Checkpoint file '%s' couldn't be opened: %s",
+										(CONSTR) file, strerror (errno)));
+
+	data.clear ();
+	char block [65536];
+	size_t n;
+	while ((n = fread (block, 1, sizeof (block), in)) > 0)
+		data.put (block, int (n));
+	bool ok = !ferror (in);
+	fclose (in);
+	if (!ok)
+		throw checkpoint_error (format ("Checkpoint file '%s' couldn't be read", (CONSTR) file));
+
+	// The checksum is in the last word
+	uint64_t checksum;
+	int size = data.size () - int (sizeof (checksum));
+	if (size < 0)
+		throw checkpoint_error (format ("Checkpoint file '%s' is truncated", (CONSTR) file));
+	memcpy (&checksum, data.data ()+size, sizeof (checksum));
+	if (checksum != CheckpointOStream::checksum (data.data (), size))
+		throw checkpoint_error (format ("Checkpoint file '%s' is damaged", (CONSTR) file));
+	data.truncate (size);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//               C h e c k p o i n t   W r i t e r                           //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/*******************************************************************************
+ * Thread of a CheckpointWriter. Just runs the writer loop.
+ ******************************************************************************/
+class CheckpointThread : public Thread {
+	CheckpointWriter*	rpWriter;
+  public:
+					CheckpointThread	(CheckpointWriter& writer) : rpWriter (&writer) {}
+	virtual void*	execute				() {rpWriter->writerLoop (); return NULL;}
+};
+
+CheckpointWriter::CheckpointWriter (bool checksums)
+{
+	mHasPending = false;
+	mWriting    = false;
+	mQuit       = false;
+	mChecksums  = checksums;
+	mWritten    = 0;
+	mDropped    = 0;
+
+	pthread_mutex_init (&mMutex, NULL);
+	pthread_cond_init (&mWakeup, NULL);
+	pthread_cond_init (&mDone, NULL);
+
+	mpThread = new CheckpointThread (*this);
+	mpThread->start ();
+}
+
+CheckpointWriter::~CheckpointWriter ()
+{
+	pthread_mutex_lock (&mMutex);
+	mQuit = true;
+	pthread_cond_broadcast (&mWakeup);
+	pthread_mutex_unlock (&mMutex);
+
+	mpThread->join ();
+	delete mpThread;
+
+	pthread_cond_destroy (&mDone);
+	pthread_cond_destroy (&mWakeup);
+	pthread_mutex_destroy (&mMutex);
+}
+
+void CheckpointWriter::submit (const String& file, CheckpointOStream& data)
+{
+	pthread_mutex_lock (&mMutex);
+	checkError ();
+
+	if (mHasPending)
+		mDropped++;
+	mPending.swap (data);
+	mPendingFile = file;
+	mHasPending  = true;
+
+	pthread_cond_signal (&mWakeup);
+	pthread_mutex_unlock (&mMutex);
+}
+
+void CheckpointWriter::flush ()
+{
+	pthread_mutex_lock (&mMutex);
+	while (mHasPending || mWriting)
+		pthread_cond_wait (&mDone, &mMutex);
+	checkError ();
+	pthread_mutex_unlock (&mMutex);
+}
+
+void CheckpointWriter::checkError ()
+{
+	if (isempty (mError))
+		return;
+
+	String error = mError;
+	mError = "";
+	pthread_mutex_unlock (&mMutex);
+	throw checkpoint_error (error);
+}
+
+/*******************************************************************************
+ * Writes the pending checkpoints until told to quit. The pending checkpoint
+ * is taken to a buffer of the thread, so that a new one can be submitted
+ * while the previous is being written.
+ ******************************************************************************/
+void CheckpointWriter::writerLoop ()
+{
+	CheckpointOStream data;
+	String            file;
+
+	pthread_mutex_lock (&mMutex);
+	while (true) {
+		while (!mQuit && !mHasPending)
+			pthread_cond_wait (&mWakeup, &mMutex);
+		if (!mHasPending)
+			break;
+
+		data.swap (mPending);
+		file        = mPendingFile;
+		mHasPending = false;
+		mWriting    = true;
+		pthread_mutex_unlock (&mMutex);
+
+		String error;
+		try {
+			writeCheckpointFile (file, data, mChecksums);
+		} catch (exception& e) {
+			error = e.what ();
+		}
+
+		pthread_mutex_lock (&mMutex);
+		mWriting = false;
+		if (isempty (error))
+			mWritten++;
+		else
+			mError = error;
+		pthread_cond_broadcast (&mDone);
+	}
+	pthread_mutex_unlock (&mMutex);
+}
+
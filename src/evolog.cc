@@ -0,0 +1,447 @@
+/***************************************************************************
+ *   This file is part of the NeHeP library.                               *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <magic/mexception.h>
+#include <magic/mthread.h>
+#include "nhp/evolog.h"
+
+/*******************************************************************************
+ * A record consists of its kind and the size of its data, both int32, and
+ * the data. The data of a report is the generation and the number of
+ * values (int32) and the values (double).
+ *
+ * The ring buffer and the binary log file contain the same records; the
+ * file begins with the magic below.
+ ******************************************************************************/
+enum logrecords {REPORT_RECORD=1, TEXT_RECORD};
+
+static const char	logMagic[8]		= {'N','H','P','E','L','O','G',1};
+static const int	maxReportValues	= 12;
+
+/*******************************************************************************
+ * Formats a report record in the columns of the text log. Returns the
+ * number of characters written.
+ ******************************************************************************/
+static int printReport (FILE* out, const char* data, int bytes)
+{
+	int32_t generation, n;
+	double  v [maxReportValues];
+	memcpy (&generation, data, sizeof (generation));
+	memcpy (&n, data+sizeof (generation), sizeof (n));
+	if (n<3 || n>maxReportValues || bytes != int (2*sizeof (int32_t) + n*sizeof (double)))
+		throw exception ("Evolution log record is damaged");
+	memcpy (v, data+2*sizeof (int32_t), n*sizeof (double));
+
+	int written = fprintf (out, "%d %.30f %.30f %.30f ", int (generation), v[0], v[1], v[2]);
+	if (n == maxReportValues)
+		written += fprintf (out, "%f %f %f %f %f %f %f %.30f %f",
+							v[3], v[4], v[5], v[6], v[7], v[8], v[9], v[10], v[11]);
+	return written;
+}
+
+/*******************************************************************************
+ * Thread of an EvolutionLogger. Just runs the writer loop.
+ ******************************************************************************/
+class LoggerThread : public Thread {
+	EvolutionLogger*	rpLogger;
+  public:
+					LoggerThread	(EvolutionLogger& logger) : rpLogger (&logger) {}
+	virtual void*	execute			() {rpLogger->writerLoop (); return NULL;}
+};
+
+/*******************************************************************************
+ * Write function of the text stream, see fopencookie(3).
+ ******************************************************************************/
+static ssize_t writeTextStream (void* cookie, const char* data, size_t bytes)
+{
+	static_cast<EvolutionLogger*> (cookie)->text (data, int (bytes));
+	return bytes;
+}
+
+EvolutionLogger::EvolutionLogger (const StringMap& params)
+{
+	String logFormat = getOrDefault (params, "EvolutionLog.format", "text");
+	ASSERTWITH (logFormat=="text" || logFormat=="binary",
+				format ("Unknown EvolutionLog.format '%s'", (CONSTR) logFormat));
+	mFormat = (logFormat=="binary")? BINARY : TEXT;
+
+	String policy = getOrDefault (params, "EvolutionLog.flush", "time");
+	ASSERTWITH (policy=="generations" || policy=="time" || policy=="exit",
+				format ("Unknown EvolutionLog.flush '%s'", (CONSTR) policy));
+	mPolicy = (policy=="generations")? GENERATIONS : (policy=="time")? TIME : EXIT;
+
+	mGenerations = getOrDefault (params, "EvolutionLog.generations", String(10)).toInt ();
+	mInterval    = getOrDefault (params, "EvolutionLog.interval", String(1000)).toInt ();
+	int size     = getOrDefault (params, "EvolutionLog.bufferSize", String(1048576)).toInt ();
+	ASSERTWITH (mGenerations>0, "EvolutionLog.generations must be positive");
+	ASSERTWITH (mInterval>0, "EvolutionLog.interval must be positive");
+	ASSERTWITH (size>=1024 && size<=(1<<30), "EvolutionLog.bufferSize must be 1k-1G");
+
+	int capacity = 1;
+	while (capacity < size)
+		capacity *= 2;
+	mpRing   = new char [capacity];
+	mpRecord = new char [capacity];
+	mMask    = capacity-1;
+
+	mpOut      = NULL;
+	mpText     = NULL;
+	mpThread   = NULL;
+	mHead      = 0;
+	mTail      = 0;
+	mDrained   = 0;
+	mWritten   = 0;
+	mGeneration = 0;
+	mWakeup    = false;
+	mQuit      = false;
+
+	pthread_mutex_init (&mMutex, NULL);
+	pthread_cond_init (&mWork, NULL);
+	pthread_cond_init (&mDone, NULL);
+}
+
+EvolutionLogger::~EvolutionLogger ()
+{
+	try {
+		close ();
+	} catch (...) {
+		// Nowhere to report it any more
+	}
+
+	pthread_cond_destroy (&mDone);
+	pthread_cond_destroy (&mWork);
+	pthread_mutex_destroy (&mMutex);
+	delete [] mpRecord;
+	delete [] mpRing;
+}
+
+void EvolutionLogger::open (const String& file)
+{
+	close ();
+
+	mpOut = fopen (file, "w");
+	if (!mpOut)
+		throw exception (format ("Log file '%s' couldn't be opened", (CONSTR) file));
+	if (mFormat == BINARY)
+		fwrite (logMagic, 1, sizeof (logMagic), mpOut);
+
+	// Collect the small writes of the text stream before passing them on
+	cookie_io_functions_t functions = {NULL, writeTextStream, NULL, NULL};
+	mpText = fopencookie (this, "w", functions);
+	ASSERT (mpText);
+	setvbuf (mpText, NULL, _IOFBF, 65536);
+
+	mHead       = 0;
+	mTail       = 0;
+	mDrained    = 0;
+	mWritten    = 0;
+	mGeneration = 0;
+	mWakeup     = false;
+	mQuit       = false;
+	mError      = "";
+
+	mpThread = new LoggerThread (*this);
+	mpThread->start ();
+}
+
+void EvolutionLogger::close ()
+{
+	if (!mpThread)
+		return;
+
+	// Pass the rest of the text to the buffer before the thread writes
+	// the last records
+	fclose (mpText);
+	mpText = NULL;
+
+	pthread_mutex_lock (&mMutex);
+	mQuit = true;
+	pthread_cond_signal (&mWork);
+	pthread_mutex_unlock (&mMutex);
+
+	mpThread->join ();
+	delete mpThread;
+	mpThread = NULL;
+
+	String error = mError;
+	if (fclose (mpOut) != 0 && isempty (error))
+		error = strerror (errno);
+	mpOut = NULL;
+
+	if (!isempty (error))
+		throw exception (format ("Evolution log couldn't be written: %s", (CONSTR) error));
+}
+
+/*******************************************************************************
+ * Long texts are split into several records, so that a record always fits
+ * in the buffer.
+ ******************************************************************************/
+void EvolutionLogger::text (const char* data, int bytes)
+{
+	ASSERTWITH (mpThread, "Evolution log is not open");
+
+	int chunk = (mMask+1)/4;
+	for (int i=0; i<bytes; i+=chunk)
+		put (TEXT_RECORD, data+i, (bytes-i < chunk)? bytes-i : chunk);
+}
+
+void EvolutionLogger::report (int generation, const double* values, int n)
+{
+	ASSERTWITH (mpThread, "Evolution log is not open");
+	ASSERTWITH (n==3 || n==maxReportValues, format ("Invalid number of report values %d", n));
+
+	// Keep the text written before the report in its place
+	fflush (mpText);
+
+	char    data [2*sizeof (int32_t) + maxReportValues*sizeof (double)];
+	int32_t header[2] = {generation, n};
+	memcpy (data, header, sizeof (header));
+	memcpy (data+sizeof (header), values, n*sizeof (double));
+	put (REPORT_RECORD, data, sizeof (header) + n*sizeof (double));
+}
+
+void EvolutionLogger::endGeneration ()
+{
+	if (mPolicy == GENERATIONS && ++mGeneration >= mGenerations) {
+		mGeneration = 0;
+		fflush (mpText);
+		wake ();
+	}
+}
+
+/*******************************************************************************
+ * Waits until the logger thread has written everything that was put in the
+ * buffer before the call.
+ ******************************************************************************/
+void EvolutionLogger::flush ()
+{
+	if (!mpThread)
+		return;
+
+	fflush (mpText);
+	unsigned int target = mHead;
+
+	pthread_mutex_lock (&mMutex);
+	mWakeup = true;
+	pthread_cond_signal (&mWork);
+	while (int (target - mDrained) > 0 && isempty (mError))
+		pthread_cond_wait (&mDone, &mMutex);
+	checkError ();
+}
+
+void EvolutionLogger::checkError ()
+{
+	String error = mError;
+	pthread_mutex_unlock (&mMutex);
+	if (!isempty (error))
+		throw exception (format ("Evolution log couldn't be written: %s", (CONSTR) error));
+}
+
+/*******************************************************************************
+ * Only the thread owning the population puts records and only the logger
+ * thread takes them, so the buffer needs no lock. The head is advanced only
+ * after the record has been copied, and the tail only after the record has
+ * been written.
+ ******************************************************************************/
+void EvolutionLogger::put (int kind, const void* data, int bytes)
+{
+	int32_t header[2] = {kind, bytes};
+	unsigned int size = sizeof (header) + bytes;
+
+	// If the buffer is full, wait for the logger thread to make room
+	while (mMask+1 - (mHead-mTail) < size) {
+		wake ();
+		sched_yield ();
+	}
+
+	unsigned int head = mHead;
+	poke (head, header, sizeof (header));
+	poke (head+sizeof (header), data, bytes);
+	__sync_synchronize ();
+	mHead = head+size;
+
+	if (mHead-mTail > (mMask+1)/2)
+		wake ();
+}
+
+void EvolutionLogger::poke (unsigned int position, const void* data, int bytes)
+{
+	unsigned int begin = position & mMask;
+	unsigned int first = (bytes < int (mMask+1-begin))? bytes : mMask+1-begin;
+	memcpy (mpRing+begin, data, first);
+	memcpy (mpRing, (const char*) data+first, bytes-first);
+}
+
+void EvolutionLogger::peek (unsigned int position, void* data, int bytes) const
+{
+	unsigned int begin = position & mMask;
+	unsigned int first = (bytes < int (mMask+1-begin))? bytes : mMask+1-begin;
+	memcpy (data, mpRing+begin, first);
+	memcpy ((char*) data+first, mpRing, bytes-first);
+}
+
+void EvolutionLogger::wake ()
+{
+	// Avoid taking the lock when the thread is already woken up
+	if (mWakeup)
+		return;
+
+	pthread_mutex_lock (&mMutex);
+	mWakeup = true;
+	pthread_cond_signal (&mWork);
+	pthread_mutex_unlock (&mMutex);
+}
+
+void EvolutionLogger::writerLoop ()
+{
+	pthread_mutex_lock (&mMutex);
+	while (true) {
+		if (!mWakeup && !mQuit) {
+			if (mPolicy == TIME) {
+				struct timespec deadline;
+				clock_gettime (CLOCK_REALTIME, &deadline);
+				deadline.tv_sec  += mInterval/1000;
+				deadline.tv_nsec += (mInterval%1000)*1000000L;
+				if (deadline.tv_nsec >= 1000000000L) {
+					deadline.tv_sec++;
+					deadline.tv_nsec -= 1000000000L;
+				}
+				pthread_cond_timedwait (&mWork, &mMutex, &deadline);
+			} else
+				pthread_cond_wait (&mWork, &mMutex);
+		}
+		bool quit = mQuit;
+		mWakeup = false;
+		pthread_mutex_unlock (&mMutex);
+
+		String error;
+		try {
+			drain ();
+		} catch (exception& e) {
+			error = e.what();
+		}
+
+		pthread_mutex_lock (&mMutex);
+		if (!isempty (error) && isempty (mError))
+			mError = error;
+		mDrained = mTail;
+		pthread_cond_broadcast (&mDone);
+		if (quit)
+			break;
+	}
+	pthread_mutex_unlock (&mMutex);
+}
+
+/*******************************************************************************
+ * The records are taken even if writing them fails, so that the population
+ * never waits for a broken file; the error is reported by flush() or
+ * close().
+ ******************************************************************************/
+void EvolutionLogger::drain ()
+{
+	unsigned int head = mHead;
+	__sync_synchronize ();
+
+	bool ok = true;
+	while (mTail != head) {
+		int32_t header[2];
+		peek (mTail, header, sizeof (header));
+		peek (mTail+sizeof (header), mpRecord, header[1]);
+
+		if (mFormat == BINARY) {
+			ok = fwrite (header, sizeof (header), 1, mpOut) == 1 && ok;
+			ok = fwrite (mpRecord, 1, header[1], mpOut) == size_t (header[1]) && ok;
+			mWritten += sizeof (header) + header[1];
+		} else if (header[0] == TEXT_RECORD) {
+			ok = fwrite (mpRecord, 1, header[1], mpOut) == size_t (header[1]) && ok;
+			mWritten += header[1];
+		} else
+			mWritten += printReport (mpOut, mpRecord, header[1]);
+
+		__sync_synchronize ();
+		mTail += sizeof (header) + header[1];
+	}
+
+	ok = fflush (mpOut) == 0 && !ferror (mpOut) && ok;
+	if (!ok)
+		throw exception (strerror (errno));
+}
+
+void EvolutionLogger::convert (const String& binaryFile, const String& textFile)
+{
+	FILE* in = fopen (binaryFile, "rb");
+	if (!in)
+		throw exception (format ("Log file '%s' couldn't be opened", (CONSTR) binaryFile));
+
+	char magic [sizeof (logMagic)];
+	if (fread (magic, 1, sizeof (magic), in) != sizeof (magic) || memcmp (magic, logMagic, sizeof (magic))) {
+		fclose (in);
+		throw exception (format ("'%s' is not a binary evolution log", (CONSTR) binaryFile));
+	}
+
+	FILE* out = fopen (textFile, "w");
+	if (!out) {
+		fclose (in);
+		throw exception (format ("Log file '%s' couldn't be opened", (CONSTR) textFile));
+	}
+
+	String  error;
+	char*   data     = NULL;
+	int32_t capacity = 0;
+	int32_t header[2];
+	try {
+		while (fread (header, sizeof (header), 1, in) == 1) {
+			if (header[1] < 0 || (header[0] != TEXT_RECORD && header[0] != REPORT_RECORD))
+				throw exception (format ("Log file '%s' is damaged", (CONSTR) binaryFile));
+			if (header[1] > capacity) {
+				delete [] data;
+				capacity = header[1];
+				data = new char [capacity];
+			}
+			if (fread (data, 1, header[1], in) != size_t (header[1]))
+				throw exception (format ("Log file '%s' is truncated", (CONSTR) binaryFile));
+
+			if (header[0] == TEXT_RECORD)
+				fwrite (data, 1, header[1], out);
+			else
+				printReport (out, data, header[1]);
+		}
+		if (ferror (in))
+			throw exception (format ("Log file '%s' couldn't be read", (CONSTR) binaryFile));
+	} catch (exception& e) {
+		error = e.what();
+	}
+
+	delete [] data;
+	fclose (in);
+	if (fclose (out) != 0 && isempty (error))
+		error = format ("Log file '%s' couldn't be written", (CONSTR) textFile);
+	if (!isempty (error))
+		throw exception (error);
+}
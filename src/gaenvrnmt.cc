@@ -30,11 +30,177 @@
 #include "nhp/genetics.h"
 #include "nhp/individual.h"
 #include "nhp/gaenvrnmt.h"
+#include "nhp/random.h"
+#include "nhp/profiler.h"
 
 impl_abstract (EAEnvironment, {Object});
 
 
 
+/*******************************************************************************
+* EvaluationRecord
+*******************************************************************************/
+
+void EvaluationRecord::reset ()
+{
+	bestfitn	= 1E+30;
+	bestFitness	= 1E+30;
+	pBest		= NULL;
+	bestItem	= -1;
+	evals		= 0;
+	mItem		= 0;
+}
+
+void EvaluationRecord::add (const EvaluationRecord& other)
+{
+	if (other.bestfitn < bestfitn)
+		bestfitn = other.bestfitn;
+
+	if (other.pBest && (!pBest || other.bestFitness < bestFitness ||
+						(other.bestFitness == bestFitness && other.bestItem < bestItem))) {
+		bestFitness	= other.bestFitness;
+		pBest		= other.pBest;
+		bestItem	= other.bestItem;
+	}
+
+	evals += other.evals;
+}
+
+
+
+/*******************************************************************************
+* FitnessCache
+*
+* The entries are kept in arrays. Each entry is linked both to the hash chain
+* of its bucket and to a doubly linked list in the order of use.
+*******************************************************************************/
+
+FitnessCache::FitnessCache (int capacity)
+{
+	ASSERT (capacity>0);
+	mCapacity = capacity;
+
+	int buckets = 1;
+	while (buckets < 2*capacity)
+		buckets <<= 1;
+
+	mKeyLow.make (capacity);
+	mKeyHigh.make (capacity);
+	mFitness.make (capacity);
+	mChain.make (capacity);
+	mPrev.make (capacity);
+	mNext.make (capacity);
+	mBuckets.make (buckets);
+	mHits = mMisses = 0;
+
+	pthread_mutex_init (&mLock, NULL);
+	clear ();
+}
+
+FitnessCache::~FitnessCache ()
+{
+	pthread_mutex_destroy (&mLock);
+}
+
+void FitnessCache::clear ()
+{
+	for (int i=0; i<mBuckets.size(); i++)
+		mBuckets[i] = -1;
+	mUsed = 0;
+	mHead = mTail = -1;
+}
+
+int FitnessCache::bucketOf (uint64_t low, uint64_t high) const
+{
+	uint64_t h = low ^ (high>>29);
+	h ^= h>>33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h>>33;
+	return int (h & uint64_t (mBuckets.size()-1));
+}
+
+int FitnessCache::find (const GenomeHash& key, int bucket) const
+{
+	for (int e=mBuckets[bucket]; e>=0; e=mChain[e])
+		if (mKeyLow[e]==key.low() && mKeyHigh[e]==key.high())
+			return e;
+	return -1;
+}
+
+void FitnessCache::unlink (int e)
+{
+	if (mPrev[e]>=0)
+		mNext[mPrev[e]] = mNext[e];
+	else
+		mHead = mNext[e];
+	if (mNext[e]>=0)
+		mPrev[mNext[e]] = mPrev[e];
+	else
+		mTail = mPrev[e];
+}
+
+void FitnessCache::pushFront (int e)
+{
+	mPrev[e] = -1;
+	mNext[e] = mHead;
+	if (mHead>=0)
+		mPrev[mHead] = e;
+	mHead = e;
+	if (mTail<0)
+		mTail = e;
+}
+
+bool FitnessCache::lookup (const GenomeHash& key, double& fitness)
+{
+	pthread_mutex_lock (&mLock);
+	int e = find (key, bucketOf (key.low(), key.high()));
+	if (e>=0) {
+		fitness = mFitness[e];
+		if (e != mHead) {
+			unlink (e);
+			pushFront (e);
+		}
+		mHits++;
+	} else
+		mMisses++;
+	pthread_mutex_unlock (&mLock);
+	return e>=0;
+}
+
+void FitnessCache::store (const GenomeHash& key, double fitness)
+{
+	pthread_mutex_lock (&mLock);
+	int bucket = bucketOf (key.low(), key.high());
+	int e = find (key, bucket);
+
+	if (e>=0)
+		unlink (e);
+	else {
+		if (mUsed < mCapacity)
+			e = mUsed++;
+		else {
+			// Replace the least recently used entry
+			e = mTail;
+			unlink (e);
+			int* link = &mBuckets[bucketOf (mKeyLow[e], mKeyHigh[e])];
+			while (*link != e)
+				link = &mChain[*link];
+			*link = mChain[e];
+		}
+
+		mKeyLow[e]	= key.low();
+		mKeyHigh[e]	= key.high();
+		mChain[e]	= mBuckets[bucket];
+		mBuckets[bucket] = e;
+	}
+
+	mFitness[e] = fitness;
+	pushFront (e);
+	pthread_mutex_unlock (&mLock);
+}
+
+
+
 //////////////////////////////////////////////////////////////////////////////
 //                                                                          //
 //    ----   _   -----             o                                        //
@@ -54,13 +220,81 @@ EAEnvironment::EAEnvironment ()
 	mTotEvals		= 0;
 	mpBest			= NULL;
 	mCycles			= 0;
+	mpFitnessCache	= NULL;
+}
+
+EAEnvironment::~EAEnvironment ()
+{
+	delete mpFitnessCache;
+}
+
+void EAEnvironment::setFitnessCache (int size)
+{
+	delete mpFitnessCache;
+	mpFitnessCache = (size>0)? new FitnessCache (size) : (FitnessCache*) NULL;
+}
+
+void EAEnvironment::cycleReport (OStream& log, OStream& out)
+{
+	mCycles++;
+
+	if (mpFitnessCache)
+		out << format ("Fitness cache: %d hits, %d misses, %d/%d entries\n",
+					   mpFitnessCache->hits(), mpFitnessCache->misses(),
+					   mpFitnessCache->size(), mpFitnessCache->capacity());
+
+	cycle_report (log, out);
+}
+
+void EAEnvironment::saveState (CheckpointOStream& out) const
+{
+	out.putInt (mTotEvals);
+	out.putInt (mCycles);
+	out.putDouble (bestfitn);
+}
+
+void EAEnvironment::loadState (CheckpointIStream& in)
+{
+	mTotEvals = in.getInt ();
+	mCycles   = in.getInt ();
+	bestfitn  = in.getDouble ();
+}
+
+/*******************************************************************************
+* Measures the fitness of an individual with evaluateg(), or takes it from
+* the fitness cache if the same genotype has been evaluated recently.
+*
+* The cache is used only when the evaluation is deterministic: no artificial
+* noise is added and each individual is evaluated once.
+*******************************************************************************/
+double EAEnvironment::measure (const Individual& ind, bool& evaluated)
+{
+	evaluated = true;
+	if (!mpFitnessCache || mNoise > 0.0 || mNEvals > 1)
+		return evaluateg (ind);
+
+	GenomeHash key;
+	ind.hash (key);
+	if (!key.isValid ())
+		return evaluateg (ind);
+
+	double fitness;
+	if (mpFitnessCache->lookup (key, fitness)) {
+		evaluated = false;
+		return fitness;
+	}
+
+	fitness = evaluateg (ind);
+	mpFitnessCache->store (key, fitness);
+	return fitness;
 }
 
 /*******************************************************************************
 * Evaluates fitness of an individual.
 *
 * If artificial noise is defined for the environment, applies it to the
-* fitness.
+* fitness. Fitness taken from the fitness cache is not counted as an
+* evaluation.
 *
 * Keeps record of the best measured fitness and stores the individual
 * having the fitness until a better one is found.
@@ -70,7 +304,9 @@ EAEnvironment::EAEnvironment ()
 double EAEnvironment::evaluate (const Individual& ind)
 {
 	// Evaluate the fitness
-	double fitness = evaluateg (ind);
+	bool evaluated;
+	double fitness = measure (ind, evaluated);
+	NHP_PROFILE_COUNT (evaluated? Profiler::EVALUATIONS : Profiler::CACHE_HITS, 1);
 
 	// Record the best _objective_ fitness. Note that this is done
 	// before adding the artificial noise, so this is really the true
@@ -81,7 +317,7 @@ double EAEnvironment::evaluate (const Individual& ind)
 	// Add some artificial noise. The if statement is here because we don't
 	// want to compate to 0.0.
 	if (mNoise > 0.0001)
-		fitness += gaussrnd (mNoise);
+		fitness += rndGauss (mNoise);
 
 	// Record the best _subjective_ fitness
 	if (fitness < mBestFitness) {
@@ -89,11 +325,131 @@ double EAEnvironment::evaluate (const Individual& ind)
 		mpBest       = const_cast <Individual*> (&ind);
 	}
 
-	mTotEvals++;
+	if (evaluated)
+		mTotEvals++;
 
 	return fitness;
 }
 
+/*******************************************************************************
+* Evaluates fitness of an individual without touching the state of the
+* environment.
+*
+* Like the other evaluate(), but the best fitness, the best individual
+* and the number of evaluations are recorded in the given record.
+*
+* @return Measured fitness.
+*******************************************************************************/
+double EAEnvironment::evaluate (const Individual& ind, EvaluationRecord& record)
+{
+	bool evaluated;
+	double fitness = measure (ind, evaluated);
+	NHP_PROFILE_COUNT (evaluated? Profiler::EVALUATIONS : Profiler::CACHE_HITS, 1);
+
+	return evaluate (ind, fitness, evaluated, record);
+}
+
+/*******************************************************************************
+* Evaluates a block of individuals with evaluateBatch(), except the ones
+* whose fitness is in the fitness cache.
+*******************************************************************************/
+void EAEnvironment::measureBatch (const Individual* const* inds, int n, double* fitness, bool* evaluated)
+{
+	// Without the cache, the whole block is evaluated as such
+	if (!mpFitnessCache || mNoise > 0.0 || mNEvals > 1) {
+		evaluateBatch (inds, n, fitness);
+		for (int i=0; i<n; i++)
+			evaluated[i] = true;
+		NHP_PROFILE_COUNT (Profiler::EVALUATIONS, n);
+		return;
+	}
+
+	// Collect the individuals that are not in the cache
+	PackArray<const Individual*> misses (n);
+	PackArray<int> missIndex (n);
+	PackArray<GenomeHash> keys (n);
+	int nMisses = 0;
+	for (int i=0; i<n; i++) {
+		inds[i]->hash (keys[i]);
+		evaluated[i] = !keys[i].isValid () || !mpFitnessCache->lookup (keys[i], fitness[i]);
+		if (evaluated[i]) {
+			misses[nMisses] = inds[i];
+			missIndex[nMisses++] = i;
+		}
+	}
+	NHP_PROFILE_COUNT (Profiler::EVALUATIONS, nMisses);
+	NHP_PROFILE_COUNT (Profiler::CACHE_HITS, n-nMisses);
+	if (nMisses == 0)
+		return;
+
+	PackArray<double> measured (nMisses);
+	evaluateBatch (misses.getData (), nMisses, measured.getData ());
+	for (int m=0; m<nMisses; m++) {
+		int i = missIndex[m];
+		fitness[i] = measured[m];
+		if (keys[i].isValid ())
+			mpFitnessCache->store (keys[i], fitness[i]);
+	}
+}
+
+void EAEnvironment::evaluateBatch (const Individual* const* inds, int n, double* fitness)
+{
+	for (int i=0; i<n; i++)
+		fitness[i] = evaluateg (*inds[i]);
+}
+
+/*******************************************************************************
+* Records a fitness measured with measureBatch(), like evaluate() does with
+* the fitness it measures.
+*
+* @return Measured fitness with the artificial noise.
+*******************************************************************************/
+double EAEnvironment::evaluate (const Individual& ind, double fitness, bool evaluated,
+								EvaluationRecord& record)
+{
+	// Objective fitness
+	if (fitness < record.bestfitn)
+		record.bestfitn = fitness;
+
+	if (mNoise > 0.0001)
+		fitness += rndGauss (mNoise);
+
+	// Subjective fitness. Ties are resolved by the item number, so
+	// that the result is the same as with serial evaluation.
+	if (fitness < record.bestFitness ||
+		(fitness == record.bestFitness && record.mItem < record.bestItem)) {
+		record.bestFitness = fitness;
+		record.pBest       = const_cast <Individual*> (&ind);
+		record.bestItem    = record.mItem;
+	}
+
+	if (evaluated)
+		record.evals++;
+
+	return fitness;
+}
+
+/*******************************************************************************
+* Stores the results of concurrent evaluations to the environment, as if
+* the evaluations had been done with the serial evaluate().
+*
+* When records of several threads are merged, they should first be
+* combined with EvaluationRecord::add(), as the tie resolution by item
+* numbers only works inside a record.
+*******************************************************************************/
+void EAEnvironment::merge (const EvaluationRecord& record)
+{
+	if (record.bestfitn < bestfitn)
+		bestfitn = record.bestfitn;
+
+	if (record.pBest && record.bestFitness < mBestFitness) {
+		mBestFitness = record.bestFitness;
+		mpBest       = record.pBest;
+	}
+
+	mTotEvals += record.evals;
+}
+
 void EAEnvironment::check () const
 {
 	ASSERT (mNEvals>=1 && mNEvals<100000);
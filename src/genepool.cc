@@ -0,0 +1,228 @@
+/***************************************************************************
+ *   This file is part of the NeHeP library.                               *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <new>
+#include <pthread.h>
+#include "nhp/genepool.h"
+
+/*******************************************************************************
+ * A free block holds the link to the next free block of its size class.
+ ******************************************************************************/
+struct FreeBlock {
+	FreeBlock*	next;
+};
+
+enum {SIZE_CLASSES = GenePool::MAX_SIZE/GenePool::GRANULE};
+
+/*******************************************************************************
+ * The blocks of a thread. Only the owning thread uses its cache, so it needs
+ * no locking.
+ ******************************************************************************/
+struct ThreadCache {
+	FreeBlock*	freeLists [SIZE_CLASSES];
+	int			freeCounts [SIZE_CLASSES];
+	char*		slabPos;		// Rest of the current slab
+	char*		slabEnd;
+	bool		registered;		// Returned to the depot when the thread exits
+};
+
+static __thread ThreadCache	threadCache;
+
+/*******************************************************************************
+ * The depot holds the free blocks shared by the threads: the surplus of the
+ * threads that free more than they allocate, and everything of the threads
+ * that have exited.
+ ******************************************************************************/
+static FreeBlock* volatile	depotLists [SIZE_CLASSES];
+static pthread_mutex_t		depotLock		= PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t		cacheKey;
+static pthread_once_t		cacheKeyOnce	= PTHREAD_ONCE_INIT;
+static volatile long		slabBytes		= 0;
+
+static int blockSize (int sizeClass) {return (sizeClass+1)*GenePool::GRANULE;}
+
+/** Number of blocks a thread takes from the depot at a time; a thread keeps
+ *  at most twice as many free blocks of a size class. */
+static int batchSize (int sizeClass) {return GenePool::SLAB_SIZE/blockSize (sizeClass);}
+
+/** Moves a list of blocks to the depot. */
+static void depotPut (int sizeClass, FreeBlock* first, FreeBlock* last)
+{
+	pthread_mutex_lock (&depotLock);
+	last->next = depotLists [sizeClass];
+	depotLists [sizeClass] = first;
+	pthread_mutex_unlock (&depotLock);
+}
+
+/** Moves up to a batch of blocks from the depot to the cache. */
+static bool depotTake (ThreadCache& cache, int sizeClass)
+{
+	if (!depotLists [sizeClass])
+		return false;
+
+	pthread_mutex_lock (&depotLock);
+	FreeBlock* first = depotLists [sizeClass];
+	FreeBlock* last  = first;
+	int count = first? 1 : 0;
+	for (int limit = batchSize (sizeClass); count<limit && last->next; count++)
+		last = last->next;
+	if (first)
+		depotLists [sizeClass] = last->next;
+	pthread_mutex_unlock (&depotLock);
+
+	if (!first)
+		return false;
+	last->next = cache.freeLists [sizeClass];
+	cache.freeLists [sizeClass] = first;
+	cache.freeCounts [sizeClass] += count;
+	return true;
+}
+
+/*******************************************************************************
+ * Returns the free blocks and the rest of the slab of an exiting thread to
+ * the depot. The rest of the slab is cut to blocks of the largest size class.
+ ******************************************************************************/
+static void releaseCache (void* data)
+{
+	ThreadCache& cache = *static_cast<ThreadCache*> (data);
+
+	for (int c=0; c<SIZE_CLASSES; c++)
+		if (FreeBlock* first = cache.freeLists [c]) {
+			FreeBlock* last = first;
+			while (last->next)
+				last = last->next;
+			depotPut (c, first, last);
+			cache.freeLists [c]  = NULL;
+			cache.freeCounts [c] = 0;
+		}
+
+	while (cache.slabPos < cache.slabEnd) {
+		size_t rest = cache.slabEnd - cache.slabPos;
+		size_t size = (rest < size_t (GenePool::MAX_SIZE))? rest : size_t (GenePool::MAX_SIZE);
+		FreeBlock* block = reinterpret_cast<FreeBlock*> (cache.slabPos);
+		depotPut (size/GenePool::GRANULE - 1, block, block);
+		cache.slabPos += size;
+	}
+	cache.slabPos = cache.slabEnd = NULL;
+
+	// Register again if the thread still uses the pool after this
+	cache.registered = false;
+}
+
+static void createCacheKey ()
+{
+	pthread_key_create (&cacheKey, releaseCache);
+}
+
+static ThreadCache& registeredCache ()
+{
+	ThreadCache& cache = threadCache;
+	if (!cache.registered) {
+		pthread_once (&cacheKeyOnce, createCacheKey);
+		pthread_setspecific (cacheKey, &cache);
+		cache.registered = true;
+	}
+	return cache;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//                        G e n e P o o l                                    //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+void* GenePool::allocate (size_t size)
+{
+#ifndef NHP_NO_GENEPOOL
+	if (size > 0 && size <= MAX_SIZE) {
+		ThreadCache& cache = registeredCache ();
+		int sizeClass = (size-1)/GRANULE;
+
+		// Reuse a freed block if there is one
+		if (cache.freeLists [sizeClass] || depotTake (cache, sizeClass)) {
+			FreeBlock* block = cache.freeLists [sizeClass];
+			cache.freeLists [sizeClass] = block->next;
+			cache.freeCounts [sizeClass]--;
+			return block;
+		}
+
+		// Otherwise cut a new block from the slab. The rest of a
+		// full slab is left unused.
+		size_t bytes = blockSize (sizeClass);
+		if (size_t (cache.slabEnd-cache.slabPos) < bytes) {
+			cache.slabPos = static_cast<char*> (::operator new (SLAB_SIZE));
+			cache.slabEnd = cache.slabPos + SLAB_SIZE;
+			__sync_fetch_and_add (&slabBytes, long (SLAB_SIZE));
+		}
+		void* block = cache.slabPos;
+		cache.slabPos += bytes;
+		return block;
+	}
+#endif
+	return ::operator new (size);
+}
+
+void GenePool::release (void* p, size_t size)
+{
+	if (!p)
+		return;
+	
+#ifndef NHP_NO_GENEPOOL
+	if (size > 0 && size <= MAX_SIZE) {
+		ThreadCache& cache = registeredCache ();
+		int sizeClass = (size-1)/GRANULE;
+		FreeBlock* block = static_cast<FreeBlock*> (p);
+		block->next = cache.freeLists [sizeClass];
+		cache.freeLists [sizeClass] = block;
+
+		// A thread that frees the blocks allocated by others passes
+		// the surplus on to the depot
+		int batch = batchSize (sizeClass);
+		if (++cache.freeCounts [sizeClass] > 2*batch) {
+			FreeBlock* last = block;
+			for (int i=1; i<batch; i++)
+				last = last->next;
+			cache.freeLists [sizeClass] = last->next;
+			cache.freeCounts [sizeClass] -= batch;
+			depotPut (sizeClass, block, last);
+		}
+		return;
+	}
+#endif
+	::operator delete (p);
+}
+
+bool GenePool::enabled ()
+{
+#ifdef NHP_NO_GENEPOOL
+	return false;
+#else
+	return true;
+#endif
+}
+
+long GenePool::reserved ()
+{
+	return slabBytes;
+}
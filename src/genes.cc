@@ -31,11 +31,14 @@
 #include "nhp/individual.h"
 #include "nhp/mutrecord.h"
 #include "nhp/mutator.h"
+#include "nhp/random.h"
 
 impl_dynamic (Gene, {Genstruct});
 impl_dynamic (BinaryGene, {Gene});
+impl_dynamic (PackedBitGentainer, {Gentainer});
 impl_dynamic (AnyFloatGene, {Gene});
 impl_dynamic (FloatGene, {AnyFloatGene});
+impl_dynamic (FloatVectorGene, {Gene});
 impl_dynamic (BitFloatGene, {AnyFloatGene});
 impl_dynamic (AnyIntGene, {Gene});
 impl_dynamic (IntGene, {AnyIntGene});
@@ -44,6 +47,22 @@ impl_dynamic (InterGene, {Gene});
 
 
 
+/*******************************************************************************
+ * Converts a Gray-coded number to binary. Each binary bit is the XOR of
+ * the Gray bits at and above it, so the prefix XOR is computed with
+ * shifts that double in length.
+ ******************************************************************************/
+static inline uint64_t grayToBinary (uint64_t gray)
+{
+	gray ^= gray >> 1;
+	gray ^= gray >> 2;
+	gray ^= gray >> 4;
+	gray ^= gray >> 8;
+	gray ^= gray >> 16;
+	gray ^= gray >> 32;
+	return gray;
+}
+
 double mutateFloat (double x, double rate, int bits)
 {
 	// Encode value in bits
@@ -91,7 +110,7 @@ BinaryGene::BinaryGene (const GeneticID& id, double mut, double initP) : Gene (i
 }
 
 void BinaryGene::init () {
-	mValue = (frnd()<mInitP)? 1:0;
+	mValue = (rndUniform()<mInitP)? 1:0;
 }
 
 bool BinaryGene::pointMutate (const MutationRate& mut_rate) {
@@ -100,7 +119,7 @@ bool BinaryGene::pointMutate (const MutationRate& mut_rate) {
 	// Mutate mutability
 	if (false && mut_rate.autoAdaptation()) {
 		double p=mutability*mut_rate.binaryRate();
-		p = 1/(1+(1-p)/p*exp(-phi*gaussrnd(1)));
+		p = 1/(1+(1-p)/p*exp(-phi*rndGauss(1)));
 		if (p<0.01)
 			p = 0.01;
 		mutability = p/mut_rate.binaryRate();
@@ -110,7 +129,7 @@ bool BinaryGene::pointMutate (const MutationRate& mut_rate) {
 	//	MutabilityRecord::addBoolMutability (mutability);
 	
 	// Mutate value
-	if (frnd()>mut_rate.binaryRate()*mutability)
+	if (rndUniform()>mut_rate.binaryRate()*mutability)
 		return false;
 
 	mValue = mValue? 0:1;
@@ -137,6 +156,268 @@ DataOStream& BinaryGene::operator>> (DataOStream& out) const {
 
 
 
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//                    P a c k e d   B i t   G e n t a i n e r                //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+PackedBitGentainer::PackedBitGentainer (const GeneticID& name, int bits, double initP) : Gentainer (name) {
+	ASSERT (bits>=0);
+	ASSERT (initP>=0 && initP<=1);
+
+	mBitCount = bits;
+	mInitP    = initP;
+	mWords.make ((bits+63)/64);
+	init ();
+}
+
+PackedBitGentainer::PackedBitGentainer (const PackedBitGentainer& orig) : Gentainer (orig) {
+	mBitCount = orig.mBitCount;
+	mInitP    = orig.mInitP;
+	mWords    = orig.mWords;
+}
+
+uint64_t PackedBitGentainer::getBits (int first, int n) const {
+	ASSERT (n>=0 && n<=64 && first>=0 && first+n<=mBitCount);
+	if (n==0)
+		return 0;
+
+	int      w     = first>>6;
+	int      shift = first&63;
+	uint64_t value = mWords[w] >> shift;
+	if (shift+n > 64)
+		value |= mWords[w+1] << (64-shift);
+
+	return (n==64)? value : value & ((uint64_t(1)<<n)-1);
+}
+
+int PackedBitGentainer::hamming (const PackedBitGentainer& other) const {
+	ASSERT (mBitCount == other.mBitCount);
+
+	int diff = 0;
+	for (int w=0; w<mWords.size(); w++)
+		diff += __builtin_popcountll (mWords[w] ^ other.mWords[w]);
+	return diff;
+}
+
+void PackedBitGentainer::clearTail () {
+	if (mBitCount & 63)
+		mWords[mWords.size()-1] &= (uint64_t(1) << (mBitCount&63)) - 1;
+}
+
+void PackedBitGentainer::init () {
+	if (mInitP == 0.5) {
+		// Uniform bits, 16 at a time
+		for (int w=0; w<mWords.size(); w++)
+			mWords[w] = uint64_t(rndInt(65536))
+				| (uint64_t(rndInt(65536))<<16)
+				| (uint64_t(rndInt(65536))<<32)
+				| (uint64_t(rndInt(65536))<<48);
+		clearTail ();
+	} else
+		for (int i=0; i<mBitCount; i++)
+			set (i, rndUniform()<mInitP);
+
+	// Initialize the private genes
+	Gentainer::init ();
+}
+
+/*******************************************************************************
+ * Flips each bit independently with probability p.
+ *
+ * Instead of drawing a random number for each bit, draws the number of
+ * unchanged bits before the next flipped one from the geometric
+ * distribution. The number of random draws is then proportional to the
+ * number of flipped bits.
+ ******************************************************************************/
+bool PackedBitGentainer::mutateBits (double p) {
+	if (p <= 0.0 || mBitCount == 0)
+		return false;
+
+	if (p >= 1.0) {
+		for (int w=0; w<mWords.size(); w++)
+			mWords[w] = ~mWords[w];
+		clearTail ();
+		return true;
+	}
+
+	double logq    = log (1.0-p);
+	bool   mutated = false;
+	double pos     = floor (log (1.0-rndUniform()) / logq);
+	while (pos < mBitCount) {
+		int i = int (pos);
+		mWords[i>>6] ^= uint64_t(1) << (i&63);
+		mutated = true;
+		pos += 1.0 + floor (log (1.0-rndUniform()) / logq);
+	}
+
+	return mutated;
+}
+
+bool PackedBitGentainer::pointMutate (const MutationRate& k) {
+	// Mutate the private genes first; this also records the
+	// mutabilities just as Gentainer does
+	bool mutated = Gentainer::pointMutate (k);
+
+	if (self_adjust) {
+		MutationRate mult (*this);
+		MutationRate combined (k, mult);
+		if (mutateBits (combined.binaryRate()))
+			mutated = true;
+	} else
+		if (mutateBits (k.binaryRate()))
+			mutated = true;
+
+	return mutated;
+}
+
+void PackedBitGentainer::copyBits (const PackedBitGentainer& other, int from, int to) {
+	if (from >= to)
+		return;
+
+	int firstWord = from>>6;
+	int lastWord  = (to-1)>>6;
+	for (int w=firstWord; w<=lastWord; w++) {
+		uint64_t mask = ~uint64_t(0);
+		if (w == firstWord)
+			mask &= ~uint64_t(0) << (from&63);
+		if (w == lastWord && (to&63))
+			mask &= (uint64_t(1) << (to&63)) - 1;
+		mWords[w] = (mWords[w] & ~mask) | (other.mWords[w] & mask);
+	}
+}
+
+/*******************************************************************************
+ * Crossover of two bit sequences.
+ *
+ * Works like Gentainer::recombine(), treating the bits and the private
+ * genes after them as one sequence: the crossover points are drawn over
+ * the whole sequence and the segments between them are copied
+ * alternately from the parents.
+ ******************************************************************************/
+void PackedBitGentainer::recombine (const Genstruct& as, const Genstruct& bs) {
+	const PackedBitGentainer& a = static_cast<const PackedBitGentainer&> (as);
+	const PackedBitGentainer& b = static_cast<const PackedBitGentainer&> (bs);
+
+	ASSERTWITH (a.mBitCount == mBitCount && b.mBitCount == mBitCount &&
+				a.substructs.size() == substructs.size() && b.substructs.size() == substructs.size(),
+				"Bit sequences must be of equal length to be crossed");
+
+	int total = mBitCount + substructs.size();
+
+	// Draw the crossover points. A point p means that the parent is
+	// switched before position p+1.
+	int nx = static_cast<const AnyIntGene&> (*getGene ("Nx")).getvalue();
+	double pX = static_cast<const AnyFloatGene&> (*getGene ("Px")).getvalue();
+	int points [8];
+	int npoints = 0;
+	for (int i=0; i<nx; i++)
+		if (rndUniform ()<pX) {
+			int p = rndInt (total)+1;
+			if (npoints<8)
+				points[npoints++] = p;
+		}
+
+	// Sort them; there are only a few
+	for (int i=1; i<npoints; i++)
+		for (int j=i; j>0 && points[j-1]>points[j]; j--) {
+			int tmp = points[j]; points[j] = points[j-1]; points[j-1] = tmp;
+		}
+
+	// Copy the segments alternately from the parents. Several
+	// crossovers at the same point switch the parent only once.
+	int whichpar = 0;
+	int start = 0;
+	for (int k=0; k<=npoints; k++) {
+		int end = (k<npoints)? points[k] : total;
+		if (end > total)
+			end = total;
+		const PackedBitGentainer& parent = whichpar? a : b;
+
+		copyBits (parent, start, (end<mBitCount)? end : mBitCount);
+		for (int i=(start>mBitCount)? start:mBitCount; i<end; i++)
+			substructs[i-mBitCount].copy (parent.substructs[i-mBitCount]);
+
+		if (k<npoints && end>start)
+			whichpar = 1-whichpar;
+		start = end;
+	}
+}
+
+double PackedBitGentainer::equality (const Genstruct& o) const {
+	const PackedBitGentainer& other = static_cast<const PackedBitGentainer&> (o);
+
+	// Equal bits and the equality of the private genes
+	return (mBitCount - hamming (other)) + Gentainer::equality (o);
+}
+
+void PackedBitGentainer::copy (const Genstruct& o) {
+	Gentainer::copy (o);
+
+	const PackedBitGentainer& other = static_cast<const PackedBitGentainer&> (o);
+	mBitCount = other.mBitCount;
+	mInitP    = other.mInitP;
+	mWords    = other.mWords;
+}
+
+void PackedBitGentainer::hash (GenomeHash& h) const {
+	h.add (uint64_t (mBitCount));
+	for (int i=0; i<mWords.size(); i++)
+		h.add (mWords[i]);
+	Gentainer::hash (h);
+}
+
+void PackedBitGentainer::saveState (CheckpointOStream& out) const {
+	out.putInt (mBitCount);
+	out.put (mWords.getData (), mWords.size()*sizeof (uint64_t));
+	Gentainer::saveState (out);
+}
+
+void PackedBitGentainer::loadState (CheckpointIStream& in) {
+	if (in.getInt () != mBitCount)
+		throw checkpoint_error (format ("Checkpoint does not match the length of '%s'", (CONSTR) id));
+	in.get (mWords.getData (), mWords.size()*sizeof (uint64_t));
+	Gentainer::loadState (in);
+}
+
+void PackedBitGentainer::print (TextOStream& out) const {
+	if (!isempty(id))
+		out.printf ("%s=", (CONSTR) id);
+	out.printf ("%s {", (CONSTR) getclassname());
+
+	for (int i=0; i<mBitCount; i++)
+		out.printf ("%c", get(i)? '1':'0');
+
+	for (int i=0; i<substructs.size(); i++)
+		if (!substructs[i].isHidden()) {
+			out << ' ';
+			substructs[i].print (out);
+		}
+	out << '}';
+}
+
+DataOStream& PackedBitGentainer::operator>> (DataOStream& out) const {
+	Gentainer::operator>> (out);
+
+	String bitstr;
+	for (int i=0; i<mBitCount; i++)
+		bitstr += get(i)? "1":"0";
+	out.name("bits") << bitstr;
+	out.name("initP") << mInitP;
+
+	return out;
+}
+
+void PackedBitGentainer::check () const {
+	Gentainer::check ();
+	ASSERT (mWords.size() == (mBitCount+63)/64);
+	if (mBitCount & 63)
+		ASSERT ((mWords[mWords.size()-1] >> (mBitCount&63)) == 0);
+}
+
+
+
 //////////////////////////////////////////////////////////////////////////////
 //                                                                          //
 //       _               ----- |                 ----                       //
@@ -190,7 +471,7 @@ FloatGene::FloatGene (const GeneticID& id, double mi, double ma, double mut, dou
 }
 
 void FloatGene::init () {
-	value = mMin + frnd ()*(mMax-mMin);
+	value = mMin + rndUniform ()*(mMax-mMin);
 }
 
 void FloatGene::copy (const Genstruct& o) {
@@ -206,24 +487,17 @@ void FloatGene::shallowCopy (const FloatGene& o) {
 
 bool FloatGene::pointMutate (const MutationRate& mut_rate) {
 	// Mutate mutability
-	if (false && mut_rate.autoAdaptation() && frnd()<mut_rate.doubleRate()) {
-		mutability = fabs (mutability + gaussrnd (mutability*0.5));
+	if (false && mut_rate.autoAdaptation() && rndUniform()<mut_rate.doubleRate()) {
+		mutability = fabs (mutability + rndGauss (mutability*0.5));
 	}
 
 	if (mMutator) {
-		value = mMutator->mutate (value, mMin, mMax, mVariance*mut_rate.doubleVariance());
+		FloatGene::forceMutate (mut_rate);
 	} else
 		if (mMax>mMin) { // Can be 0 -> gene is immutable
 			// Default mutation
-			if (frnd()<mut_rate.doubleRate()) {
-				double delta = gaussrnd (mut_rate.doubleVariance());
-				if (value+delta<mMin)
-					delta = mMin;
-				else if (value+delta>mMax)
-					delta = mMax;
-				
-				value += delta;
-			}
+			if (rndUniform()<mut_rate.doubleRate())
+				FloatGene::forceMutate (mut_rate);
 		}
 
 	//if (MutabilityRecord::record)
@@ -232,6 +506,27 @@ bool FloatGene::pointMutate (const MutationRate& mut_rate) {
 	return true;
 }
 
+int FloatGene::mutationSite (double& coef) const {
+	coef = 1.0;
+	if (mMutator)
+		return MutationSites::ALWAYS;
+	return (mMax>mMin)? MutationSites::FLOAT : MutationSites::NONE;
+}
+
+void FloatGene::forceMutate (const MutationRate& mut_rate) {
+	if (mMutator) {
+		value = mMutator->mutate (value, mMin, mMax, mVariance*mut_rate.doubleVariance());
+	} else {
+		double delta = rndGauss (mut_rate.doubleVariance());
+		if (value+delta<mMin)
+			delta = mMin;
+		else if (value+delta>mMax)
+			delta = mMax;
+		
+		value += delta;
+	}
+}
+
 double FloatGene::equality (const Genstruct& o) const {
 	const FloatGene& other = static_cast<const FloatGene&>(o);
 	return fabs(value-((FloatGene&)other).value)/(mMax-mMin);
@@ -249,6 +544,204 @@ void FloatGene::check () const {
 
 
 
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//                  F l o a t   V e c t o r   G e n e                        //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+FloatVectorGene::FloatVectorGene (const GeneticID& id, int n, double mi, double ma, double mut) : Gene (id, mut) {
+	ASSERT (n>=0);
+	ASSERTWITH (mi<=ma, format ("min (was %f) value must be <= than max value (was %f)"
+							   , mi, ma));
+	mValues.make (n);
+	mMin.make (n);
+	mMax.make (n);
+	mVariance.make (n);
+	for (int i=0; i<n; i++) {
+		mMin[i]		 = mi;
+		mMax[i]		 = ma;
+		mVariance[i] = 1.0;
+	}
+	mMutator = NULL;
+	init ();
+}
+
+FloatVectorGene& FloatVectorGene::setRange (int i, double mi, double ma) {
+	ASSERTWITH (mi<=ma, format ("min (was %f) value must be <= than max value (was %f)"
+							   , mi, ma));
+	mMin[i] = mi;
+	mMax[i] = ma;
+	if (mValues[i]<mi)
+		mValues[i] = mi;
+	else if (mValues[i]>ma)
+		mValues[i] = ma;
+	return *this;
+}
+
+void FloatVectorGene::init () {
+	const int n = mValues.size();
+	for (int i=0; i<n; i++)
+		mValues[i] = mMin[i] + rndUniform ()*(mMax[i]-mMin[i]);
+}
+
+void FloatVectorGene::copy (const Genstruct& o) {
+	Gene::copy (o);
+	shallowCopy (static_cast<const FloatVectorGene&>(o));
+}
+
+void FloatVectorGene::shallowCopy (const FloatVectorGene& o) {
+	mValues		= o.mValues;
+	mMin		= o.mMin;
+	mMax		= o.mMax;
+	mVariance	= o.mVariance;
+	mMutator	= o.mMutator;
+}
+
+/*******************************************************************************
+ * Mutates the elements in blocks. The random numbers of a block are drawn
+ * in two batches: first the uniform numbers deciding which elements mutate,
+ * then the Gaussian changes for the mutating ones. As with FloatGene, a
+ * mutator mutates every element, with the variance of the element scaled by
+ * the mutation variance.
+ ******************************************************************************/
+bool FloatVectorGene::pointMutate (const MutationRate& k) {
+	const int block = 64;
+	const int n = mValues.size();
+	const double rate = k.doubleRate();
+	const double sd = k.doubleVariance();
+	bool mutated = false;
+
+	double uniform [block];
+	double delta [block];
+	double variance [block];
+	int    site [block];
+
+	if (mMutator) {
+		for (int start=0; start<n; start+=block) {
+			const int m = (n-start < block)? n-start : block;
+			for (int j=0; j<m; j++)
+				variance[j] = mVariance[start+j]*sd;
+			mMutator->mutateBatch (&mValues[start], &mMin[start], &mMax[start], m, variance);
+		}
+		return n>0;
+	}
+
+	for (int start=0; start<n; start+=block) {
+		const int m = (n-start < block)? n-start : block;
+
+		// Choose the mutating elements
+		if (rate<1.0)
+			rndFillUniform (uniform, m);
+		int sites = 0;
+		for (int j=0; j<m; j++)
+			if (mMax[start+j]>mMin[start+j] && (rate>=1.0 || uniform[j]<rate))
+				site[sites++] = start+j;
+		if (sites==0)
+			continue;
+
+		// Add the changes, limited to the value range
+		rndFillGaussian (delta, sites, sd);
+		for (int j=0; j<sites; j++) {
+			const int i = site[j];
+			double v = mValues[i] + delta[j]*mVariance[i];
+			if (v<mMin[i])
+				v = mMin[i];
+			else if (v>mMax[i])
+				v = mMax[i];
+			mValues[i] = v;
+		}
+		mutated = true;
+	}
+
+	return mutated;
+}
+
+void FloatVectorGene::recombine (const Genstruct& as, const Genstruct& bs) {
+	const FloatVectorGene& a = static_cast<const FloatVectorGene&> (as);
+	const FloatVectorGene& b = static_cast<const FloatVectorGene&> (bs);
+
+	ASSERTWITH (a.dim() == dim() && b.dim() == dim(),
+				format ("Parameter error, dim=%d, a.dim=%d, b.dim=%d",
+						dim(), a.dim(), b.dim()));
+
+	// Gentainer::recombine() has copied the preceding genes from b
+	// and continues with a, so the elements before the crossover
+	// point come from b and the rest from a.
+	Gene::copy (a);
+	const int n = mValues.size();
+	const int point = (n>0)? rndInt (n) : 0;
+	for (int i=0; i<point; i++) {
+		mValues[i]	 = b.mValues[i];
+		mVariance[i] = b.mVariance[i];
+	}
+	for (int i=point; i<n; i++) {
+		mValues[i]	 = a.mValues[i];
+		mVariance[i] = a.mVariance[i];
+	}
+}
+
+double FloatVectorGene::equality (const Genstruct& o) const {
+	const FloatVectorGene& other = static_cast<const FloatVectorGene&>(o);
+	ASSERT (other.dim() == dim());
+
+	const int n = mValues.size();
+	double tot = 0.0;
+	for (int i=0; i<n; i++)
+		if (mMax[i]>mMin[i])
+			tot += fabs (mValues[i]-other.mValues[i])/(mMax[i]-mMin[i]);
+	return tot;
+}
+
+void FloatVectorGene::hash (GenomeHash& h) const {
+	const int n = mValues.size();
+	h.add (uint64_t (n));
+	for (int i=0; i<n; i++)
+		h.add (mValues[i]);
+}
+
+void FloatVectorGene::saveState (CheckpointOStream& out) const {
+	out.putDoubles (mValues.getData (), mValues.size());
+	out.putDoubles (mVariance.getData (), mVariance.size());
+}
+
+void FloatVectorGene::loadState (CheckpointIStream& in) {
+	in.getDoubles (mValues.getData (), mValues.size());
+	in.getDoubles (mVariance.getData (), mVariance.size());
+}
+
+void FloatVectorGene::print (TextOStream& out) const {
+	out.printf ("%s={", (CONSTR) id);
+	for (int i=0; i<mValues.size(); i++)
+		out.printf ((i>0)? " %0.2f":"%0.2f", mValues[i]);
+	out << '}';
+}
+
+DataOStream& FloatVectorGene::operator>> (DataOStream& out) const {
+	Genstruct::operator>> (out);
+
+	String values;
+	for (int i=0; i<mValues.size(); i++)
+		values += format ((i>0)? " %g":"%g", mValues[i]);
+	out.name("values") << values;
+
+	return out;
+}
+
+void FloatVectorGene::check () const {
+	Gene::check ();
+	ASSERT (mMin.size() == mValues.size());
+	ASSERT (mMax.size() == mValues.size());
+	ASSERT (mVariance.size() == mValues.size());
+	for (int i=0; i<mValues.size(); i++) {
+		ASSERT (mMin[i]<=mMax[i]);
+		ASSERT (mValues[i]>=mMin[i]);
+		ASSERT (mValues[i]<=mMax[i]);
+	}
+}
+
+
+
 //////////////////////////////////////////////////////////////////////////////
 //                                                                          //
 //        ----  o     ----- |                 ----                          //
@@ -259,12 +752,10 @@ void FloatGene::check () const {
 //                                                                          //
 //////////////////////////////////////////////////////////////////////////////
 
-BitFloatGene::BitFloatGene (const GeneticID& id, double mi, double ma, int bits, const StringMap& params, double mut) : AnyFloatGene (id, mi, ma, mut) {
+BitFloatGene::BitFloatGene (const GeneticID& id, double mi, double ma, int bits, const StringMap& params, double mut) : AnyFloatGene (id, mi, ma, mut), mBits (NULL, bits) {
 	ASSERT (bits>=1 && bits<=32);
 
 	mBitCount = bits;
-	for (int i=0; i<bits; i++)
-		mBits.add (new BinaryGene (format("b%d", i)));
 
 	Gentainer* dummy = NULL;
 	mBits.addPrivateGenes (*dummy, params);
@@ -272,6 +763,7 @@ BitFloatGene::BitFloatGene (const GeneticID& id, double mi, double ma, int bits,
 
 	trywith (mGrayCoded = getOrDefault (params, "BitFloatGene.graycoding", String(1)).toInt(),
 			 format ("Gene name='%s'", (CONSTR) id));
+	decode ();
 }
 
 void BitFloatGene::copy (const Genstruct& o) {
@@ -283,27 +775,26 @@ void BitFloatGene::shallowCopy (const BitFloatGene& o) {
 	mBitCount	= o.mBitCount;
 	mBits.copy (o.mBits);
 	mGrayCoded = o.mGrayCoded;
+	mValue     = o.mValue;
 }
 
-double BitFloatGene::getvalue () const
+double BitFloatGene::decodeBits () const
 {
-	// Read the bits to a binary vector
-	PackArray<int> bits (mBitCount);
-	for (int i=0; i<mBitCount; i++)
-		bits[i] = static_cast<const BinaryGene&> (*mBits.getGene(format("b%d",i))).getvalue();
+	// Read the bits as an integer, b0 being the least significant
+	uint64_t sum = mBits.getBits (0, mBitCount);
 
-	if (mGrayCoded) {
-		// Convert from Gray to binary
-		for (int i=mBitCount-2; i>=0; i--)
-			bits[i] = bits[i+1]^bits[i];
-	}
+	if (mGrayCoded)
+		sum = grayToBinary (sum);
+
+	return mMin+(mMax-mMin)*double(sum)/double(uint64_t(1)<<mBitCount);
+}
 
-	// Convert from binary to double
-	unsigned long int sum = 0;
-	for (unsigned long int i=0, m=1; i < (uint) mBitCount; i++, m<<=1)
-		sum |= m*bits[i];
+bool BitFloatGene::pointMutate (const MutationRate& k) {
+	if (!mBits.pointMutate (k))
+		return false;
 
-	return mMin+(mMax-mMin)*double(sum)/double((1<<mBitCount));
+	decode ();
+	return true;
 }
 
 void BitFloatGene::print (TextOStream& out) const {
@@ -316,10 +807,12 @@ void BitFloatGene::recombine (const Genstruct& ar, const Genstruct& br) {
 	const BitFloatGene& b = static_cast<const BitFloatGene&> (br);
 	
 	mBits.recombine (a.mBits, b.mBits);
+	decode ();
 }
 
 void BitFloatGene::check () const {
 	AnyFloatGene::check ();
+	ASSERT (mValue == decodeBits());
 	ASSERT (getvalue()>=mMin);
 	ASSERT (getvalue()<=mMax);
 	mBits.check ();
@@ -379,7 +872,7 @@ int IntGene::getvalue () const {
 }
 
 void IntGene::init () {
-	mValue = mMin + rnd (mMax-mMin);
+	mValue = mMin + rndInt (mMax-mMin);
 }
 
 void IntGene::copy (const Genstruct& o) {
@@ -397,13 +890,13 @@ void IntGene::shallowCopy (const IntGene& o) {
 bool IntGene::pointMutate (const MutationRate& mut_rate) {
 	switch (0) {
 	  case 0: {
-		  if (frnd()<=mut_rate.intRate()*mutability)
+		  if (rndUniform()<=mut_rate.intRate()*mutability)
 			  init ();
 	  } break;
 	  case 1: {
 		  int delta;
 		  do {
-			  delta = int (gaussrnd (mut_rate.doubleVariance()*mutability));
+			  delta = int (rndGauss (mut_rate.doubleVariance()*mutability));
 		  } while (mValue+delta<mMin || mValue+delta>mMax);
 		  mValue += delta;
 	  }
@@ -438,14 +931,12 @@ void IntGene::check () const {
 //                                                                           //
 ///////////////////////////////////////////////////////////////////////////////
 
-BitIntGene::BitIntGene (const GeneticID& id, int mi, int ma, int bits, const StringMap& params, double mut) : AnyIntGene (id, mi, ma, mut) {
+BitIntGene::BitIntGene (const GeneticID& id, int mi, int ma, int bits, const StringMap& params, double mut) : AnyIntGene (id, mi, ma, mut), mBits (NULL, bits) {
 	ASSERT (bits>=1 && bits<=32);
 	ASSERTWITH (ma-mi+1==(1<<bits), format("Range (%d-%d) must match the number of bits (%d)",
 											 mi, ma, bits));
 	
 	mBitCount = bits;
-	for (int i=0; i<bits; i++)
-		mBits.add (new BinaryGene (format("b%d", i)));
 
 	Gentainer* dummy = NULL;
 	mBits.addPrivateGenes (*dummy, params);
@@ -453,6 +944,7 @@ BitIntGene::BitIntGene (const GeneticID& id, int mi, int ma, int bits, const Str
 
 	trywith (mGrayCoded = getOrDefault (params, "BitIntGene.graycoding", String(1)).toInt (),
 			 (CONSTR) format ("Gene name='%s'", (CONSTR) id));
+	decode ();
 }
 
 void BitIntGene::copy (const Genstruct& o) {
@@ -464,26 +956,25 @@ void BitIntGene::shallowCopy (const BitIntGene& o) {
 	mBitCount	= o.mBitCount;
 	mBits.copy (o.mBits);
 	mGrayCoded = o.mGrayCoded;
+	mValue     = o.mValue;
 }
 
-int BitIntGene::getvalue () const {
-	// Read the bits to a binary vector
-	PackArray<int> bits (mBitCount);
-	for (int i=0; i<mBitCount; i++)
-		bits[i] = static_cast<const BinaryGene&> (*mBits.getGene(format("b%d",i))).getvalue();
+int BitIntGene::decodeBits () const {
+	// Read the bits as an integer, b0 being the least significant
+	uint64_t sum = mBits.getBits (0, mBitCount);
 
-	if (mGrayCoded) {
-		// Convert from Gray to binary
-		for (int i=mBitCount-2; i>=0; i--)
-			bits[i] = bits[i+1]^bits[i];
-	}
+	if (mGrayCoded)
+		sum = grayToBinary (sum);
 
-	// Convert from binary to double
-	unsigned long int sum = 0;
-	for (unsigned long int i=0, m=1; i < (uint) mBitCount; i++, m<<=1)
-		sum |= m*bits[i];
+	return mMin + int (sum);
+}
 
-	return mMin + sum;
+bool BitIntGene::pointMutate (const MutationRate& k) {
+	if (!mBits.pointMutate (k))
+		return false;
+
+	decode ();
+	return true;
 }
 
 void BitIntGene::print (TextOStream& out) const {
@@ -496,10 +987,12 @@ void BitIntGene::recombine (const Genstruct& ar, const Genstruct& br) {
 	const BitIntGene& b = static_cast<const BitIntGene&> (br);
 	
 	mBits.recombine (a.mBits, b.mBits);
+	decode ();
 }
 
 void BitIntGene::check () const {
 	AnyIntGene::check ();
+	ASSERT (mValue == decodeBits());
 	ASSERT (getvalue()>=mMin);
 	ASSERT (getvalue()<=mMax);
 	mBits.check ();
@@ -31,6 +31,7 @@
 #include "nhp/genes.h"
 #include "nhp/mutrecord.h"
 #include "nhp/mutator.h"
+#include "nhp/random.h"
 
 impl_dynamic (Genstruct, {Object});
 impl_dynamic (Gentainer, {Genstruct});
@@ -54,6 +55,8 @@ MutationRate::MutationRate (const Gentainer& g) {
 	mFloatVariance	= static_cast<const FloatGene&> (*g.getGene ("Vf")).getvalue();
 	mIntRate		= static_cast<const FloatGene&> (*g.getGene ("Ri")).getvalue();
 	mOneBitMutation = false;
+	mAutoAdaptation = false;
+	mSkipSampling	= false;
 }
 
 MutationSimpleMutator mutmut (30);
@@ -123,6 +126,206 @@ void Genstruct::check () const {
 	ASSERTWITH (size<1000000, "A sensible upper limit for error checking");
 }
 
+/*******************************************************************************
+ * Mixes the word into both halves of the hash. The halves use different
+ * multipliers and rotations, and each is mixed into the other, so a
+ * difference in any word spreads to all 128 bits.
+ ******************************************************************************/
+void GenomeHash::add (uint64_t word)
+{
+	mLow ^= word;
+	mLow *= 0x87C37B91114253D5ULL;
+	mLow  = (mLow<<31) | (mLow>>33);
+	mLow += mHigh;
+
+	mHigh ^= word;
+	mHigh *= 0x4CF5AD432745937FULL;
+	mHigh  = (mHigh<<33) | (mHigh>>31);
+	mHigh += mLow;
+}
+
+void GenomeHash::add (double value)
+{
+	// Hash the bit pattern, but make the two zeros equal
+	if (value == 0.0)
+		value = 0.0;
+	union {double d; uint64_t w;} bits;
+	bits.d = value;
+	add (bits.w);
+}
+
+void MutationRate::saveState (CheckpointOStream& out) const
+{
+	out.putDouble (mBinaryRate);
+	out.putDouble (mIntRate);
+	out.putDouble (mFloatRate);
+	out.putDouble (mFloatVariance);
+	out.putBool (mOneBitMutation);
+	out.putBool (mAutoAdaptation);
+	out.putBool (mSkipSampling);
+}
+
+void MutationRate::loadState (CheckpointIStream& in)
+{
+	mBinaryRate     = in.getDouble ();
+	mIntRate        = in.getDouble ();
+	mFloatRate      = in.getDouble ();
+	mFloatVariance  = in.getDouble ();
+	mOneBitMutation = in.getBool ();
+	mAutoAdaptation = in.getBool ();
+	mSkipSampling   = in.getBool ();
+}
+
+void GenomeHash::add (const String& text)
+{
+	uint64_t word = text.length ();
+	for (int i=0; i<text.length (); i++) {
+		word = (word<<8) | (unsigned char) text[i];
+		if (i%8 == 7) {
+			add (word);
+			word = 0;
+		}
+	}
+	add (word);
+}
+
+void Genstruct::signature (GenomeHash& h) const {
+	h.add (String (getclassname ()));
+	h.add (id);
+	h.add (uint64_t (length ()));
+}
+
+void Genstruct::saveState (CheckpointOStream& out) const {
+	throw checkpoint_error (format ("%s '%s' can not be checkpointed",
+									getclassname (), (CONSTR) id));
+}
+
+void Genstruct::loadState (CheckpointIStream& in) {
+	throw checkpoint_error (format ("%s '%s' can not be checkpointed",
+									getclassname (), (CONSTR) id));
+}
+
+void Genstruct::collectMutationSites (MutationSites& sites) {
+	double coef;
+	int kind = mutationSite (coef);
+	sites.add (this, kind, coef);
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//                        M u t a t i o n   S i t e s                        //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/*******************************************************************************
+ * Version of the structure of all Gentainers. The containers do not know
+ * their parents, so a change anywhere makes all the site lists stale, and
+ * they are rebuilt on their next use. The structure normally changes only
+ * while the genomes are being built.
+ ******************************************************************************/
+static volatile long structureVersion = 0;
+
+MutationSites::MutationSites ()
+{
+	for (int i=0; i<number_of_kinds; i++)
+		mMaxCoef[i] = 0.0;
+	mStale = false;
+	mVersion = structureVersion;
+}
+
+bool MutationSites::isStale () const
+{
+	return mStale || mVersion != structureVersion;
+}
+
+void MutationSites::structureChanged ()
+{
+	__sync_fetch_and_add (&structureVersion, 1);
+}
+
+void MutationSites::add (Genstruct* site, int kind, double coefficient)
+{
+	if (kind==NONE)
+		return;
+	ASSERTWITH (kind>=0 && kind<number_of_kinds, format ("Unknown mutation site kind %d", kind));
+
+	PackArray<Genstruct*>& list = mSites[kind];
+	list.resize (list.size()+1);
+	list[list.size()-1] = site;
+
+	if (coefficient > mMaxCoef[kind])
+		mMaxCoef[kind] = coefficient;
+}
+
+double MutationSites::rateOf (const MutationRate& k, int kind) const
+{
+	switch (kind) {
+	  case BINARY: return k.binaryRate ();
+	  case INT:    return k.intRate ();
+	  case FLOAT:  return k.doubleRate ();
+	};
+	return 1.0;
+}
+
+/*******************************************************************************
+ * Mutates the sites of each kind by jumping from one candidate site to the
+ * next with geometrically distributed gaps.
+ *
+ * If the gaps are drawn with probability p_max and each candidate is
+ * accepted with probability p/p_max, every site mutates independently with
+ * its own probability p, just as if it had been tested separately.
+ ******************************************************************************/
+bool MutationSites::mutate (const MutationRate& k)
+{
+	bool mutated = false;
+
+	for (int kind=0; kind<ALWAYS; kind++) {
+		const PackArray<Genstruct*>& list = mSites[kind];
+		double rate = rateOf (k, kind);
+		double pmax = rate * mMaxCoef[kind];
+		if (list.size()==0 || pmax<=0.0)
+			continue;
+		if (pmax>1.0)
+			pmax = 1.0;
+
+		// Here i is always the first site not yet passed, and the gap
+		// is the number of sites skipped before the next candidate.
+		// With p_max=1 every site is a candidate.
+		double logq = (pmax<1.0)? log (1.0-pmax) : 0.0;
+		for (int i=0; ; i++) {
+			if (logq<0.0) {
+				double gap = log (1.0-rndUniform()) / logq;
+				if (gap >= list.size()-i)
+					break;
+				i += int (gap);
+			} else if (i >= list.size())
+				break;
+
+			// Accept the candidate with the ratio of its own
+			// probability to the one used for drawing the gap.
+			double coef;
+			list[i]->mutationSite (coef);
+			if (coef > mMaxCoef[kind])
+				mStale = true;
+			double p = rate*coef;
+			if (p >= pmax || rndUniform()*pmax < p) {
+				list[i]->forceMutate (k);
+				mutated = true;
+			}
+		}
+	}
+
+	// The structures with some other mutation scheme mutate by themselves
+	const PackArray<Genstruct*>& always = mSites[ALWAYS];
+	for (int i=0; i<always.size(); i++)
+		if (always[i]->pointMutate (k))
+			mutated = true;
+
+	return mutated;
+}
+
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -138,6 +341,7 @@ void Genstruct::check () const {
 Gentainer::Gentainer (const GeneticID& iid) : Genstruct (iid) {
 	self_adjust = false;
 	mRecombRate = 1.0;
+	mpSites = NULL;
 }
 
 Gentainer::Gentainer (const Gentainer& orig) : Genstruct (orig) {
@@ -147,11 +351,13 @@ Gentainer::Gentainer (const Gentainer& orig) : Genstruct (orig) {
 	
 	self_adjust = orig.self_adjust;
 	mRecombRate = orig.mRecombRate;
+	mpSites = NULL;
 }
 
 void Gentainer::add (Genstruct* genestr) {
 	ASSERTWITH (genestr, "Genstruct to be added to Gentainer must not be null pointer.");
 	substructs.add (genestr);
+	invalidateSites ();
 }
 
 void Gentainer::init () {
@@ -216,6 +422,42 @@ const Genstruct* Gentainer::getGene (const GeneticID& cc_name) const
 	return NULL;
 }
 
+GenePath Gentainer::resolve (const GeneticID& name) const
+{
+	GenePath path;
+	if (!findPath (name, path.mSteps, 0))
+		throw invalid_gene_name (format ("Gene '%s' not found", (CONSTR) name));
+	return path;
+}
+
+bool Gentainer::findPath (const GeneticID& name, PackArray<int>& steps, int depth) const
+{
+	for (int i=0; i<substructs.size(); i++)
+		if (substructs[i].getID() == name) {
+			steps.resize (depth+1);
+			steps[depth] = i;
+			return true;
+		}
+
+	for (int i=0; i<substructs.size(); i++)
+		if (const Gentainer* sub = dynamic_cast<const Gentainer*> (&substructs[i]))
+			if (sub->findPath (name, steps, depth+1)) {
+				steps[depth] = i;
+				return true;
+			}
+
+	return false;
+}
+
+const Genstruct* Gentainer::getGene (const GenePath& path) const
+{
+	const Gentainer* container = this;
+	for (int d=0; d<path.depth()-1; d++)
+		container = static_cast<const Gentainer*> (&container->substructs[path[d]]);
+
+	return &container->substructs[path[path.depth()-1]];
+}
+
 bool Gentainer::pointMutate (const MutationRate& k) {
 	bool mutated = false;
 
@@ -226,12 +468,29 @@ bool Gentainer::pointMutate (const MutationRate& k) {
 		MutabilityRecord::addBoolMutability (combined.binaryRate());
 		MutabilityRecord::addFloatMutability (combined.doubleRate());
 		MutabilityRecord::addFloatVariance (combined.doubleVariance());
-		
-		for (int i=0; i<substructs.size(); i++)
-			if (substructs[i].pointMutate (combined))
-				mutated = true;
+
+		mutated = mutateSubstructs (combined);
 	} else {
 		// No self-adjustment
+		mutated = mutateSubstructs (k);
+	}
+
+	return mutated;
+}
+
+bool Gentainer::mutateSubstructs (const MutationRate& k) {
+	bool mutated = false;
+
+	if (k.skipSampling ()) {
+		// Collect the sites of the whole structure once and reuse them
+		if (!mpSites || mpSites->isStale ()) {
+			delete mpSites;
+			mpSites = new MutationSites ();
+			for (int i=0; i<substructs.size(); i++)
+				substructs[i].collectMutationSites (*mpSites);
+		}
+		mutated = mpSites->mutate (k);
+	} else {
 		for (int i=0; i<substructs.size(); i++)
 			if (substructs[i].pointMutate (k))
 				mutated = true;
@@ -240,6 +499,45 @@ bool Gentainer::pointMutate (const MutationRate& k) {
 	return mutated;
 }
 
+void Gentainer::hash (GenomeHash& h) const {
+	h.add (uint64_t (substructs.size()));
+	for (int i=0; i<substructs.size() && h.isValid(); i++)
+		substructs[i].hash (h);
+}
+
+void Gentainer::signature (GenomeHash& h) const {
+	Genstruct::signature (h);
+	h.add (uint64_t (substructs.size()));
+	for (int i=0; i<substructs.size(); i++)
+		substructs[i].signature (h);
+}
+
+void Gentainer::saveState (CheckpointOStream& out) const {
+	out.putInt (substructs.size());
+	for (int i=0; i<substructs.size(); i++)
+		substructs[i].saveState (out);
+}
+
+void Gentainer::loadState (CheckpointIStream& in) {
+	if (in.getInt () != substructs.size())
+		throw checkpoint_error (format ("Checkpoint does not match the structure of '%s'", (CONSTR) id));
+	for (int i=0; i<substructs.size(); i++)
+		substructs[i].loadState (in);
+}
+
+/*******************************************************************************
+ * Adds the sites of the substructures, as if they were directly in the
+ * containing structure. A self-adjusting gentainer has its own mutation
+ * rates, so it is added as a whole.
+ ******************************************************************************/
+void Gentainer::collectMutationSites (MutationSites& sites) {
+	if (self_adjust)
+		sites.add (this, MutationSites::ALWAYS, 1.0);
+	else
+		for (int i=0; i<substructs.size(); i++)
+			substructs[i].collectMutationSites (sites);
+}
+
 void Gentainer::recombine (const Genstruct& as, const Genstruct& bs) {
 	const Gentainer& a = static_cast<const Gentainer&> (as);
 	const Gentainer& b = static_cast<const Gentainer&> (bs);
@@ -258,8 +556,8 @@ void Gentainer::recombine (const Genstruct& as, const Genstruct& bs) {
 	int n = static_cast<const AnyIntGene&> (*getGene ("Nx")).getvalue();
 	double pX = static_cast<const AnyFloatGene&> (*getGene ("Px")).getvalue();
 	for (int i=0; i<n; i++)
-		if (frnd ()<pX)
-			crosspos [rnd (substructs.size())] = true;
+		if (rndUniform ()<pX)
+			crosspos [rndInt (substructs.size())] = true;
 
 	// And copy the parents, switching at the marks...
 	int whichpar = 0;
@@ -334,8 +632,11 @@ void Gentainer::copy (const Genstruct& o) {
 		// Can't copy, so clone
 		for (int i=0; i<other.substructs.size(); i++)
 			substructs.add (other.substructs[i].replicate());
+		invalidateSites ();
 	}
 
+	if (self_adjust != other.self_adjust)
+		invalidateSites ();
 	self_adjust = other.self_adjust;
 }
 
@@ -438,6 +739,16 @@ void Genome::addPrivateGenes (Gentainer& parent, const StringMap& pars) {
 	Gentainer::addPrivateGenes (*this, pars);
 }
 
+void Genome::saveState (CheckpointOStream& out) const {
+	out.putInt (kings);
+	Gentainer::saveState (out);
+}
+
+void Genome::loadState (CheckpointIStream& in) {
+	kings = in.getInt ();
+	Gentainer::loadState (in);
+}
+
 void Genome::print (TextOStream& out) const {
 	Gentainer::print (out);
 }
@@ -0,0 +1,328 @@
+/***************************************************************************
+ *   This file is part of the NeHeP library.                               *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <magic/mpararr.h>
+#include <magic/mexception.h>
+#include "nhp/gridpopulation.h"
+#include "nhp/gaenvrnmt.h"
+#include "nhp/mutrecord.h"
+
+/*******************************************************************************
+ * Job for the worker pool of a GridPopulation: either evaluates a range of
+ * cells or breeds a range of rows.
+ ******************************************************************************/
+class GridTask : public PoolTask {
+	GridPopulation*	rpPopula;
+	bool			mBreed;
+
+  public:
+					GridTask	(GridPopulation& popula, bool breed) : rpPopula (&popula), mBreed (breed) {}
+
+	virtual void	process		(int begin, int end, int worker) {
+		if (mBreed)
+			rpPopula->breed (begin, end);
+		else
+			rpPopula->evaluate (begin, end, rpPopula->mpEvalRecords[worker]);
+	}
+};
+
+GridPopulation::GridPopulation (EAEnvironment& envir, const StringMap& params)
+		: Population (envir, params)
+{
+	mWidth       = getOrDefault (params, "GridPopulation.width", String(16)).toInt ();
+	mHeight      = getOrDefault (params, "GridPopulation.height", String(16)).toInt ();
+	mLocalElites = getOrDefault (params, "GridPopulation.localElites", String(1)).toInt ();
+	mTournament  = getOrDefault (params, "Selection.q", String(2)).toInt ();
+	ASSERTWITH (mWidth>0 && mHeight>0, "GridPopulation must have at least one cell");
+	ASSERTWITH (mTournament>0, "Selection.q must be positive");
+
+	String neighbourhood = getOrDefault (params, "GridPopulation.neighbourhood", "vonneumann");
+	ASSERTWITH (neighbourhood=="vonneumann" || neighbourhood=="moore",
+				format ("Unknown GridPopulation.neighbourhood '%s'", (CONSTR) neighbourhood));
+	mNeighbourhood = (neighbourhood=="moore")? MOORE : VON_NEUMANN;
+
+	// The neighbourhood as offsets from the cell, the cell itself first
+	mRowOffset.make ((mNeighbourhood==MOORE)? 9:5);
+	mColOffset.make (mRowOffset.size ());
+	int n = 0;
+	for (int dr=-1; dr<=1; dr++)
+		for (int dc=-1; dc<=1; dc++)
+			if (mNeighbourhood==MOORE || dr==0 || dc==0) {
+				int k = (dr==0 && dc==0)? 0 : ++n;
+				mRowOffset[k] = dr;
+				mColOffset[k] = dc;
+			}
+
+	mSelectionParams.setQ (mTournament);
+
+	/**************************************************************************/
+	// Create a template for an Individual
+
+	Genome templ;
+	rpEnvironment->addFeaturesTo (templ);     // Add environment genes
+	templ.addPrivateGenes (templ, params);    // Add genome      genes
+	Individual::addGenesTo (templ, params);   // Add individual  genes
+	templ.selfadjust (mGlobalMutationRate.autoAdaptation());
+	rpEnvironment->resolveGenes (templ);
+	rpEnvironment->setFitnessCache (getOrDefault (params, "FitnessCache.size", String(0)).toInt ());
+
+	/**************************************************************************/
+	// Create the two grids. Only the current one is initialized, the
+	// other is overwritten by the offspring.
+
+	mpCells = new Array<Individual> ();
+	mpNext  = new Array<Individual> ();
+	mpCells->make (size());
+	mpNext->make (size());
+	mFitness.make (size());
+	mSurvives.make (size());
+
+	// Seed the root stream before initializing the cells from it
+	mSeed = (unsigned int) getOrDefault (params, "SimplePopulation.seed", String(0)).toInt ();
+	if (mSeed)
+		mRandom.seed (mSeed);
+	else
+		mRandom.seed ((uint64_t (rnd (65536))<<32) | (uint64_t (rnd (65536))<<16) | uint64_t (rnd (65536)));
+
+	RandomStream stream;
+	RandomScope scope (stream);
+	for (int i=0; i<size(); i++) {
+		stream = mRandom.split (INIT_STREAM, i);
+		mpCells->put (new Individual (templ), i);
+		(*mpCells)[i].setSelector (mSelectionParams);
+		(*mpCells)[i].init ();
+		(*mpCells)[i].incarnate (true);
+
+		mpNext->put (new Individual (templ), i);
+		(*mpNext)[i].setSelector (mSelectionParams);
+
+		mFitness[i]  = 0.0;
+		mSurvives[i] = false;
+	}
+
+	String scheduler = getOrDefault (params, "SimplePopulation.scheduler", "stealing");
+	ASSERTWITH (scheduler=="stealing" || scheduler=="chunked",
+				format ("Unknown SimplePopulation.scheduler '%s'", (CONSTR) scheduler));
+	mpWorkerPool  = new WorkerPool (getOrDefault (params, "SimplePopulation.threads", String(0)).toInt (),
+									(scheduler=="chunked")? WorkerPool::CHUNKED : WorkerPool::STEALING);
+	mpEvalRecords = new EvaluationRecord [mpWorkerPool->threads ()];
+
+	mAge = 0;
+	mEvolog.autoFlush ();
+	mOuts.autoFlush ();
+}
+
+GridPopulation::~GridPopulation ()
+{
+	delete [] mpEvalRecords;
+	delete mpWorkerPool;
+	delete mpNext;
+	delete mpCells;
+}
+
+int GridPopulation::neighbour (int i, int k) const
+{
+	int row = i/mWidth + mRowOffset[k];
+	int col = i%mWidth + mColOffset[k];
+
+	if (row<0)
+		row += mHeight;
+	else if (row>=mHeight)
+		row -= mHeight;
+	if (col<0)
+		col += mWidth;
+	else if (col>=mWidth)
+		col -= mWidth;
+
+	return row*mWidth+col;
+}
+
+double GridPopulation::evolve (int gens, double target_fitn)
+{
+	FUNCTION_BEGIN;
+
+	for (int g=0; g<gens; g++) {
+		if (MutabilityRecord::record)
+			MutabilityRecord::reset ();
+
+		rpEnvironment->init_cycle ();
+		evaluate ();
+		report (mEvolog);
+		rpEnvironment->cycleReport (mEvolog, mOuts);
+
+		if (target_fitn != -1 && rpEnvironment->bestfitn < target_fitn)
+			break;
+
+		// Self-adaptation and mutability recording collect global
+		// statistics that can not be updated from several threads
+		GridTask task (*this, true);
+		if (mGlobalMutationRate.autoAdaptation() || MutabilityRecord::record)
+			task.process (0, mHeight, 0);
+		else
+			mpWorkerPool->run (task, mHeight);
+
+		// The survivors move to the next generation as they are. This
+		// can be done only after all the offspring are created, as
+		// the neighbours of the survivors read them.
+		for (int i=0; i<size(); i++)
+			if (mSurvives[i]) {
+				Individual* survivor = mpCells->cut (i);
+				mpCells->put (mpNext->cut (i), i);
+				mpNext->put (survivor, i);
+			}
+
+		Array<Individual>* tmp = mpCells;
+		mpCells = mpNext;
+		mpNext = tmp;
+
+		mEvolog << "\n";
+	}
+
+	FUNCTION_END;
+	return mFitnessStats.minFitness();
+}
+
+void GridPopulation::evaluate ()
+{
+	FUNCTION_BEGIN;
+
+	for (int w=0; w<mpWorkerPool->threads (); w++)
+		mpEvalRecords[w].reset ();
+
+	GridTask task (*this, false);
+	mpWorkerPool->run (task, size());
+
+	for (int w=1; w<mpWorkerPool->threads (); w++)
+		mpEvalRecords[0].add (mpEvalRecords[w]);
+	rpEnvironment->merge (mpEvalRecords[0]);
+
+	mFitnessStats.reset ();
+	for (int i=0; i<size(); i++) {
+		mFitness[i] = (*mpCells)[i].getfitness ();
+		mFitnessStats.add (mFitness[i]);
+	}
+
+	mOuts.printf ("GridPopulation report gen %d: ", mAge);
+	mFitnessStats.print (mOuts);
+
+	mAge++;
+
+	FUNCTION_END;
+}
+
+void GridPopulation::evaluate (int begin, int end, EvaluationRecord& record)
+{
+	RandomStream stream;
+	RandomScope scope (stream);
+
+	for (int i=begin; i<end; i++) {
+		stream = mRandom.split (EVALUATION_STREAM, mAge, i);
+		record.setItem (i);
+		(*mpCells)[i].evaluate (*rpEnvironment, record);
+	}
+}
+
+/*******************************************************************************
+ * Creates the offspring of the cells in rows [begin, end) in the next grid.
+ *
+ * The current grid and the fitness array are only read here, and each cell
+ * of the next grid is written by the worker that has its row, so no locking
+ * is needed. Rows are handed out in contiguous ranges, which keeps the
+ * neighbourhoods of consecutive cells in the cache.
+ ******************************************************************************/
+void GridPopulation::breed (int begin, int end)
+{
+	RandomStream stream;
+	RandomScope scope (stream);
+
+	for (int i=begin*mWidth; i<end*mWidth; i++) {
+		mSurvives[i] = mLocalElites && isLocalElite (i);
+		if (mSurvives[i])
+			continue;
+
+		stream = mRandom.split (OFFSPRING_STREAM, mAge, i);
+		const Individual& parent_a = (*mpCells)[select (i)];
+		const Individual& parent_b = (*mpCells)[select (i)];
+
+		Individual& offspring = (*mpNext)[i];
+		offspring.recombine (parent_a, parent_b);
+		offspring.pointMutate (mGlobalMutationRate);
+		offspring.incarnate (true);
+	}
+}
+
+int GridPopulation::select (int i) const
+{
+	int best = neighbour (i, rndInt (neighbours ()));
+	for (int t=1; t<mTournament; t++) {
+		int candidate = neighbour (i, rndInt (neighbours ()));
+		if (mFitness[candidate] < mFitness[best])
+			best = candidate;
+	}
+	return best;
+}
+
+/*******************************************************************************
+ * Of cells with equal fitness, the one with the smallest index wins, so that
+ * a plateau does not freeze the whole neighbourhood.
+ ******************************************************************************/
+bool GridPopulation::isLocalElite (int i) const
+{
+	for (int k=1; k<neighbours (); k++) {
+		int j = neighbour (i, k);
+		if (mFitness[j] < mFitness[i] || (mFitness[j] == mFitness[i] && j < i))
+			return false;
+	}
+	return true;
+}
+
+void GridPopulation::print (TextOStream& out) const
+{
+	out << "GridPopulation {\n";
+	out.printf ("width=%d, height=%d,\n", mWidth, mHeight);
+	for (int row=0; row<mHeight; row++) {
+		for (int col=0; col<mWidth; col++)
+			out.printf ("%g ", mFitness[row*mWidth+col]);
+		out << "\n";
+	}
+	out << "}\n";
+}
+
+void GridPopulation::report (TextOStream& log) const
+{
+	log.printf ("%d %.30f %.30f %.30f ", mAge,
+				mFitnessStats.minFitness(), mFitnessStats.avgFitness(),
+				mFitnessStats.maxFitness());
+	log.flush ();
+}
+
+void GridPopulation::check () const
+{
+	Population::check ();
+	ASSERT (mpCells && mpNext);
+	ASSERT (mpCells->size()==size() && mpNext->size()==size());
+	for (int i=0; i<size(); i++)
+		(*mpCells)[i].check ();
+	rpEnvironment->check ();
+}
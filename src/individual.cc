@@ -30,6 +30,7 @@
 #include "nhp/genes.h"
 #include "nhp/population.h"
 #include "nhp/selection.h"
+#include "nhp/profiler.h"
 
 impl_dynamic (Individual, {Comparable});
 
@@ -103,10 +104,36 @@ void Individual::grow_older () {
 *******************************************************************************/
 double Individual::evaluate (EAEnvironment& envr, /**< Environment to evaluate the fitness in. */
 							 bool           force /**< Force re-evaluation of the fitness.     */) 
+{
+	return evaluate (envr, NULL, force);
+}
+
+double Individual::evaluate (EAEnvironment&    envr,   /**< Environment to evaluate the fitness in. */
+							 EvaluationRecord& record, /**< Record of the evaluating thread.        */
+							 bool              force   /**< Force re-evaluation of the fitness.     */)
+{
+	return evaluate (envr, &record, force);
+}
+
+double Individual::evaluate (EAEnvironment&    envr,     /**< Environment that measured the fitness. */
+							 EvaluationRecord& record,   /**< Record of the evaluating thread.      */
+							 double            measured, /**< Fitness from EAEnvironment::measureBatch(). */
+							 bool              evaluated /**< Was it really evaluated, not cached?  */)
+{
+	double measured_fitness = envr.evaluate (*this, measured, evaluated, record);
+	fitness = (fitness*avg_over + measured_fitness) / (++avg_over);
+
+	// Evaluating is tiring
+	grow_older ();
+
+	return fitness;
+}
+
+double Individual::evaluate (EAEnvironment& envr, EvaluationRecord* record, bool force)
 {
 	// Evaluate as many times as required for averaging.
 	while (avg_over < envr.evals() || force) {
-		double measured_fitness = envr.evaluate (*this);
+		double measured_fitness = record? envr.evaluate (*this, *record) : envr.evaluate (*this);
 
 		// Take an average of old measurements
  		fitness = (fitness*avg_over + measured_fitness) / (++avg_over);
@@ -121,6 +148,21 @@ double Individual::evaluate (EAEnvironment& envr, /**< Environment to evaluate t
 	return fitness;
 }
 
+void Individual::saveState (CheckpointOStream& out) const {
+	out.putDouble (fitness);
+	out.putInt (avg_over);
+	out.putInt (age);
+	genome.saveState (out);
+}
+
+void Individual::loadState (CheckpointIStream& in) {
+	fitness  = in.getDouble ();
+	avg_over = in.getInt ();
+	age      = in.getInt ();
+	genome.loadState (in);
+	mpSelector->read (genome);
+}
+
 void Individual::joinfitness (const Individual& other) {
 	if (avg_over>0 || other.avg_over>0)
 		fitness = (fitness*avg_over + other.fitness*other.avg_over) / (avg_over+other.avg_over);
@@ -160,8 +202,10 @@ bool Individual::pointMutate (const MutationRate& k) {
 	bool mut = genome.pointMutate (k);
 
 	// If a mutation has actualized, we are considered a new individual
-	if (mut)
+	if (mut) {
+		NHP_PROFILE_COUNT (Profiler::MUTATIONS, 1);
 		incarnate (false);
+	}
 	
 	return mut;
 }
@@ -22,8 +22,387 @@
  *                                                                         *
  ***************************************************************************/
 
+#include <math.h>
 #include <magic/mpararr.h>
 #include <magic/mdatastream.h>
+#include <magic/mexception.h>
+#include "nhp/metapopulation.h"
 #include "nhp/gaenvrnmt.h"
 #include "nhp/mutrecord.h"
 
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//               M i g r a n t   Q u e u e                                   //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+MigrantQueue::MigrantQueue (int capacity)
+{
+	// One slot is always kept empty to tell a full queue from an
+	// empty one
+	int size = 2;
+	while (size < capacity+1)
+		size <<= 1;
+
+	mpSlots = new Individual* [size];
+	mMask   = size-1;
+	mHead   = 0;
+	mTail   = 0;
+}
+
+MigrantQueue::~MigrantQueue ()
+{
+	while (Individual* migrant = pop ())
+		delete migrant;
+	delete [] mpSlots;
+}
+
+/*******************************************************************************
+ * The producer writes the slot before publishing it by advancing the tail,
+ * and the consumer reads the slot before releasing it by advancing the
+ * head. The barriers keep the compiler and the processor from reordering
+ * these, so no locks are needed.
+ ******************************************************************************/
+bool MigrantQueue::push (Individual* migrant)
+{
+	int tail = mTail;
+	int next = (tail+1) & mMask;
+	if (next == mHead)
+		return false;
+
+	mpSlots[tail] = migrant;
+	__sync_synchronize ();
+	mTail = next;
+	return true;
+}
+
+Individual* MigrantQueue::pop ()
+{
+	int head = mHead;
+	if (head == mTail)
+		return NULL;
+
+	__sync_synchronize ();
+	Individual* migrant = mpSlots[head];
+	__sync_synchronize ();
+	mHead = (head+1) & mMask;
+	return migrant;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//               M e t a p o p u l a t i o n                                 //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/*******************************************************************************
+ * Thread evolving one island of a Metapopulation.
+ ******************************************************************************/
+class IslandThread : public Thread {
+	Metapopulation*	rpMetapop;
+	int				mIsland;
+	int				mGenerations;
+	double			mTarget;
+  public:
+					IslandThread	(Metapopulation& metapop, int island, int generations, double target)
+							: rpMetapop (&metapop), mIsland (island), mGenerations (generations), mTarget (target) {}
+	virtual void*	execute			() {rpMetapop->evolveIsland (mIsland, mGenerations, mTarget); return NULL;}
+};
+
+Metapopulation::Metapopulation (Array<EAEnvironment>& envrs, const StringMap& params)
+		: Population (envrs[0], params)
+{
+	String topology = getOrDefault (params, "Metapopulation.topology", "ring");
+	ASSERTWITH (topology=="ring" || topology=="torus" || topology=="full",
+				format ("Unknown Metapopulation.topology '%s'", (CONSTR) topology));
+
+	build (envrs, params, (topology=="full")? FULL : (topology=="torus")? TORUS : RING);
+}
+
+Metapopulation::Metapopulation (Array<EAEnvironment>& envrs, const StringMap& params, int topology)
+		: Population (envrs[0], params)
+{
+	build (envrs, params, topology);
+}
+
+Metapopulation::~Metapopulation ()
+{
+	pthread_mutex_destroy (&mLock);
+}
+
+void Metapopulation::build (Array<EAEnvironment>& envrs, const StringMap& params, int topology)
+{
+	int islands = envrs.size ();
+	ASSERTWITH (islands>0, "Metapopulation needs at least one island");
+
+	mTopology  = topology;
+	mInterval  = getOrDefault (params, "Metapopulation.interval", String(10)).toInt ();
+	mMigrants  = getOrDefault (params, "Metapopulation.migrants", String(1)).toInt ();
+	int queue  = getOrDefault (params, "Metapopulation.queueSize", String(4*mMigrants)).toInt ();
+	mStop      = false;
+	mAge       = 0;
+	pthread_mutex_init (&mLock, NULL);
+
+	// Share the processors between the islands, unless told otherwise
+	StringMap islandParams;
+	islandParams += params;
+	if (!params.getp ("SimplePopulation.threads")) {
+		int threads = WorkerPool::processors ()/islands;
+		islandParams.set ("SimplePopulation.threads", String ((threads>0)? threads:1));
+	}
+	int seed = getOrDefault (params, "SimplePopulation.seed", String(0)).toInt ();
+	String checkpointFile = getOrDefault (params, "Checkpoint.file", "");
+	String snapshotFile   = getOrDefault (params, "Snapshot.file", "");
+
+	// Create the islands. Each island writes files of its own.
+	mIslands.make (islands);
+	for (int i=0; i<islands; i++) {
+		if (seed)
+			islandParams.set ("SimplePopulation.seed", String (seed+i));
+		if (!isempty (checkpointFile))
+			islandParams.set ("Checkpoint.file", format ("%s.%d", (CONSTR) checkpointFile, i));
+		if (!isempty (snapshotFile))
+			islandParams.set ("Snapshot.file", format ("%s.%d", (CONSTR) snapshotFile, i));
+		mIslands.put (new SimplePopulation (envrs[i], islandParams), i);
+
+		ASSERTWITH (mMigrants <= mIslands[i].elites (),
+					format ("Metapopulation.migrants (%d) exceeds the number of elites (%d)",
+							mMigrants, mIslands[i].elites ()));
+	}
+
+	mSent.make (islands);
+	mDropped.make (islands);
+	mMinFitness.make (islands);
+	for (int i=0; i<islands; i++) {
+		mSent[i]       = 0;
+		mDropped[i]    = 0;
+		mMinFitness[i] = 0.0;
+	}
+
+	// Create the queues between the connected islands
+	connect ();
+	mQueues.make (mEdgeTarget.size ());
+	for (int e=0; e<mEdgeTarget.size (); e++)
+		mQueues.put (new MigrantQueue (queue), e);
+}
+
+/*******************************************************************************
+ * Lists the neighbours of each island as outgoing edges.
+ *
+ * In the torus, the islands are laid out in a grid that is as square as the
+ * number of islands allows, and each has (at most) four neighbours. With a
+ * prime number of islands the torus is a bidirectional ring.
+ ******************************************************************************/
+void Metapopulation::connect ()
+{
+	int islands = mIslands.size ();
+
+	int cols = int (sqrt (double (islands)));
+	while (islands % cols)
+		cols--;
+	int rows = islands/cols;
+
+	mEdgeStart.make (islands+1);
+	mEdgeTarget.make (islands*((mTopology==FULL)? islands : 4));
+	int edges = 0;
+	for (int i=0; i<islands; i++) {
+		mEdgeStart[i] = edges;
+
+		int candidates [4];
+		int count = 0;
+		if (mTopology == RING) {
+			candidates[count++] = (i+1) % islands;
+		} else if (mTopology == TORUS) {
+			int row = i/cols, col = i%cols;
+			candidates[count++] = row*cols + (col+1)%cols;
+			candidates[count++] = row*cols + (col+cols-1)%cols;
+			candidates[count++] = ((row+1)%rows)*cols + col;
+			candidates[count++] = ((row+rows-1)%rows)*cols + col;
+		}
+
+		if (mTopology == FULL) {
+			for (int j=0; j<islands; j++)
+				if (j != i)
+					mEdgeTarget[edges++] = j;
+		} else {
+			// Small grids wrap to the island itself or list a
+			// neighbour twice
+			for (int c=0; c<count; c++) {
+				bool seen = (candidates[c] == i);
+				for (int e=mEdgeStart[i]; e<edges && !seen; e++)
+					seen = (mEdgeTarget[e] == candidates[c]);
+				if (!seen)
+					mEdgeTarget[edges++] = candidates[c];
+			}
+		}
+	}
+	mEdgeStart[islands] = edges;
+	mEdgeTarget.resize (edges);
+}
+
+/*******************************************************************************
+ * Runs each island in its own thread. The calling thread evolves the first
+ * island. The islands synchronize only when they are all done.
+ ******************************************************************************/
+double Metapopulation::evolve (int generations, double trg_fitn)
+{
+	FUNCTION_BEGIN;
+
+	mStop  = false;
+	mError = "";
+
+	IslandThread** threads = new IslandThread* [islands()];
+	threads[0] = NULL;
+	for (int i=1; i<islands(); i++) {
+		threads[i] = new IslandThread (*this, i, generations, trg_fitn);
+		threads[i]->start ();
+	}
+
+	evolveIsland (0, generations, trg_fitn);
+
+	for (int i=1; i<islands(); i++) {
+		threads[i]->join ();
+		delete threads[i];
+	}
+	delete [] threads;
+
+	if (!isempty (mError))
+		throw exception (format ("Island failed: %s", (CONSTR) mError));
+
+	// The islands may have stopped at different generations
+	double best = mMinFitness[0];
+	for (int i=0; i<islands(); i++) {
+		if (mIslands[i].getAge () > mAge)
+			mAge = mIslands[i].getAge ();
+		if (mMinFitness[i] < best)
+			best = mMinFitness[i];
+	}
+
+	mOuts.printf ("Metapopulation report gen %d: %d islands, %d migrants sent, %d dropped\n",
+				  mAge, islands(), sent(), dropped());
+
+	FUNCTION_END;
+	return best;
+}
+
+/*******************************************************************************
+ * Main loop of an island thread.
+ *
+ * The random operations done directly in the island thread, such as choosing
+ * the destinations of the migrants, use a stream of the island, so that the
+ * islands do not share the global random generator.
+ ******************************************************************************/
+void Metapopulation::evolveIsland (int island, int generations, double trg_fitn)
+{
+	SimplePopulation& popula = mIslands[island];
+	RandomStream stream;
+	RandomScope scope (stream);
+
+	try {
+		for (int g=0; g<generations && !mStop; g++) {
+			stream = popula.random().split (SimplePopulation::ISLAND_STREAM, popula.getAge ());
+
+			immigrate (island);
+			mMinFitness[island] = popula.evolve (1);
+
+			if (trg_fitn != -1 && popula.environment().bestfitn < trg_fitn)
+				mStop = true;
+
+			if (mInterval>0 && mMigrants>0 && popula.getAge () % mInterval == 0)
+				emigrate (island);
+		}
+	} catch (exception& e) {
+		pthread_mutex_lock (&mLock);
+		if (isempty (mError))
+			mError = format ("island %d: %s", island, e.what());
+		pthread_mutex_unlock (&mLock);
+		mStop = true;
+	} catch (...) {
+		pthread_mutex_lock (&mLock);
+		if (isempty (mError))
+			mError = format ("island %d: unknown exception", island);
+		pthread_mutex_unlock (&mLock);
+		mStop = true;
+	}
+}
+
+void Metapopulation::emigrate (int island)
+{
+	for (int k=0; k<neighbours (island); k++)
+		for (int m=0; m<mMigrants; m++)
+			send (island, k, mIslands[island][m]);
+}
+
+void Metapopulation::send (int island, int k, const Individual& migrant)
+{
+	Individual* copy = new Individual (migrant);
+	if (mQueues[mEdgeStart[island]+k].push (copy))
+		mSent[island]++;
+	else {
+		delete copy;
+		mDropped[island]++;
+	}
+}
+
+/*******************************************************************************
+ * Replaces the last offspring of the island with the migrants that have
+ * arrived from its neighbours. The elites are never replaced.
+ ******************************************************************************/
+void Metapopulation::immigrate (int island)
+{
+	SimplePopulation& popula = mIslands[island];
+	int slot = popula.size ();
+
+	for (int e=0; e<mEdgeTarget.size (); e++) {
+		if (mEdgeTarget[e] != island)
+			continue;
+
+		while (Individual* migrant = mQueues[e].pop ()) {
+			if (slot > popula.elites ())
+				popula.replace (--slot, migrant);
+			else {
+				delete migrant;
+				mDropped[island]++;
+			}
+		}
+	}
+}
+
+int Metapopulation::sent () const
+{
+	int sum = 0;
+	for (int i=0; i<islands(); i++)
+		sum += mSent[i];
+	return sum;
+}
+
+int Metapopulation::dropped () const
+{
+	int sum = 0;
+	for (int i=0; i<islands(); i++)
+		sum += mDropped[i];
+	return sum;
+}
+
+void Metapopulation::check () const
+{
+	Population::check ();
+	ASSERT (mIslands.size() == mEdgeStart.size()-1);
+	ASSERT (mQueues.size() == mEdgeTarget.size());
+	for (int i=0; i<mIslands.size(); i++)
+		mIslands[i].check ();
+}
+
+/*******************************************************************************
+ * Each migrant goes to one randomly chosen island, instead of a copy to every
+ * island as in the fully connected topology.
+ ******************************************************************************/
+void NonspatialMetapopulation::emigrate (int island)
+{
+	if (neighbours (island) == 0)
+		return;
+
+	for (int m=0; m<migrants(); m++)
+		send (island, rndInt (neighbours (island)), this->island (island)[m]);
+}
+
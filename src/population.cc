@@ -30,6 +30,9 @@
 #include "nhp/gaenvrnmt.h"
 #include "nhp/selection.h"
 #include "nhp/mutrecord.h"
+#include "nhp/random.h"
+#include "nhp/workerpool.h"
+#include "nhp/profiler.h"
 
 // For mutrecord.h
 bool MutabilityRecord::record=false;		// Should we record or not
@@ -96,20 +99,27 @@ void EAStrategy::evolve (EAEnvironment& envr, TextOStream& out, TextOStream& log
 	// out << "Reporting...\n";
 	mrPopula.report (log);
 	envr.cycleReport (log, out);
+	mrPopula.periodicSnapshot ();
 
 	SelectionSituation situation (mrPopula);
 	// Order by fitness. Selection methods can use this order if they wish
 	//RefArray<Individual> pop_order (*mrPopula.mpPopulation);
 	//pop_order.quicksort ();
 	
+	// The rest of the generation draws from a stream of its own,
+	// except for the offspring, which have their own streams
+	RandomStream stream = mrPopula.random().split (SimplePopulation::SELECTION_STREAM, mrPopula.getAge ());
+	RandomScope scope (stream);
+
 	// Create a selection matrix
-	SelectionMatrix selmat (situation);
+	SelectionMatrix selmat (situation, mrPopula.selectionSampler ());
 
 	// Create the next generation according to the selection matrix
 	recombine (situation, selmat);
 
 	// Re-evaluate Tarzan a little...
 	if (mrPopula.mElites>0) {
+		NHP_PROFILE_PHASE (Profiler::ELITES);
 		// out << "Re-evaluating Tarzan...\n";
 		Individual& tarzan = const_cast<Individual&> (situation.getOrdered(0));
 		tarzan.evaluate (envr, true);
@@ -119,6 +129,36 @@ void EAStrategy::evolve (EAEnvironment& envr, TextOStream& out, TextOStream& log
 	FUNCTION_END;
 }
 
+/*******************************************************************************
+ * Job for creating a range of offspring in the worker pool. Each offspring
+ * gets its own random stream, so that the result does not depend on which
+ * thread creates it.
+ ******************************************************************************/
+class OffspringTask : public PoolTask {
+	EAStrategy*					rpStrategy;
+	const SelectionSituation*	rpSituation;
+	const SelectionMatrix*		rpSelmat;
+	const RandomStream*			rpRandom;
+	int							mFirst;
+	int							mGeneration;
+
+  public:
+					OffspringTask	(EAStrategy& strategy, const SelectionSituation& situation,
+									 const SelectionMatrix& selmat, const RandomStream& random,
+									 int first, int generation)
+							: rpStrategy (&strategy), rpSituation (&situation), rpSelmat (&selmat),
+							  rpRandom (&random), mFirst (first), mGeneration (generation) {}
+
+	virtual void	process			(int begin, int end, int worker) {
+		RandomStream stream;
+		RandomScope scope (stream);
+		for (int i=mFirst+begin; i<mFirst+end; i++) {
+			stream = rpRandom->split (SimplePopulation::OFFSPRING_STREAM, mGeneration, i);
+			rpStrategy->makeOffspring (i, *rpSituation, *rpSelmat);
+		}
+	}
+};
+
 /*******************************************************************************
  *
  ******************************************************************************/
@@ -126,34 +166,32 @@ void EAStrategy::recombine (
 	const SelectionSituation& situation,
 	const SelectionMatrix&    selmat)
 {
+	NHP_PROFILE_PHASE (Profiler::BREED);
+
 	////////////////////////////////////////////////////////////////////////////
 	// Clone the old population. This is done in two parts because
 	// we don't want to replicate the elites for no reason
 
 	// Copy the elite references. Warning! Elites are now owned by two
 	// objects for a while.
-	for (int i=0; i<mrPopula.mElites; i++)
-		mpNextGen->put (situation.getOrdered(i), i);
+	{
+		NHP_PROFILE_PHASE (Profiler::ELITES);
+		for (int i=0; i<mrPopula.mElites; i++)
+			mpNextGen->put (situation.getOrdered(i), i);
+	}
 
 	////////////////////////////////////////////////////////////////////////////
 	// Recombine
 	
-	const Individual *parent_a, *parent_b;
-	for (int i=mrPopula.mElites; i<mrPopula.size(); i++) {
-		// Select two parents
-		int parent_a_ind, parent_b_ind;
-		selmat.selectRandomPair (parent_a_ind, parent_b_ind);
-		parent_a = &situation.getOrdered (parent_a_ind);
-		parent_b = &situation.getOrdered (parent_b_ind);
-		
-		// Recombine them as the descendant
-		(*mpNextGen)[i].recombine (*parent_a, *parent_b);
-
-		// Mutate the descendant a little
-		(*mpNextGen)[i].pointMutate (mrPopula.mutRate());
-
-		// Incarnate the descendant
-		(*mpNextGen)[i].incarnate (true);
+	
+	// Self-adaptation and mutability recording collect global
+	// statistics that can not be updated from several threads
+	if (mrPopula.mutRate().autoAdaptation() || MutabilityRecord::record) {
+		for (int i=mrPopula.mElites; i<mrPopula.size(); i++)
+			makeOffspring (i, situation, selmat);
+	} else {
+		OffspringTask task (*this, situation, selmat, mrPopula.random (), mrPopula.mElites, mrPopula.getAge ());
+		mrPopula.mpWorkerPool->run (task, mrPopula.size()-mrPopula.mElites, mrPopula.mChunkSize);
 	}
 
 	////////////////////////////////////////////////////////////////////////////
@@ -166,6 +204,7 @@ void EAStrategy::recombine (
 
 	// Remove the references to the elites from the original
 	// population to make the new population their only owner
+	NHP_PROFILE_PHASE (Profiler::ELITES);
 	for (int i=0; i<mrPopula.mElites; i++)
 		// Since we can cut() only with index, not pointer...
 		for (int j=0; j<mrPopula.size(); j++)
@@ -183,6 +222,35 @@ void EAStrategy::recombine (
 	// delete mrPopula.mpPopulation;
 }
 
+void EAStrategy::makeOffspring (int i, const SelectionSituation& situation,
+								const SelectionMatrix& selmat)
+{
+	// Select two parents
+	int parent_a_ind, parent_b_ind;
+	{
+		NHP_PROFILE_PHASE (Profiler::SELECT);
+		selmat.selectRandomPair (parent_a_ind, parent_b_ind);
+	}
+	const Individual& parent_a = situation.getOrdered (parent_a_ind);
+	const Individual& parent_b = situation.getOrdered (parent_b_ind);
+		
+	// Recombine them as the descendant
+	{
+		NHP_PROFILE_PHASE (Profiler::RECOMBINE);
+		(*mpNextGen)[i].recombine (parent_a, parent_b);
+	}
+
+	// Mutate the descendant a little
+	{
+		NHP_PROFILE_PHASE (Profiler::MUTATE);
+		(*mpNextGen)[i].pointMutate (mrPopula.mutRate());
+	}
+
+	// Incarnate the descendant
+	NHP_PROFILE_PHASE (Profiler::INCARNATE);
+	(*mpNextGen)[i].incarnate (true);
+}
+
 void EAStrategy::addFeaturesTo (Genome& genome) const {
 }
 
@@ -214,6 +282,188 @@ void EAStrategy::check () const {
 	}
 }
 
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//               S t e a d y   S t a t e   S t r a t e g y                   //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/*******************************************************************************
+ * Job for breeding offspring in the worker pool with the steady-state
+ * strategy.
+ ******************************************************************************/
+class SteadyStateTask : public PoolTask {
+	SteadyStateStrategy*	rpStrategy;
+	EAEnvironment*			rpEnvironment;
+
+  public:
+					SteadyStateTask	(SteadyStateStrategy& strategy, EAEnvironment& envr)
+							: rpStrategy (&strategy), rpEnvironment (&envr) {}
+
+	virtual void	process			(int begin, int end, int worker) {
+		rpStrategy->breed (begin, end, worker, *rpEnvironment);
+	}
+};
+
+SteadyStateStrategy::SteadyStateStrategy (SimplePopulation& popula, const StringMap& params)
+		: EAStrategy (popula)
+{
+	mTournament = getOrDefault (params, "SteadyState.tournament", String(2)).toInt ();
+	ASSERTWITH (mTournament>0, "SteadyState.tournament must be positive");
+
+	String replace = getOrDefault (params, "SteadyState.replace", "worst");
+	ASSERTWITH (replace=="worst" || replace=="tournament",
+				format ("Unknown SteadyState.replace '%s'", (CONSTR) replace));
+	mReplacement = (replace=="tournament")? REPLACE_TOURNAMENT : REPLACE_WORST;
+
+	mInserted  = 0;
+	mDiscarded = 0;
+	pthread_mutex_init (&mLock, NULL);
+}
+
+SteadyStateStrategy::~SteadyStateStrategy ()
+{
+	pthread_mutex_destroy (&mLock);
+}
+
+void SteadyStateStrategy::evolve (EAEnvironment& envr, TextOStream& out, TextOStream& log)
+{
+	FUNCTION_BEGIN;
+
+	envr.init_cycle ();
+
+	// Evaluate the individuals that do not have a fitness yet (only
+	// the initial population) and collect the statistics
+	mrPopula.evaluate (envr, out);
+	mrPopula.report (log);
+	envr.cycleReport (log, out);
+	mrPopula.periodicSnapshot ();
+
+	// Each worker breeds its offspring in a buffer of its own, which
+	// it trades with the member the offspring replaces
+	WorkerPool& pool = *mrPopula.mpWorkerPool;
+	if (mOffspring.size() == 0) {
+		mOffspring.make (pool.threads ());
+		for (int w=0; w<pool.threads (); w++)
+			mOffspring.put (new Individual (mrPopula[0]), w);
+	}
+
+	for (int w=0; w<pool.threads (); w++)
+		mrPopula.mpEvalRecords[w].reset ();
+	int inserted  = mInserted;
+	int discarded = mDiscarded;
+
+	// Self-adaptation and mutability recording collect global
+	// statistics that can not be updated from several threads.
+	// Otherwise the offspring are handed out one at a time, so that
+	// a worker that finishes early takes the next one.
+	SteadyStateTask task (*this, envr);
+	if (mrPopula.mutRate().autoAdaptation() || MutabilityRecord::record)
+		task.process (0, mrPopula.size(), 0);
+	else
+		pool.run (task, mrPopula.size(), 1);
+
+	for (int w=1; w<pool.threads (); w++)
+		mrPopula.mpEvalRecords[0].add (mrPopula.mpEvalRecords[w]);
+	envr.merge (mrPopula.mpEvalRecords[0]);
+
+	out.printf ("Steady state: %d offspring inserted, %d discarded, %f s\n",
+				mInserted-inserted, mDiscarded-discarded, pool.runTime ());
+
+	FUNCTION_END;
+}
+
+/*******************************************************************************
+ * The expensive part, the evaluation of the offspring, is done without the
+ * lock, so the workers block each other only for the short selection and
+ * insertion steps.
+ ******************************************************************************/
+void SteadyStateStrategy::breed (int begin, int end, int worker, EAEnvironment& envr)
+{
+	NHP_PROFILE_PHASE (Profiler::BREED);
+	EvaluationRecord& record = mrPopula.mpEvalRecords[worker];
+	RandomStream stream;
+	RandomScope scope (stream);
+
+	for (int i=begin; i<end; i++) {
+		stream = mrPopula.random().split (SimplePopulation::OFFSPRING_STREAM, mrPopula.getAge (), i);
+		Individual* offspring = mOffspring.getp (worker);
+
+		// The parents may be replaced by the other workers as soon
+		// as the lock is released, so they must be used within it
+		{
+			MutexLock lock (mLock);
+			const Individual& parent_a = mrPopula[selectParent ()];
+			const Individual& parent_b = mrPopula[selectParent ()];
+			offspring->recombine (parent_a, parent_b);
+		}
+
+		{
+			NHP_PROFILE_PHASE (Profiler::MUTATE);
+			offspring->pointMutate (mrPopula.mutRate());
+		}
+		{
+			NHP_PROFILE_PHASE (Profiler::INCARNATE);
+			offspring->incarnate (true);
+		}
+		record.setItem (i);
+		double fitness = offspring->evaluate (envr, record);
+
+		MutexLock lock (mLock);
+		int victim = selectVictim ();
+		if (fitness <= mrPopula[victim].getfitness ()) {
+			Individual* replaced = mrPopula.mpPopulation->cut (victim);
+			mrPopula.mpPopulation->put (mOffspring.cut (worker), victim);
+			mOffspring.put (replaced, worker);
+			mInserted++;
+		} else
+			mDiscarded++;
+	}
+}
+
+int SteadyStateStrategy::selectParent () const
+{
+	int best = rndInt (mrPopula.size ());
+	for (int t=1; t<mTournament; t++) {
+		int candidate = rndInt (mrPopula.size ());
+		if (mrPopula[candidate].getfitness () < mrPopula[best].getfitness ())
+			best = candidate;
+	}
+	return best;
+}
+
+int SteadyStateStrategy::selectVictim () const
+{
+	int worst = (mReplacement==REPLACE_WORST)? 0 : rndInt (mrPopula.size ());
+
+	if (mReplacement==REPLACE_WORST) {
+		for (int i=1; i<mrPopula.size (); i++)
+			if (mrPopula[i].getfitness () > mrPopula[worst].getfitness ())
+				worst = i;
+	} else {
+		for (int t=1; t<mTournament; t++) {
+			int candidate = rndInt (mrPopula.size ());
+			if (mrPopula[candidate].getfitness () > mrPopula[worst].getfitness ())
+				worst = candidate;
+		}
+	}
+	return worst;
+}
+
+void SteadyStateStrategy::print (TextOStream& out) {
+	out.printf ("Evolving with steady-state strategy, population %d, "
+				"tournament %d, replacing the %s\n",
+				mrPopula.size(), mTournament,
+				(mReplacement==REPLACE_WORST)? "worst" : "tournament loser");
+
+	out.printf ("Mutation coefficient=%f (binary), %f (int), %f (double rate), "
+				"%f (double variance)\n\n",
+				mrPopula.mutRate().binaryRate(),
+				mrPopula.mutRate().intRate(),
+				mrPopula.mutRate().doubleRate(),
+				mrPopula.mutRate().doubleVariance());
+}
+
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -245,11 +495,37 @@ void FitnessStats::add (double fitness) {
 	mAvgOver++;
 }
 
+void FitnessStats::add (const FitnessStats& other) {
+	if (other.mMinFitness < mMinFitness)
+		mMinFitness = other.mMinFitness;
+
+	if (other.mMaxFitness > mMaxFitness)
+		mMaxFitness = other.mMaxFitness;
+
+	mSumFitness += other.mSumFitness;
+
+	mAvgOver += other.mAvgOver;
+}
+
 void FitnessStats::print (TextOStream& out) const {
 	out.printf ("Fitness min/avg/max = %f / %f / %f\n",
 				mMinFitness, mSumFitness/mAvgOver, mMaxFitness);
 }
 
+void FitnessStats::saveState (CheckpointOStream& out) const {
+	out.putDouble (mMinFitness);
+	out.putDouble (mSumFitness);
+	out.putDouble (mMaxFitness);
+	out.putInt (mAvgOver);
+}
+
+void FitnessStats::loadState (CheckpointIStream& in) {
+	mMinFitness = in.getDouble ();
+	mSumFitness = in.getDouble ();
+	mMaxFitness = in.getDouble ();
+	mAvgOver    = in.getInt ();
+}
+
 
 
 //////////////////////////////////////////////////////////////////////////////
@@ -270,6 +546,8 @@ void FitnessStats::print (TextOStream& out) const {
 * @param params["intRate"] The mutation rate for @ref IntGene genes.
 * @param params["floatRate"] The mutation rate for @ref FloatGene genes.
 * @param params["floatVariance"] The mutation variance for @ref FloatGene genes.
+* @param params["skipSampling"] Should point mutation jump over the unmutated
+* genes with geometric skip-sampling? See @ref MutationSites. [Default:0]
 *******************************************************************************/
 Population::Population (EAEnvironment&   envir,   /**< The environment in which the population evolves in. */
 						const StringMap& params)  /**< Additional dynamic parameters as a @ref String @ref Map. */
@@ -288,6 +566,7 @@ Population::Population (EAEnvironment&   envir,   /**< The environment in which
 	mGlobalMutationRate.doubleRate (frate);
 	mGlobalMutationRate.doubleVariance (fvar);
 	mGlobalMutationRate.autoAdaptation (getOrDefault(params,"Population.autoAdapt", String(0)).toInt ());
+	mGlobalMutationRate.skipSampling (getOrDefault(params,"Population.skipSampling", String(0)).toInt ());
 	mAutoadjustGMR = false;
 }
 
@@ -0,0 +1,238 @@
+/***************************************************************************
+ *   This file is part of the NeHeP library.                               *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <magic/mexception.h>
+#include "nhp/profiler.h"
+
+/*******************************************************************************
+ * Statistics of one thread. Only the owning thread writes to its record, so
+ * no locking or atomic operations are needed when recording.
+ ******************************************************************************/
+struct ProfileRecord {
+	double	wall [Profiler::PHASES];
+	double	cpu [Profiler::PHASES];
+	long	calls [Profiler::PHASES];
+	long	counters [Profiler::COUNTERS];
+	char	padding [64];	// Keep the records of different threads in separate cache lines
+};
+
+static ProfileRecord	profileRecords [Profiler::MAX_THREADS];
+static bool				profileRecordUsed [Profiler::MAX_THREADS];
+static volatile int		profileRecordCount	= 0;	// Records ever taken
+static volatile int		profileDropped		= 0;	// Threads left without a record
+static pthread_mutex_t	profileLock			= PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t	profileKey;
+static pthread_once_t	profileKeyOnce		= PTHREAD_ONCE_INIT;
+static __thread int		threadRecord		= -1;	// -2 if the thread got no record
+
+static const char*	phaseNames []	= {"evaluate", "sort", "selectionMatrix", "breed", "select",
+									   "recombine", "mutate", "incarnate", "elites"};
+static const char*	counterNames []	= {"evaluations", "cacheHits", "mutations"};
+
+/*******************************************************************************
+ * Frees the record of an exiting thread for the threads started later, such
+ * as the island threads of a Metapopulation, which are created again for each
+ * evolve(). The statistics stay in the record and the next owner adds to them.
+ ******************************************************************************/
+static void releaseRecord (void* record)
+{
+	pthread_mutex_lock (&profileLock);
+	profileRecordUsed [(ProfileRecord*) record - profileRecords] = false;
+	pthread_mutex_unlock (&profileLock);
+}
+
+static void createProfileKey ()
+{
+	pthread_key_create (&profileKey, releaseRecord);
+}
+
+/** Returns the record of the calling thread, or NULL if there are too many threads. */
+static ProfileRecord* threadProfile ()
+{
+	if (threadRecord == -1) {
+		pthread_once (&profileKeyOnce, createProfileKey);
+
+		pthread_mutex_lock (&profileLock);
+		int r = 0;
+		while (r < Profiler::MAX_THREADS && profileRecordUsed[r])
+			r++;
+		if (r < Profiler::MAX_THREADS) {
+			profileRecordUsed[r] = true;
+			if (r >= profileRecordCount)
+				profileRecordCount = r+1;
+		} else if (profileDropped++ == 0)
+			fprintf (stderr, "Profiler: more than %d concurrent threads, the rest are not profiled\n",
+					 int (Profiler::MAX_THREADS));
+		pthread_mutex_unlock (&profileLock);
+
+		if (r == Profiler::MAX_THREADS) {
+			threadRecord = -2;
+			return NULL;
+		}
+		threadRecord = r;
+		pthread_setspecific (profileKey, &profileRecords[r]);
+	}
+	return (threadRecord >= 0)? &profileRecords [threadRecord] : (ProfileRecord*) NULL;
+}
+
+static double clockTime (clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime (clock, &ts);
+	return ts.tv_sec + ts.tv_nsec*1E-9;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//                         P r o f i l e r                                   //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+bool Profiler::enabled ()
+{
+#ifdef NHP_PROFILE
+	return true;
+#else
+	return false;
+#endif
+}
+
+void Profiler::reset ()
+{
+	memset (profileRecords, 0, sizeof (profileRecords));
+	profileDropped = 0;
+}
+
+int Profiler::threads ()
+{
+	return profileRecordCount;
+}
+
+double Profiler::wallTime (int phase, int thread)
+{
+	ASSERT (phase>=0 && phase<PHASES && thread<threads ());
+	if (thread >= 0)
+		return profileRecords[thread].wall[phase];
+
+	double sum = 0.0;
+	for (int t=0; t<threads (); t++)
+		sum += profileRecords[t].wall[phase];
+	return sum;
+}
+
+double Profiler::cpuTime (int phase, int thread)
+{
+	ASSERT (phase>=0 && phase<PHASES && thread<threads ());
+	if (thread >= 0)
+		return profileRecords[thread].cpu[phase];
+
+	double sum = 0.0;
+	for (int t=0; t<threads (); t++)
+		sum += profileRecords[t].cpu[phase];
+	return sum;
+}
+
+long Profiler::calls (int phase, int thread)
+{
+	ASSERT (phase>=0 && phase<PHASES && thread<threads ());
+	if (thread >= 0)
+		return profileRecords[thread].calls[phase];
+
+	long sum = 0;
+	for (int t=0; t<threads (); t++)
+		sum += profileRecords[t].calls[phase];
+	return sum;
+}
+
+long Profiler::counter (int counter, int thread)
+{
+	ASSERT (counter>=0 && counter<COUNTERS && thread<threads ());
+	if (thread >= 0)
+		return profileRecords[thread].counters[counter];
+
+	long sum = 0;
+	for (int t=0; t<threads (); t++)
+		sum += profileRecords[t].counters[counter];
+	return sum;
+}
+
+const char* Profiler::phaseName (int phase)
+{
+	ASSERT (phase>=0 && phase<PHASES);
+	return phaseNames [phase];
+}
+
+const char* Profiler::counterName (int counter)
+{
+	ASSERT (counter>=0 && counter<COUNTERS);
+	return counterNames [counter];
+}
+
+void Profiler::count (int counter, long n)
+{
+	if (ProfileRecord* record = threadProfile ())
+		record->counters[counter] += n;
+}
+
+void Profiler::print (TextOStream& out)
+{
+	out.printf ("%-16s %10s %12s %12s %8s\n", "phase", "calls", "wall s", "cpu s", "busiest");
+	for (int p=0; p<PHASES; p++) {
+		int busiest = 0;
+		for (int t=1; t<threads (); t++)
+			if (profileRecords[t].wall[p] > profileRecords[busiest].wall[p])
+				busiest = t;
+		out.printf ("%-16s %10ld %12.6f %12.6f %8d\n", phaseName (p),
+					calls (p), wallTime (p), cpuTime (p), busiest);
+	}
+	for (int c=0; c<COUNTERS; c++)
+		out.printf ("%-16s %10ld\n", counterName (c), counter (c));
+	if (profileDropped > 0)
+		out.printf ("%d threads were not profiled\n", int (profileDropped));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//                    P r o f i l e   S c o p e                              //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+ProfileScope::ProfileScope (int phase) : mPhase (phase)
+{
+	mWallStart = clockTime (CLOCK_MONOTONIC);
+	mCpuStart  = clockTime (CLOCK_THREAD_CPUTIME_ID);
+}
+
+ProfileScope::~ProfileScope ()
+{
+	if (ProfileRecord* record = threadProfile ()) {
+		record->cpu[mPhase]  += clockTime (CLOCK_THREAD_CPUTIME_ID) - mCpuStart;
+		record->wall[mPhase] += clockTime (CLOCK_MONOTONIC) - mWallStart;
+		record->calls[mPhase]++;
+	}
+}
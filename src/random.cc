@@ -0,0 +1,237 @@
+/***************************************************************************
+ *   This file is part of the NeHeP library.                               *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <math.h>
+#include "nhp/random.h"
+#include "nhp/vecmath.h"
+
+__thread RandomStream* RandomStream::tpCurrent = NULL;
+
+/** Returns the next output of the SplitMix64 generator. */
+static uint64_t splitmix (uint64_t& x)
+{
+	uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+void RandomStream::seed (uint64_t seed)
+{
+	uint64_t key = splitmix (seed);
+	mKey[0]   = uint32_t (key);
+	mKey[1]   = uint32_t (key >> 32);
+	mCounter  = 0;
+	mUsed     = 2;
+	mHasSpare = false;
+}
+
+RandomStream RandomStream::split (uint64_t a, uint64_t b, uint64_t c) const
+{
+	// Chain the numbers through the mixer, so that for example
+	// (1,2) and (2,1) give different streams
+	uint64_t x = (uint64_t (mKey[1]) << 32) | mKey[0];
+	x = splitmix (x) ^ a;
+	x = splitmix (x) ^ b;
+	x = splitmix (x) ^ c;
+	return RandomStream (x);
+}
+
+void RandomStream::saveState (CheckpointOStream& out) const
+{
+	out.putWord ((uint64_t (mKey[1]) << 32) | mKey[0]);
+	out.putWord (mCounter);
+	out.putWord (mBlock[0]);
+	out.putWord (mBlock[1]);
+	out.putInt (mUsed);
+	out.putDouble (mSpare);
+	out.putBool (mHasSpare);
+}
+
+void RandomStream::loadState (CheckpointIStream& in)
+{
+	uint64_t key = in.getWord ();
+	mKey[0]   = uint32_t (key);
+	mKey[1]   = uint32_t (key >> 32);
+	mCounter  = in.getWord ();
+	mBlock[0] = in.getWord ();
+	mBlock[1] = in.getWord ();
+	mUsed     = in.getInt ();
+	mSpare    = in.getDouble ();
+	mHasSpare = in.getBool ();
+}
+
+/*******************************************************************************
+ * Philox4x32-10: ten rounds of multiplications and key additions over the
+ * 128-bit counter. The upper half of the counter is left zero, which still
+ * gives 2^64 blocks per stream.
+ ******************************************************************************/
+static inline void philox (const uint32_t key[2], uint64_t counter, uint64_t block[2])
+{
+	uint32_t c0 = uint32_t (counter), c1 = uint32_t (counter >> 32), c2 = 0, c3 = 0;
+	uint32_t k0 = key[0], k1 = key[1];
+
+	for (int round=0; round<10; round++) {
+		uint64_t p0 = uint64_t (0xD2511F53u) * c0;
+		uint64_t p1 = uint64_t (0xCD9E8D57u) * c2;
+		uint32_t n0 = uint32_t (p1 >> 32) ^ c1 ^ k0;
+		uint32_t n2 = uint32_t (p0 >> 32) ^ c3 ^ k1;
+		c1 = uint32_t (p1);
+		c3 = uint32_t (p0);
+		c0 = n0;
+		c2 = n2;
+		k0 += 0x9E3779B9u;
+		k1 += 0xBB67AE85u;
+	}
+
+	block[0] = (uint64_t (c1) << 32) | c0;
+	block[1] = (uint64_t (c3) << 32) | c2;
+}
+
+void RandomStream::refill ()
+{
+	philox (mKey, mCounter++, mBlock);
+	mUsed = 0;
+}
+
+/*******************************************************************************
+ * Gives the same numbers as calling uniform() for each element. The rest of
+ * the current block is used first, and the whole blocks in the middle are
+ * then generated straight to the output, one block per counter, without
+ * going through the buffer of the stream.
+ ******************************************************************************/
+void RandomStream::fillUniform (double* out, int n)
+{
+	const double scale = 1.0/9007199254740992.0;
+	int i = 0;
+	while (i < n && mUsed < 2)
+		out[i++] = (mBlock[mUsed++] >> 11) * scale;
+
+	uint64_t block[2];
+	for (; i+1 < n; i += 2) {
+		philox (mKey, mCounter++, block);
+		out[i]   = (block[0] >> 11) * scale;
+		out[i+1] = (block[1] >> 11) * scale;
+	}
+
+	if (i < n)
+		out[i] = uniform ();
+}
+
+/*******************************************************************************
+ * Polar Box-Muller method. Each round gives two values, the second of which
+ * is kept for the next call.
+ ******************************************************************************/
+double RandomStream::gaussian (double sd)
+{
+	if (mHasSpare) {
+		mHasSpare = false;
+		return mSpare*sd;
+	}
+
+	double u, v, s;
+	do {
+		u = 2.0*uniform () - 1.0;
+		v = 2.0*uniform () - 1.0;
+		s = u*u + v*v;
+	} while (s >= 1.0 || s == 0.0);
+
+	double f = sqrt (-2.0*log (s)/s);
+	mSpare    = v*f;
+	mHasSpare = true;
+	return u*f*sd;
+}
+
+/*******************************************************************************
+ * Basic Box-Muller method in blocks. The uniform numbers of a block are
+ * drawn first, and the transformation is then a loop of the functions in
+ * vecmath.h. The loop must not call sqrt() or log(), since their errno
+ * branches keep the compiler from vectorizing it.
+ ******************************************************************************/
+void RandomStream::fillGaussian (double* out, int n, double sd)
+{
+	const int block = 128;
+	double u [block];
+
+	int i = 0;
+	if (mHasSpare && n>0) {
+		out[i++] = mSpare*sd;
+		mHasSpare = false;
+	}
+
+	while (i+1 < n) {
+		const int pairs = ((n-i)/2 < block/2)? (n-i)/2 : block/2;
+		fillUniform (u, 2*pairs);
+
+		double* o = out+i;
+		for (int j=0; j<pairs; j++) {
+			// 1-u is in (0,1], so the logarithm is finite
+			double r = vecSqrt (-2.0*vecLog (1.0-u[2*j])) * sd;
+			double sine, cosine;
+			vecSinCos (6.283185307179586*u[2*j+1] - 3.141592653589793, sine, cosine);
+			o[2*j]   = r*cosine;
+			o[2*j+1] = r*sine;
+		}
+		i += 2*pairs;
+	}
+
+	if (i < n)
+		out[i] = gaussian (sd);
+}
+
+/*******************************************************************************
+ * Draws a batch of normal numbers and redraws, again as a batch, those that
+ * fell outside their range. This gives exactly the distribution of drawing
+ * each number until it hits its range, but in a few passes over the arrays.
+ ******************************************************************************/
+void RandomStream::fillTruncatedGaussian (double* out, const double* lo, const double* hi,
+										  int n, double sd)
+{
+	const int block = 128;
+	int    pending [block];
+	double draw [block];
+
+	for (int start=0; start<n; start+=block) {
+		const int m = (n-start < block)? n-start : block;
+		int left = 0;
+		for (int j=0; j<m; j++)
+			if (lo[start+j] < hi[start+j])
+				pending[left++] = start+j;
+			else
+				out[start+j] = lo[start+j]; // Only one possible value
+
+		while (left > 0) {
+			fillGaussian (draw, left, sd);
+			int still = 0;
+			for (int j=0; j<left; j++) {
+				const int k = pending[j];
+				if (draw[j] >= lo[k] && draw[j] <= hi[k])
+					out[k] = draw[j];
+				else
+					pending[still++] = k;
+			}
+			left = still;
+		}
+	}
+}
@@ -28,13 +28,38 @@
 #include "nhp/selection.h"
 #include "nhp/genes.h"
 #include "nhp/mutator.h"
+#include "nhp/random.h"
+#include "nhp/profiler.h"
 #include <magic/mmath.h>
 
-SelectionMatrix::SelectionMatrix (const SelectionSituation& situation) {
+SelectionMatrix::SelectionMatrix (const SelectionSituation& situation, int sampler)
+{
+	ASSERTWITH (sampler==SCAN || sampler==ALIAS || sampler==RANKS,
+				format ("Unknown sampler %d", sampler));
+	mSampler = sampler;
+
+	if (mSampler == RANKS) {
+		if (calculateRankWeights (situation)) {
+			mRankTable.make (mRankWeights);
+			return;
+		}
+		mSampler = ALIAS;
+	}
+
 	calculateMatrix (situation);
+
+	// Build the alias table over all the cells of the matrix
+	if (mSampler == ALIAS) {
+		PackArray<double> cells (mSelection.rows*mSelection.cols);
+		for (int i=0, k=0; i<mSelection.rows; i++)
+			for (int j=0; j<mSelection.cols; j++, k++)
+				cells[k] = mSelection.get(i,j);
+		mPairTable.make (cells);
+	}
 }
 
 void SelectionMatrix::calculateMatrix (const SelectionSituation& situation) {
+	NHP_PROFILE_PHASE (Profiler::SELECTION_MATRIX);
 
 	//
 	// Compute selection matrices for each method
@@ -67,8 +92,50 @@ void SelectionMatrix::calculateMatrix (const SelectionSituation& situation) {
 	mSelection.multiplyToSum (1.0);
 }
 
+/*******************************************************************************
+ * Calculates the weight of each rank, if all the individuals select with the
+ * same non-pairwise selector. The weights of all the individuals are then
+ * those of the fittest one.
+ ******************************************************************************/
+bool SelectionMatrix::calculateRankWeights (const SelectionSituation& situation)
+{
+	int popSize = situation.population().size();
+	for (int i=0; i<popSize; i++)
+		if (situation.getOrdered(i).selector().isPairwise (situation))
+			return false;
+
+	const Selector& selector = situation.getOrdered(0).selector();
+	mRankWeights.make (popSize);
+	mRankWeightSum = 0.0;
+	for (int j=0; j<popSize; j++)
+		mRankWeightSum += (mRankWeights[j] = selector.rankWeight (situation, j));
+
+	return true;
+}
+
+double SelectionMatrix::pairProbability (int a, int b) const
+{
+	if (mSampler == RANKS)
+		return mRankWeights[a]*mRankWeights[b] / (mRankWeightSum*mRankWeightSum);
+
+	return mSelection.get(a,b);
+}
+
 void SelectionMatrix::selectRandomPair (int& a, int& b) const {
-	double rn=frnd();
+	if (mSampler == RANKS) {
+		a = mRankTable.draw ();
+		b = mRankTable.draw ();
+		return;
+	}
+
+	if (mSampler == ALIAS) {
+		int cell = mPairTable.draw ();
+		a = cell / mSelection.cols;
+		b = cell % mSelection.cols;
+		return;
+	}
+
+	double rn=rndUniform();
 	double pos=0.0;
 	for (int i=0; i<mSelection.rows; i++) {
 		for (int j=0; j<mSelection.cols; j++) {
@@ -95,6 +162,7 @@ void SelectionMatrix::selectRandomPair (int& a, int& b) const {
 
 SelectionSituation::SelectionSituation (const SimplePopulation& pop)
 		: mrPop (pop), mOrdPop (pop.getPopArray()) {
+	NHP_PROFILE_PHASE (Profiler::SORT);
 	mOrdPop.quicksort ();
 }
 
@@ -268,7 +336,7 @@ double Selector::select (const SelectionSituation& situation, int i, int j) cons
 		// Choose one selection method using the propabilities for
 		// different methods
 		//
-		double p=frnd ();
+		double p=rndUniform ();
 		for (int m=0; m<Selector::number_of_methods; p-=mSelMethodW[m++])
 			if (p <= mSelMethodW[m])
 				return selectWithMethod (situation, m, i, j);
@@ -276,6 +344,23 @@ double Selector::select (const SelectionSituation& situation, int i, int j) cons
 	}
 }
 
+bool Selector::isPairwise (const SelectionSituation& situation) const
+{
+	const SimplePopulation& pop = situation.population();
+	return mAdaptiveWeights || !pop.mUseGlobalMu || !pop.mUseGlobalQ || !pop.mUseGlobalEtaPlus;
+}
+
+double Selector::rankWeight (const SelectionSituation& situation, int j) const
+{
+	// The affinity does not depend on the selecting individual, so
+	// any index will do for it
+	double weight = 0.0;
+	for (int m=0; m<Selector::number_of_methods; m++)
+		if (mSelMethodW[m] > 0.0)
+			weight += mSelMethodW[m] * selectWithMethod (situation, m, 0, j);
+	return weight;
+}
+
 double Selector::selectWithMethod (const SelectionSituation& situation, int sm, int i, int j) const {
 	ASSERTWITH (sm>=0 && sm<=3, "Selection method index out of range");
 
@@ -22,13 +22,29 @@
  *                                                                         *
  ***************************************************************************/
 
+#include <string.h>
 #include <magic/mpararr.h>
 #include <magic/mdatastream.h>
 #include "nhp/simplepopula.h"
 #include "nhp/gaenvrnmt.h"
 #include "nhp/mutrecord.h"
+#include "nhp/profiler.h"
 
 
+/*******************************************************************************
+ * Replaces the first "%d" in the name of a snapshot file with the generation.
+ * The name is not used as a format, so any other '%' characters in it are
+ * kept as they are.
+ ******************************************************************************/
+static String snapshotName (const String& pattern, int generation)
+{
+	const char* text = (CONSTR) pattern;
+	const char* mark = strstr (text, "%d");
+	if (!mark)
+		return pattern;
+	return format ("%.*s%d%s", int (mark-text), text, generation, mark+2);
+}
+
 SimplePopulation::SimplePopulation (EAEnvironment& envir, const StringMap& params)
 		: Population (envir, params)
 {
@@ -63,6 +79,12 @@ SimplePopulation::SimplePopulation (EAEnvironment& envir, const StringMap& param
 	mUseGlobalQ = !aq;
 	mUseGlobalEtaPlus = !aep;
 
+	String sampler = getOrDefault (params, "Selection.sampler", "ranks");
+	ASSERTWITH (sampler=="ranks" || sampler=="alias" || sampler=="scan",
+				format ("Unknown Selection.sampler '%s'", (CONSTR) sampler));
+	mSelectionSampler = (sampler=="scan")?  SelectionMatrix::SCAN :
+						(sampler=="alias")? SelectionMatrix::ALIAS : SelectionMatrix::RANKS;
+
 	/**************************************************************************/
 	// Create a template for an Individual
 
@@ -75,6 +97,10 @@ SimplePopulation::SimplePopulation (EAEnvironment& envir, const StringMap& param
 	// Set individual-based autoadaptive mutation
 	templ.selfadjust (mGlobalMutationRate.autoAdaptation());
 
+	// Let the environment find the genes it needs
+	rpEnvironment->resolveGenes (templ);
+	rpEnvironment->setFitnessCache (getOrDefault (params, "FitnessCache.size", String(0)).toInt ());
+
 	/**************************************************************************/
 	// Create the population from the template individual
 
@@ -82,8 +108,20 @@ SimplePopulation::SimplePopulation (EAEnvironment& envir, const StringMap& param
 	mpPopulation = new Array<Individual> ();
 	mpPopulation->make (popSize); // 20021125: This was popSize-1 for unknown reason
 
-	// Create individuals
+	// Seed the root stream before anything random is done. Without
+	// a given seed, take one from the global generator, so that
+	// seeding it still makes the runs repeatable.
+	mSeed = (unsigned int) getOrDefault (params, "SimplePopulation.seed", String(0)).toInt ();
+	if (mSeed)
+		mRandom.seed (mSeed);
+	else
+		mRandom.seed ((uint64_t (rnd (65536))<<32) | (uint64_t (rnd (65536))<<16) | uint64_t (rnd (65536)));
+
+	// Create individuals, each initialized from a stream of its own
+	RandomStream stream;
+	RandomScope scope (stream);
 	for (int i=0; i<mpPopulation->size(); i++) {
+		stream = mRandom.split (INIT_STREAM, i);
 		mpPopulation->put (new Individual (templ), i);
 		(*mpPopulation) [i].setSelector(mSelectionParams);
 		(*mpPopulation) [i].init ();
@@ -91,7 +129,38 @@ SimplePopulation::SimplePopulation (EAEnvironment& envir, const StringMap& param
 	}
 
 	// Set evolution strategy
-	mpStrategy = new EAStrategy (*this);
+	String strategy = getOrDefault (params, "SimplePopulation.strategy", "generational");
+	ASSERTWITH (strategy=="generational" || strategy=="steadystate",
+				format ("Unknown SimplePopulation.strategy '%s'", (CONSTR) strategy));
+	if (strategy=="steadystate")
+		mpStrategy = new SteadyStateStrategy (*this, params);
+	else
+		mpStrategy = new EAStrategy (*this);
+
+	// Create the evaluation threads. They live as long as the population.
+	String scheduler = getOrDefault (params, "SimplePopulation.scheduler", "stealing");
+	ASSERTWITH (scheduler=="stealing" || scheduler=="chunked",
+				format ("Unknown SimplePopulation.scheduler '%s'", (CONSTR) scheduler));
+	mpWorkerPool = new WorkerPool (getOrDefault (params, "SimplePopulation.threads", String(0)).toInt (),
+								   (scheduler=="chunked")? WorkerPool::CHUNKED : WorkerPool::STEALING);
+	mChunkSize   = getOrDefault (params, "SimplePopulation.chunkSize", String(0)).toInt ();
+	mpEvalRecords = new EvaluationRecord [mpWorkerPool->threads ()];
+
+	mCheckpointFile     = getOrDefault (params, "Checkpoint.file", "");
+	mCheckpointInterval = getOrDefault (params, "Checkpoint.interval", String(10)).toInt ();
+	ASSERTWITH (mCheckpointInterval>0, "Checkpoint.interval must be positive");
+	mpCheckpointWriter  = isempty (mCheckpointFile)? NULL : new CheckpointWriter ();
+
+	mSnapshotFile       = getOrDefault (params, "Snapshot.file", "");
+	mSnapshotInterval   = getOrDefault (params, "Snapshot.interval", String(10)).toInt ();
+	ASSERTWITH (mSnapshotInterval>0, "Snapshot.interval must be positive");
+	mpSnapshotWriter    = isempty (mSnapshotFile)? NULL : new CheckpointWriter (false);
+
+	mProfileReport      = getOrDefault (params, "Profiler.report", String(0)).toInt ();
+	for (int p=0; p<Profiler::PHASES; p++)
+		mPhaseMark[p] = 0.0;
+	for (int c=0; c<Profiler::COUNTERS; c++)
+		mCounterMark[c] = 0;
 
 	failtrace_begin;
 	params.failByThrowOnce ();
@@ -104,12 +173,19 @@ SimplePopulation::SimplePopulation (EAEnvironment& envir, const StringMap& param
 	minsimilarity = getOrDefault (params, "EAStrategy.minSimilarity", String(0.1)).toDouble ();
 	mAge = 0;
 
-	// Set logging
+	// Set logging. The log file is opened only in evolve().
+	mpLogger = new EvolutionLogger (params);
 	mEvolog.autoFlush ();
 	mOuts.autoFlush ();
 }
 
 SimplePopulation::~SimplePopulation () {
+	// Finishes writing the last checkpoint, snapshot and the log
+	delete mpCheckpointWriter;
+	delete mpSnapshotWriter;
+	delete mpLogger;
+	delete [] mpEvalRecords;
+	delete mpWorkerPool;
 	delete mpStrategy;
 	delete mpPopulation;
 }
@@ -121,17 +197,15 @@ double SimplePopulation::evolve (int gens, const char* logfile, double target_fi
 {
 	FUNCTION_BEGIN;
 	
-	// Open logfile
-	FILE* save = NULL;
+	// Open logfile. The logger buffers the log, so the stream should
+	// not flush every line.
 	if (logfile) {
-		save = fopen (logfile, "w");
-		ASSERTWITH (save, format ("Log file '%s' couldn't be opened", logfile));
-
-		fprintf (save, "Generation, min_fitness, avg_fitness, max_fitness\n");
-		fflush (save);
+		mpLogger->open (logfile);
+		const char* header = "Generation, min_fitness, avg_fitness, max_fitness\n";
+		mpLogger->text (header, strlen (header));
+		mEvolog.setDevice (new File (mpLogger->textStream ()));
+		mEvolog.autoFlush (false);
 	}
-	if (save)
-		mEvolog.setDevice (new File (save));
 
 	// mOuts.setFlag (EAStrategy::TRACE_RECOMBINATION);
 	// mOuts.setFlag (EAStrategy::TRACE_MUTATION);
@@ -145,90 +219,112 @@ double SimplePopulation::evolve (int gens, const char* logfile, double target_fi
 		// Evolve for one generation
 		failtrace (mpStrategy->evolve (*rpEnvironment, mOuts, mEvolog));
 
+		// Serialize the state here, but leave the writing to the
+		// background thread
+		if (mpCheckpointWriter && mAge % mCheckpointInterval == 0) {
+			mCheckpointBuffer.clear ();
+			saveState (mCheckpointBuffer);
+			mpCheckpointWriter->submit (mCheckpointFile, mCheckpointBuffer);
+		}
+
 		// Check the termination criteria
 		if (target_fitn != -1 && rpEnvironment->bestfitn < target_fitn)
 			break;
 		
 		mEvolog << "\n";
+		if (mpLogger->isOpen ())
+			mpLogger->endGeneration ();
 	}
 	
-	if (save)
-		fclose (save);
+	// The log stays open for any later output, but everything logged so
+	// far is written before returning
+	if (mpLogger->isOpen ()) {
+		mEvolog.flush ();
+		mpLogger->flush ();
+	}
 
 	FUNCTION_END;
 	return mFitnessStats.minFitness();
 }
 
 /*******************************************************************************
- * Worker thread to evaluate individuals in a population.
+ * Job for evaluating a range of individuals in the worker pool.
  ******************************************************************************/
-class EvaluationWorker : public Thread {
+class EvaluationTask : public PoolTask {
 	SimplePopulation*	rpPopula;
-	int					mIndividual;
 	EAEnvironment*		rpEnvironment;
-	TextOStream*		rpOut;
 	
   public:
-	EvaluationWorker();
-	EvaluationWorker(SimplePopulation& popula, int individual, EAEnvironment& environment, TextOStream& out);
-	virtual void*		execute		();
-};
-
+					EvaluationTask	(SimplePopulation& popula, EAEnvironment& environment)
+							: rpPopula (&popula), rpEnvironment (&environment) {}
 
-EvaluationWorker::EvaluationWorker()
-		: rpPopula(NULL), mIndividual(0), rpEnvironment(NULL), rpOut(NULL)
-{
-	fprintf (stderr, "EvaluationWorker::EvaluationWorker() called.\n");
-	MUST_OVERLOAD;
-}
+	virtual void	process			(int begin, int end, int worker) {
+		rpPopula->evaluate (begin, end, *rpEnvironment, rpPopula->mpEvalRecords[worker]);
+	}
+};
 
 /*******************************************************************************
- * Initialize evaluation worker by storing callback data.
+ * Evaluates a chunk of individuals.
+ *
+ * The results are collected in the record of the calling worker, which no
+ * other thread touches during the evaluation, so no locking is needed.
+ *
+ * If the environment can evaluate blocks of individuals, the individuals
+ * that need evaluating are measured in blocks, and the measurements are
+ * then recorded one by one in order, so that the result is the same as
+ * with evaluating them one at a time.
  ******************************************************************************/
-EvaluationWorker::EvaluationWorker(
-	SimplePopulation& popula,
-	int               individual,
-	EAEnvironment&    environment,
-	TextOStream&      out)
-		: rpPopula(&popula), mIndividual(individual), rpEnvironment(&environment),
-		  rpOut(&out)
+void SimplePopulation::evaluate (int begin, int end, EAEnvironment& environment,
+								 EvaluationRecord& record)
 {
-	// out.printf("Created worker %02d.\n", individual);
-}
+	FUNCTION_BEGIN;
 
-/*******************************************************************************
- * Evaluate the individual.
- ******************************************************************************/
-void* EvaluationWorker::execute ()
-{
-	// fprintf (stderr, "EvaluationWorker::execute () called.\n");
-	// rpOut->printf("Evaluating %02d...\n", mIndividual);
-	// rpOut->flush();
-	rpPopula->evaluate(mIndividual, *rpEnvironment, *rpOut);
-	return NULL;
-}
+	// Each individual has its own stream, for example for the
+	// artificial noise
+	RandomStream stream;
+	RandomScope scope (stream);
+
+	// Averaging over several evaluations is only done one at a time
+	int width = (environment.evals () == 1)? environment.batchWidth () : 0;
+	if (width <= 0) {
+		for (int i=begin; i<end; i++) {
+			stream = mRandom.split (EVALUATION_STREAM, mAge, i);
+			record.setItem (i);
+			(*this) [i].evaluate (environment, record);
+		}
+
+		FUNCTION_END;
+		return;
+	}
+
+	PackArray<const Individual*> block (width);
+	PackArray<int> blockIndex (width);
+	PackArray<double> fitness (width);
+	PackArray<bool> evaluated (width);
+	for (int first=begin; first<end; ) {
+		// Collect a block of individuals that have not been evaluated
+		int n = 0, last = first;
+		for (; last<end && n<width; last++)
+			if ((*this)[last].averaged_over () < 1) {
+				block[n] = &(*this)[last];
+				blockIndex[n++] = last;
+			}
+
+		if (n > 0)
+			environment.measureBatch (block.getData (), n, fitness.getData (), evaluated.getData ());
+
+		for (int i=first, k=0; i<last; i++) {
+			stream = mRandom.split (EVALUATION_STREAM, mAge, i);
+			record.setItem (i);
+			if (k<n && blockIndex[k]==i) {
+				(*this) [i].evaluate (environment, record, fitness[k], evaluated[k]);
+				k++;
+			} else
+				(*this) [i].evaluate (environment, record);
+		}
+		first = last;
+	}
 
-void SimplePopulation::evaluate (int i, EAEnvironment& environment, TextOStream& out)
-{
-	FUNCTION_BEGIN;
-		
-	double fitness =  (*this) [i].evaluate (environment);
-
-	mThreadLock.lock();
-	mFitnessStats.add (fitness);
-
-#if 0
-	out.printf ("Indv%3d: ", i);
-	failtrace ((*this) [i].print (out));
-	out.printf ("", fitness);
-	if ((*this)[i].averaged_over ()>1)
-		out.printf (" (%d evls)", (*this)[i].averaged_over ());
-	if ((*this)[i].getkings())
-		out.printf (", kings=%3d\n", (*this)[i].getkings());
-	out << "\n";
-#endif
-	
-	mThreadLock.unlock();
 	FUNCTION_END;
 }
 
@@ -238,27 +334,31 @@ void SimplePopulation::evaluate (int i, EAEnvironment& environment, TextOStream&
 void SimplePopulation::evaluate (EAEnvironment& environment, TextOStream& out)
 {
 	FUNCTION_BEGIN;
+	NHP_PROFILE_PHASE (Profiler::EVALUATE);
 
-	mFitnessStats.reset ();
+	for (int w=0; w<mpWorkerPool->threads (); w++)
+		mpEvalRecords[w].reset ();
 
-	// Evaluate individuals
-	// @TODO Evaluate individuals in worker threads
-	Array<EvaluationWorker> workers(size());
-	for (int i=0; i<size(); i++) {
-		EvaluationWorker* worker = new EvaluationWorker(*this, i, environment, out);
-		workers.put(worker, i);
-		// out.printf("Starting thread %02d\n", i);
-		workers[i].start();
-	}
+	// Evaluate individuals in the worker threads
+	EvaluationTask task (*this, environment);
+	mpWorkerPool->run (task, size(), mChunkSize);
 
-	// Wait for threads to end
-	for (int i=0; i<size(); i++) {
-		// out.printf("Waiting for thread %02d...\n", i);
-		workers[i].join();
-	}
+	// Combine the results of the workers. The statistics are
+	// collected here in the order of the individuals, so that they
+	// do not depend on how the work was divided between the threads.
+	for (int w=1; w<mpWorkerPool->threads (); w++)
+		mpEvalRecords[0].add (mpEvalRecords[w]);
+	environment.merge (mpEvalRecords[0]);
+
+	mFitnessStats.reset ();
+	for (int i=0; i<size(); i++)
+		mFitnessStats.add ((*this) [i].getfitness ());
 
 	out.printf ("SimplePopulation report gen %d: ", mAge);
 	mFitnessStats.print (out);
+	out.printf ("Evaluation took %f s, workers idle %f s (%d threads)\n",
+				mpWorkerPool->runTime (), mpWorkerPool->idleTime (),
+				mpWorkerPool->threads ());
 
 	if (mAutoadjustGMR) {
 		// Something here
@@ -275,6 +375,136 @@ void SimplePopulation::resetFitnesses ()
 	}
 }
 
+void SimplePopulation::replace (int i, Individual* individual)
+{
+	ASSERTWITH (i>=0 && i<size(), format ("Individual index %d out of range", i));
+	ASSERT (individual);
+
+	mpPopulation->put (individual, i);
+	individual->setSelector (mSelectionParams);
+	individual->incarnate (true);
+}
+
+/*******************************************************************************
+ * Layout of a checkpoint, in the byte order of the machine:
+ *
+ *   "NHPCKPT" and a version byte, the signature of the genome (2 words),
+ *   size, age, seed, mutation rates, fitness statistics, root random
+ *   stream, environment, and the individuals.
+ *
+ * writeCheckpointFile() adds a checksum after these.
+ ******************************************************************************/
+static const char	checkpointMagic[8]	= {'N','H','P','C','K','P','T',1};
+
+void SimplePopulation::saveState (CheckpointOStream& out) const
+{
+	GenomeHash signature;
+	(*this)[0].signature (signature);
+
+	out.put (checkpointMagic, sizeof (checkpointMagic));
+	out.putWord (signature.low ());
+	out.putWord (signature.high ());
+	out.putInt (size());
+	out.putInt (mAge);
+	out.putWord (mSeed);
+	mGlobalMutationRate.saveState (out);
+	mFitnessStats.saveState (out);
+	mRandom.saveState (out);
+	rpEnvironment->saveState (out);
+
+	for (int i=0; i<size(); i++)
+		(*this)[i].saveState (out);
+}
+
+void SimplePopulation::checkpoint (const String& file) const
+{
+	CheckpointOStream data;
+	saveState (data);
+	writeCheckpointFile (file, data);
+}
+
+void SimplePopulation::restore (const String& file)
+{
+	FUNCTION_BEGIN;
+
+	CheckpointOStream data;
+	readCheckpointFile (file, data);
+	CheckpointIStream in (data.data (), data.size ());
+
+	char magic [sizeof (checkpointMagic)];
+	in.get (magic, sizeof (magic));
+	if (memcmp (magic, checkpointMagic, sizeof (magic)))
+		throw checkpoint_error (format ("'%s' is not a population checkpoint", (CONSTR) file));
+
+	GenomeHash signature;
+	(*this)[0].signature (signature);
+	uint64_t low  = in.getWord ();
+	uint64_t high = in.getWord ();
+	if (low != signature.low () || high != signature.high ())
+		throw checkpoint_error (format ("Checkpoint '%s' was written by a population with a different genome",
+										(CONSTR) file));
+
+	int popSize = in.getInt ();
+	if (popSize != size())
+		throw checkpoint_error (format ("Checkpoint '%s' has %d individuals instead of %d",
+										(CONSTR) file, popSize, size()));
+
+	mAge  = in.getInt ();
+	mSeed = (unsigned int) in.getWord ();
+	mGlobalMutationRate.loadState (in);
+	mFitnessStats.loadState (in);
+	mRandom.loadState (in);
+	rpEnvironment->loadState (in);
+
+	for (int i=0; i<size(); i++)
+		(*this)[i].loadState (in);
+
+	if (in.remaining () != 0)
+		throw checkpoint_error (format ("Checkpoint '%s' has extra data", (CONSTR) file));
+
+	FUNCTION_END;
+}
+
+void SimplePopulation::snapshot (const String& file) const
+{
+	SnapshotWriter writer (file, (*this)[0], size(), mAge);
+	for (int i=0; i<size(); i++)
+		writer.add ((*this)[i]);
+	writer.close ();
+}
+
+/*******************************************************************************
+ * Called by the strategy after the generation has been evaluated and
+ * reported, before it is replaced with the offspring, so that the snapshot
+ * has the fitnesses of the genomes in it. The snapshot is built in memory
+ * and written in the background. Unlike checkpoints, snapshots are not
+ * dropped if the writer falls behind, so a new one waits for the previous.
+ ******************************************************************************/
+void SimplePopulation::periodicSnapshot ()
+{
+	if (!mpSnapshotWriter || mAge % mSnapshotInterval != 0)
+		return;
+
+	String file = snapshotName (mSnapshotFile, mAge);
+	mpSnapshotWriter->flush ();
+	mSnapshotBuffer.clear ();
+	SnapshotWriter writer (mSnapshotBuffer, file, (*this)[0], size(), mAge);
+	for (int i=0; i<size(); i++)
+		writer.add ((*this)[i]);
+	writer.close ();
+	mpSnapshotWriter->submit (file, mSnapshotBuffer);
+}
+
+void SimplePopulation::warmStart (const SnapshotReader& snapshot)
+{
+	if (!snapshot.matches ((*this)[0]))
+		throw checkpoint_error ("Snapshot was written by a population with a different genome");
+
+	int n = (snapshot.individuals () < size())? snapshot.individuals () : size();
+	for (int i=0; i<n; i++)
+		snapshot.load (i, (*this)[i]);
+}
+
 void SimplePopulation::print (TextOStream& out) const {
 	FUNCTION_BEGIN;
 	
@@ -293,21 +523,57 @@ void SimplePopulation::print (TextOStream& out) const {
 
 void SimplePopulation::report (TextOStream& log) const
 {
-	log.printf ("%d %.30f %.30f %.30f ", mAge,
-				mFitnessStats.minFitness(), mFitnessStats.avgFitness(),
-				mFitnessStats.maxFitness());
-	if (MutabilityRecord::record)
-		log.printf ("%f %f %f %f %f %f %f %.30f %f",
-					MutabilityRecord::boolMin(),
-					MutabilityRecord::boolAvg(),
-					MutabilityRecord::boolMax(),
-					MutabilityRecord::floatMin(),
-					MutabilityRecord::floatAvg(),
-					MutabilityRecord::floatMax(),
-					MutabilityRecord::floatVarMin(),
-					MutabilityRecord::floatVarAvg(),
-					MutabilityRecord::floatVarMax());
-	log.flush ();
+	if (&log == &mEvolog && mpLogger->isOpen ()) {
+		double values [12] = {mFitnessStats.minFitness(), mFitnessStats.avgFitness(),
+							  mFitnessStats.maxFitness()};
+		int n = 3;
+		if (MutabilityRecord::record) {
+			values[3]  = MutabilityRecord::boolMin();
+			values[4]  = MutabilityRecord::boolAvg();
+			values[5]  = MutabilityRecord::boolMax();
+			values[6]  = MutabilityRecord::floatMin();
+			values[7]  = MutabilityRecord::floatAvg();
+			values[8]  = MutabilityRecord::floatMax();
+			values[9]  = MutabilityRecord::floatVarMin();
+			values[10] = MutabilityRecord::floatVarAvg();
+			values[11] = MutabilityRecord::floatVarMax();
+			n = 12;
+		}
+
+		// Pass the text written so far to the logger before the report
+		log.flush ();
+		mpLogger->report (mAge, values, n);
+	} else {
+		log.printf ("%d %.30f %.30f %.30f ", mAge,
+					mFitnessStats.minFitness(), mFitnessStats.avgFitness(),
+					mFitnessStats.maxFitness());
+		if (MutabilityRecord::record)
+			log.printf ("%f %f %f %f %f %f %f %.30f %f",
+						MutabilityRecord::boolMin(),
+						MutabilityRecord::boolAvg(),
+						MutabilityRecord::boolMax(),
+						MutabilityRecord::floatMin(),
+						MutabilityRecord::floatAvg(),
+						MutabilityRecord::floatMax(),
+						MutabilityRecord::floatVarMin(),
+						MutabilityRecord::floatVarAvg(),
+						MutabilityRecord::floatVarMax());
+	}
+
+	// The phase times in milliseconds and the counters since the
+	// previous report
+	if (mProfileReport && Profiler::enabled ()) {
+		for (int p=0; p<Profiler::PHASES; p++) {
+			double wall = Profiler::wallTime (p);
+			log.printf (" %.3f", (wall-mPhaseMark[p])*1000.0);
+			mPhaseMark[p] = wall;
+		}
+		for (int c=0; c<Profiler::COUNTERS; c++) {
+			long count = Profiler::counter (c);
+			log.printf (" %ld", count-mCounterMark[c]);
+			mCounterMark[c] = count;
+		}
+	}
 }
 
 void SimplePopulation::check () const {
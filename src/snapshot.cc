@@ -0,0 +1,526 @@
+/***************************************************************************
+ *   This file is part of the NeHeP library.                               *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "nhp/snapshot.h"
+#include "nhp/individual.h"
+#include "nhp/genes.h"
+
+/*******************************************************************************
+ * Layout of a snapshot file:
+ *
+ *   SnapshotHeader
+ *   SnapshotGene [genes]            Directory of the genes, depth-first
+ *   char [namesSize]                Zero-terminated names of the genes, padded
+ *                                   to 8 bytes
+ *   double [individuals]            Fitness column
+ *   char [individuals][stride]      Individual::saveState() of each
+ *
+ * All sections start at a multiple of 8 bytes, so the fitness column can be
+ * used in place.
+ ******************************************************************************/
+static const char	snapshotMagic[8]	= {'N','H','P','S','N','A','P',1};
+
+struct SnapshotHeader {
+	char		magic [8];
+	uint64_t	signatureLow;	// Signature of the genome structure
+	uint64_t	signatureHigh;
+	uint64_t	individuals;
+	uint64_t	generation;
+	uint64_t	recordSize;		// Bytes of the serialized individual
+	uint64_t	stride;			// Bytes between the records
+	uint64_t	genes;			// Entries in the directory
+	uint64_t	namesSize;		// Padded size of the name table
+	uint64_t	fitnessOffset;
+	uint64_t	recordsOffset;
+	uint64_t	fileSize;
+	uint64_t	reserved [4];
+};
+
+struct SnapshotGene {
+	uint64_t	offset;			// Position of the gene within the record
+	int32_t		kind;			// SnapshotReader::kinds
+	int32_t		count;			// Number of values
+	int32_t		parent;			// Index of the container, -1 for the genome
+	int32_t		name;			// Position of the name in the name table
+	int32_t		nameLength;
+	int32_t		reserved;
+};
+
+static uint64_t align8 (uint64_t bytes) {return (bytes+7) & ~uint64_t (7);}
+
+/*******************************************************************************
+ * Checks that an entry of the directory of a snapshot refers only to its own
+ * name in the name table, to a value within the record and to a container
+ * before it in the directory.
+ ******************************************************************************/
+static bool validGene (const SnapshotGene& e, int index, const SnapshotHeader& h, const char* names)
+{
+	if (e.name < 0 || e.nameLength < 0 || uint64_t (e.name) + e.nameLength >= h.namesSize
+		|| names [e.name + e.nameLength] != 0)
+		return false;
+
+	if (e.parent < -1 || e.parent >= index)
+		return false;
+
+	uint64_t size = 0;
+	switch (e.kind) {
+	  case SnapshotReader::CONTAINER:
+	  case SnapshotReader::OTHER:	size = 0; break;
+	  case SnapshotReader::DOUBLE:	size = sizeof (double); break;
+	  case SnapshotReader::INT:		size = sizeof (int32_t); break;
+	  case SnapshotReader::BOOL:	size = 1; break;
+	  case SnapshotReader::DOUBLES:
+		  if (e.count < 0 || uint64_t (e.count) > h.recordSize/sizeof (double))
+			  return false;
+		  size = sizeof (int32_t) + e.count*sizeof (double);
+		  break;
+	  default:
+		  return false;
+	}
+	return e.offset <= h.recordSize && size <= h.recordSize - e.offset;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//               S n a p s h o t   W r i t e r                               //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+SnapshotWriter::SnapshotWriter (const String& file, const Individual& prototype,
+								int individuals, int generation)
+		: mFile (file), mpOut (NULL), rpBuffer (NULL), mBase (0),
+		  mIndividuals (individuals), mAdded (0)
+{
+	ASSERTWITH (individuals>=0, "Negative number of individuals");
+
+	mTemp = file;
+	mTemp += ".tmp";
+	mpOut = fopen (mTemp, "wb");
+	if (!mpOut)
+		throw checkpoint_error (format ("Snapshot file '%s' couldn't be opened: %s",
+										(CONSTR) mTemp, strerror (errno)));
+
+	try {
+		start (prototype, generation);
+	} catch (...) {
+		// The destructor is not called for a failed constructor
+		fclose (mpOut);
+		remove (mTemp);
+		throw;
+	}
+}
+
+SnapshotWriter::SnapshotWriter (CheckpointOStream& buffer, const String& file,
+								const Individual& prototype, int individuals, int generation)
+		: mFile (file), mpOut (NULL), rpBuffer (&buffer), mBase (buffer.size ()),
+		  mIndividuals (individuals), mAdded (0)
+{
+	ASSERTWITH (individuals>=0, "Negative number of individuals");
+
+	try {
+		start (prototype, generation);
+	} catch (...) {
+		buffer.truncate (mBase);
+		throw;
+	}
+}
+
+SnapshotWriter::~SnapshotWriter ()
+{
+	if (mpOut) {
+		fclose (mpOut);
+		remove (mTemp);
+	}
+	if (rpBuffer)
+		rpBuffer->truncate (mBase);
+}
+
+void SnapshotWriter::start (const Individual& prototype, int generation)
+{
+	// The genome is at the end of the record of the individual
+	prototype.saveState (mRecord);
+	mRecordSize = mRecord.size ();
+	mStride     = int (align8 (mRecordSize));
+
+	CheckpointOStream genome;
+	prototype.getGenome().saveState (genome);
+	layout (prototype.getGenome(), mRecordSize-genome.size(), -1);
+
+	GenomeHash signature;
+	prototype.signature (signature);
+
+	SnapshotHeader header;
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, snapshotMagic, sizeof (header.magic));
+	header.signatureLow  = signature.low ();
+	header.signatureHigh = signature.high ();
+	header.individuals   = mIndividuals;
+	header.generation    = generation;
+	header.recordSize    = mRecordSize;
+	header.stride        = mStride;
+	header.genes         = mDirectory.size () / sizeof (SnapshotGene);
+	header.namesSize     = align8 (mNames.size ());
+	header.fitnessOffset = sizeof (header) + mDirectory.size () + header.namesSize;
+	header.recordsOffset = header.fitnessOffset + uint64_t (mIndividuals)*sizeof (double);
+	header.fileSize      = header.recordsOffset + uint64_t (mIndividuals)*mStride;
+
+	mFitness.make (mIndividuals);
+	mFitnessOffset = header.fitnessOffset;
+
+	char padding [8] = {0,0,0,0,0,0,0,0};
+	write (&header, sizeof (header));
+	write (mDirectory.data (), mDirectory.size ());
+	write (mNames.data (), mNames.size ());
+	write (padding, header.namesSize - mNames.size ());
+
+	// The fitness column is written last, so skip over it for now. The
+	// buffer can not have holes, so it is filled with zeros.
+	if (rpBuffer) {
+		for (int i=0; i<mIndividuals; i++)
+			write (padding, sizeof (double));
+	} else if (fseeko (mpOut, off_t (header.recordsOffset), SEEK_SET) != 0)
+		throw checkpoint_error (format ("Snapshot file '%s' couldn't be written: %s",
+										(CONSTR) mTemp, strerror (errno)));
+}
+
+/*******************************************************************************
+ * Containers write their own data before their substructures, so the
+ * substructures of a container are at the end of its state, one after
+ * another.
+ ******************************************************************************/
+void SnapshotWriter::layout (const Genstruct& gene, int offset, int parent)
+{
+	SnapshotGene entry;
+	memset (&entry, 0, sizeof (entry));
+	entry.offset     = offset;
+	entry.parent     = parent;
+	entry.name       = mNames.size ();
+	entry.nameLength = gene.getID().length ();
+	mNames.put ((CONSTR) gene.getID(), entry.nameLength+1);
+
+	const Gentainer* container = dynamic_cast<const Gentainer*> (&gene);
+	entry.count = 1;
+	if (container) {
+		entry.kind  = SnapshotReader::CONTAINER;
+		entry.count = 0;
+	} else if (dynamic_cast<const FloatGene*> (&gene))
+		entry.kind  = SnapshotReader::DOUBLE;
+	else if (dynamic_cast<const IntGene*> (&gene))
+		entry.kind  = SnapshotReader::INT;
+	else if (dynamic_cast<const BinaryGene*> (&gene))
+		entry.kind  = SnapshotReader::BOOL;
+	else if (dynamic_cast<const FloatVectorGene*> (&gene)) {
+		entry.kind  = SnapshotReader::DOUBLES;
+		entry.count = gene.length ();
+	} else
+		entry.kind  = SnapshotReader::OTHER;
+
+	int index = mDirectory.size () / sizeof (SnapshotGene);
+	mDirectory.put (&entry, sizeof (entry));
+
+	if (!container)
+		return;
+
+	CheckpointOStream state;
+	PackArray<int> sizes (container->size ());
+	int substructs = 0;
+	for (int i=0; i<container->size (); i++) {
+		state.clear ();
+		(*container)[i].saveState (state);
+		sizes[i] = state.size ();
+		substructs += sizes[i];
+	}
+
+	state.clear ();
+	gene.saveState (state);
+	int position = offset + state.size () - substructs;
+	for (int i=0; i<container->size (); i++) {
+		layout ((*container)[i], position, index);
+		position += sizes[i];
+	}
+}
+
+void SnapshotWriter::write (const void* data, size_t bytes)
+{
+	if (rpBuffer) {
+		rpBuffer->put (data, int (bytes));
+		return;
+	}
+	if (fwrite (data, 1, bytes, mpOut) != bytes)
+		throw checkpoint_error (format ("Snapshot file '%s' couldn't be written: %s",
+										(CONSTR) mTemp, strerror (errno)));
+}
+
+void SnapshotWriter::add (const Individual& individual)
+{
+	ASSERTWITH (mpOut || rpBuffer, "Snapshot is already closed");
+	if (mAdded >= mIndividuals)
+		throw checkpoint_error (format ("Snapshot '%s' has room for only %d individuals",
+										(CONSTR) mFile, mIndividuals));
+
+	mRecord.clear ();
+	individual.saveState (mRecord);
+	if (mRecord.size () != mRecordSize)
+		throw checkpoint_error (format ("Individual %d does not match the structure of snapshot '%s'",
+										mAdded, (CONSTR) mFile));
+
+	char padding [8] = {0,0,0,0,0,0,0,0};
+	mRecord.put (padding, mStride-mRecordSize);
+	write (mRecord.data (), mRecord.size ());
+
+	mFitness[mAdded++] = individual.getfitness ();
+}
+
+void SnapshotWriter::close ()
+{
+	ASSERTWITH (mpOut || rpBuffer, "Snapshot is already closed");
+	if (mAdded != mIndividuals)
+		throw checkpoint_error (format ("Snapshot '%s' got %d individuals instead of %d",
+										(CONSTR) mFile, mAdded, mIndividuals));
+
+	if (rpBuffer) {
+		rpBuffer->overwrite (mBase + int (mFitnessOffset), mFitness.getData (),
+							 int (mIndividuals*sizeof (double)));
+		rpBuffer = NULL;
+		return;
+	}
+
+	bool ok = fseeko (mpOut, off_t (mFitnessOffset), SEEK_SET) == 0;
+	ok = ok && fwrite (mFitness.getData (), sizeof (double), mIndividuals, mpOut) == size_t (mIndividuals);
+	ok = (fflush (mpOut) == 0) && ok;
+	ok = (fsync (fileno (mpOut)) == 0) && ok;
+	ok = (fclose (mpOut) == 0) && ok;
+	mpOut = NULL;
+
+	if (!ok || rename (mTemp, mFile) != 0) {
+		String error = strerror (errno);
+		remove (mTemp);
+		throw checkpoint_error (format ("Snapshot file '%s' couldn't be written: %s",
+										(CONSTR) mFile, (CONSTR) error));
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//               S n a p s h o t   R e a d e r                               //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+SnapshotReader::SnapshotReader (const String& file)
+{
+	int fd = open (file, O_RDONLY);
+	if (fd < 0)
+		throw checkpoint_error (format ("Snapshot file '%s' couldn't be opened: %s",
+										(CONSTR) file, strerror (errno)));
+
+	struct stat st;
+	if (fstat (fd, &st) != 0 || size_t (st.st_size) < sizeof (SnapshotHeader)) {
+		::close (fd);
+		throw checkpoint_error (format ("Snapshot file '%s' is truncated", (CONSTR) file));
+	}
+
+	// The mapping stays valid after closing the file
+	mMapSize = st.st_size;
+	mpMap    = mmap (NULL, mMapSize, PROT_READ, MAP_SHARED, fd, 0);
+	::close (fd);
+	if (mpMap == MAP_FAILED)
+		throw checkpoint_error (format ("Snapshot file '%s' couldn't be mapped: %s",
+										(CONSTR) file, strerror (errno)));
+
+	const char* base = (const char*) mpMap;
+	rpHeader = (const SnapshotHeader*) base;
+
+	// Check that the sections are where they should be before trusting
+	// any of the offsets
+	const SnapshotHeader& h = *rpHeader;
+	uint64_t directory = sizeof (SnapshotHeader) + h.genes*sizeof (SnapshotGene);
+	bool valid = memcmp (h.magic, snapshotMagic, sizeof (h.magic)) == 0
+		&& h.fileSize == mMapSize
+		&& h.genes > 0 && h.genes < mMapSize && h.namesSize < mMapSize
+		&& h.fitnessOffset == directory + h.namesSize
+		&& h.individuals <= mMapSize/sizeof (double)
+		&& h.recordsOffset == h.fitnessOffset + h.individuals*sizeof (double)
+		&& h.recordSize <= h.stride && h.stride%8 == 0 && h.stride <= mMapSize
+		&& h.recordsOffset + h.individuals*h.stride == mMapSize;
+	if (!valid) {
+		munmap (mpMap, mMapSize);
+		throw checkpoint_error (format ("'%s' is not a valid snapshot", (CONSTR) file));
+	}
+
+	rpGenes   = (const SnapshotGene*) (base + sizeof (SnapshotHeader));
+	rpNames   = base + directory;
+
+	// The directory and the names come from the file, too
+	for (uint64_t g=0; g<h.genes; g++)
+		if (!validGene (rpGenes[g], int (g), h, rpNames)) {
+			munmap (mpMap, mMapSize);
+			throw checkpoint_error (format ("Gene %d of snapshot '%s' is invalid", int (g), (CONSTR) file));
+		}
+
+	rpFitness = (const double*) (base + h.fitnessOffset);
+	rpRecords = base + h.recordsOffset;
+	mStride   = h.stride;
+}
+
+SnapshotReader::~SnapshotReader ()
+{
+	munmap (mpMap, mMapSize);
+}
+
+int SnapshotReader::individuals () const
+{
+	return int (rpHeader->individuals);
+}
+
+int SnapshotReader::generation () const
+{
+	return int (rpHeader->generation);
+}
+
+int SnapshotReader::recordSize () const
+{
+	return int (rpHeader->recordSize);
+}
+
+bool SnapshotReader::matches (const Individual& prototype) const
+{
+	GenomeHash signature;
+	prototype.signature (signature);
+	return signature.low () == rpHeader->signatureLow && signature.high () == rpHeader->signatureHigh;
+}
+
+/*******************************************************************************
+ * The record begins with the fitness, the number of evaluations and the
+ * age, as written by Individual::saveState().
+ ******************************************************************************/
+int SnapshotReader::age (int i) const
+{
+	int32_t age;
+	memcpy (&age, record (i) + sizeof (double) + sizeof (int32_t), sizeof (age));
+	return age;
+}
+
+int SnapshotReader::genes () const
+{
+	return int (rpHeader->genes);
+}
+
+const SnapshotGene& SnapshotReader::entry (int gene) const
+{
+	ASSERTWITH (gene>=0 && gene<genes (), format ("Gene index %d out of range", gene));
+	return rpGenes [gene];
+}
+
+String SnapshotReader::geneName (int gene) const
+{
+	return String (rpNames + entry (gene).name);
+}
+
+String SnapshotReader::genePath (int gene) const
+{
+	String path = geneName (gene);
+	for (int p = entry (gene).parent; p >= 0; p = entry (p).parent)
+		if (entry (p).nameLength > 0) {
+			String prefix = geneName (p);
+			prefix += "/";
+			prefix += path;
+			path = prefix;
+		}
+	return path;
+}
+
+int SnapshotReader::geneKind (int gene) const
+{
+	return entry (gene).kind;
+}
+
+int SnapshotReader::geneCount (int gene) const
+{
+	return entry (gene).count;
+}
+
+int SnapshotReader::findGene (const String& name) const
+{
+	int length = name.length ();
+	for (int g=0; g<genes (); g++)
+		if (rpGenes[g].nameLength == length && !memcmp (rpNames + rpGenes[g].name, (CONSTR) name, length))
+			return g;
+	return -1;
+}
+
+double SnapshotReader::getDouble (int i, int gene, int k) const
+{
+	const SnapshotGene& e = entry (gene);
+	const char* value = record (i) + e.offset;
+	double result;
+
+	switch (e.kind) {
+	  case DOUBLE:
+		  memcpy (&result, value, sizeof (result));
+		  return result;
+	  case DOUBLES:
+		  // The values follow their count
+		  ASSERTWITH (k>=0 && k<e.count, format ("Value index %d out of range", k));
+		  memcpy (&result, value + sizeof (int32_t) + k*sizeof (double), sizeof (result));
+		  return result;
+	  case INT:
+	  case BOOL:
+		  return getInt (i, gene);
+	}
+	throw checkpoint_error (format ("Gene '%s' has no numeric value", (CONSTR) geneName (gene)));
+}
+
+int SnapshotReader::getInt (int i, int gene) const
+{
+	const SnapshotGene& e = entry (gene);
+	const char* value = record (i) + e.offset;
+
+	if (e.kind == INT) {
+		int32_t result;
+		memcpy (&result, value, sizeof (result));
+		return result;
+	}
+	if (e.kind == BOOL)
+		return *value != 0;
+	throw checkpoint_error (format ("Gene '%s' has no integer value", (CONSTR) geneName (gene)));
+}
+
+void SnapshotReader::decode (int i, int gene, Genstruct& into) const
+{
+	const SnapshotGene& e = entry (gene);
+	CheckpointIStream in (record (i) + e.offset, recordSize () - int (e.offset));
+	into.loadState (in);
+}
+
+void SnapshotReader::load (int i, Individual& into) const
+{
+	CheckpointIStream in (record (i), recordSize ());
+	into.loadState (in);
+}
@@ -31,6 +31,32 @@
 #include "nhp/individual.h"
 #include "nhp/gaenvrnmt.h"
 #include "nhp/testenv.h"
+#include "nhp/testkernels.h"
+
+/*******************************************************************************
+ * Seeks a gene by name, checking that it exists and is of the expected class.
+ ******************************************************************************/
+template <class T>
+static const T* namedGene (const Individual& indiv, const GeneticID& name)
+{
+	const T* gene = dynamic_cast<const T*> (indiv.getGene (name));
+	ASSERTWITH (gene, format ("Gene '%s' not found or not of the expected class", (CONSTR) name));
+	return gene;
+}
+
+/*******************************************************************************
+ * Resolves the path of a gene in the template genome and checks its class once.
+ * The genomes copied from the template have a gene of the same class at the
+ * path, so the genes found with the path can be cast without checking.
+ ******************************************************************************/
+template <class T>
+static GenePath* resolveGene (const Genome& templ, const GeneticID& name)
+{
+	GenePath path = templ.resolve (name);
+	ASSERTWITH (dynamic_cast<const T*> (templ.getGene (path)),
+				format ("Gene '%s' is not of the expected class", (CONSTR) name));
+	return new GenePath (path);
+}
 
 ////////////////////////////////////////////////////////////////////////////////////////////////
 // -----                  ----   _   -----             o                                      //
@@ -40,7 +66,8 @@
 //   |    \__  ____)   \ |___/ |   | |____ |   |   V   | |   \__/ |   | | | |  \__  |   |   \ //
 ////////////////////////////////////////////////////////////////////////////////////////////////
 
-BinaryTestEAEnv::BinaryTestEAEnv (int dim, int ntargets) {
+BinaryTestEAEnv::BinaryTestEAEnv (int dim, int ntargets) : mTarget ("target", dim, 0.0) {
+	mPacked = false;
 	targets.make (ntargets, dim);
 	changeObjective (0);
 }
@@ -51,21 +78,50 @@ void BinaryTestEAEnv::changeObjective (int target) {
 	for (int t=0; t<targets.rows; t++)
 		for (int i=0; i<targets.cols; i++)
 			targets.get (t, i) = mObjective;
+
+	for (int i=0; i<targets.cols; i++)
+		mTarget.set (i, targets.get (0, i));
 }
 
 void BinaryTestEAEnv::addFeaturesTo (Genome& genome) const {
-	for (int i=0; i<targets.cols; i++)
-		genome.add (new BinaryGene (format ("x%d", i), 1.0));
+	if (mPacked)
+		genome.add (new PackedBitGentainer ("x", targets.cols));
+	else
+		for (int i=0; i<targets.cols; i++)
+			genome.add (new BinaryGene (format ("x%d", i), 1.0));
 }
 
 double dist (double x0, double y0, double x1, double y1) {
 	return sqrt ((x1-x0)*(x1-x0)+(y1-y0)*(y1-y0));
 }
 
+void BinaryTestEAEnv::resolveGenes (const Genome& templ) {
+	if (mPacked) {
+		mGenePaths.make (1);
+		mGenePaths.put (resolveGene<PackedBitGentainer> (templ, "x"), 0);
+		return;
+	}
+
+	mGenePaths.make (targets.cols);
+	for (int i=0; i<targets.cols; i++)
+		mGenePaths.put (resolveGene<BinaryGene> (templ, format ("x%d", i)), i);
+}
+
 double BinaryTestEAEnv::evaluateg (const Individual& indiv) {
+	bool resolved = (mGenePaths.size() == (mPacked? 1 : targets.cols));
+
+	// Count the differing bits a word at a time
+	if (mPacked) {
+		const PackedBitGentainer* bits = resolved? static_cast<const PackedBitGentainer*> (indiv.getGene (mGenePaths[0]))
+			: namedGene<PackedBitGentainer> (indiv, "x");
+		return bits->hamming (mTarget);
+	}
+
 	double err = 0.0;
 	for (int i=0; i<targets.cols; i++) {
-		int x = static_cast<const BinaryGene&> (*indiv.getGene(format ("x%d", i))).getvalue();
+		const BinaryGene* gene = resolved? static_cast<const BinaryGene*> (indiv.getGene (mGenePaths[i]))
+			: namedGene<BinaryGene> (indiv, format ("x%d", i));
+		int x = gene->getvalue();
 		err += (x==targets.get (0, i))? 0.0:1.0;
 		//		printf ("%g ", x);
 		//		fflush (stdout);
@@ -97,9 +153,26 @@ FloatTestEAEnv::FloatTestEAEnv (const StringMap& params, int d, int f) : mParams
 	func = f;
 	mObjective = 0;
 	mGeneType = ESFLOAT;
+	mBatchWidth = getOrDefault (params, "FloatTestEAEnv.batchWidth", String(0)).toInt ();
+
+	String kernels = getOrDefault (params, "FloatTestEAEnv.kernels", "exact");
+	int isa = TestKernels::find ((CONSTR) kernels);
+	ASSERTWITH (isa >= 0, format ("Unknown FloatTestEAEnv.kernels '%s'", (CONSTR) kernels));
+	setKernels (isa);
  }
 
+void FloatTestEAEnv::setKernels (int isa) {
+	ASSERTWITH (TestKernels::supported (isa),
+				format ("The processor does not support the %s kernels", TestKernels::name (isa)));
+	mKernels = isa;
+}
+
 void FloatTestEAEnv::addFeaturesTo (Genome& genome) const {
+	if (mGeneType==VECFLOAT) {
+		genome.add (new FloatVectorGene ("x", dim, -4.0, 4.0, 1.0));
+		return;
+	}
+
 	for (int i=0; i<dim; i++)
 		if (mGeneType==BITFLOAT)
 			genome.add (new BitFloatGene (format ("x%d", i), -4.0, 4.0, 16, mParams));
@@ -190,10 +263,32 @@ inline double TF8 (const PackArray<double>& x) {
 
 ///////////////////////////////////////////////////////////////////////////////
 
+void FloatTestEAEnv::resolveGenes (const Genome& templ) {
+	if (mGeneType==VECFLOAT) {
+		mGenePaths.make (1);
+		mGenePaths.put (resolveGene<FloatVectorGene> (templ, "x"), 0);
+		return;
+	}
+
+	mGenePaths.make (dim);
+	for (int i=0; i<dim; i++)
+		mGenePaths.put (resolveGene<AnyFloatGene> (templ, format ("x%d", i)), i);
+}
+
 double FloatTestEAEnv::evaluateg (const Individual& indiv) {
+	if (mGeneType==VECFLOAT) {
+		const FloatVectorGene* gene = (mGenePaths.size()==1)? static_cast<const FloatVectorGene*> (indiv.getGene (mGenePaths[0]))
+			: namedGene<FloatVectorGene> (indiv, "x");
+		return calc (gene->getvalues(), func);
+	}
+
+	bool resolved = (mGenePaths.size() == dim);
 	PackArray<double> x (dim);
-	for (int i=0; i<dim; i++)
-		x[i] = dynamic_cast<const AnyFloatGene&> (*indiv.getGene(format ("x%d", i))).getvalue();
+	for (int i=0; i<dim; i++) {
+		const AnyFloatGene* gene = resolved? static_cast<const AnyFloatGene*> (indiv.getGene (mGenePaths[i]))
+			: namedGene<AnyFloatGene> (indiv, format ("x%d", i));
+		x[i] = gene->getvalue();
+	}
 	
 	return calc (x, func);
 }
@@ -223,6 +318,123 @@ double FloatTestEAEnv::calc (const Vector& x0, int func) {
 	return result;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Test functions for blocks of vectors. Each row of the matrix holds one
+// dimension of all the vectors, so the inner loops run over the vectors
+// and can be vectorized by the compiler. The sums are accumulated in the
+// same order as in the functions above, so the results are identical.
+
+#define SumBatch(fx)\
+	for (int k=0; k<n; k++)\
+		sum[k] = 0;\
+	for (int i=0; i<dim; i++) {\
+		const double* xi = x + i*n;\
+		for (int k=0; k<n; k++)\
+			sum[k] += fx;\
+	}
+
+inline void sphereTFBatch (const double* x, int dim, int n, double* sum) {
+	SumBatch (sqr(xi[k]));
+}
+
+inline void ellipsoidTFBatch (const double* x, int dim, int n, double* sum) {
+	SumBatch (sqr(double(i+1))*sqr(xi[k]));
+}
+
+inline void negsphereTFBatch (const double* x, int dim, int n, double* sum) {
+	SumBatch (-sqr(xi[k]));
+}
+
+inline void absSumTFBatch (const double* x, int dim, int n, double* sum) {
+	SumBatch (fabs(xi[k]));
+}
+
+inline void TF4Batch (const double* x, int dim, int n, double* sum) {
+	double k4=4;
+	SumBatch (sqr(k4*xi[k])-k4*cos(2*pi*xi[k]*k4));
+	for (int k=0; k<n; k++)
+		sum[k] = (dim*10 + sum[k])/50.0;
+}
+
+inline void TF5Batch (const double* x, int dim, int n, double* sum) {
+	double k5=-1000;
+	SumBatch (-xi[k]*sin(sqrt(fabs(k5*xi[k]))));
+}
+
+inline void TF6Batch (const double* x, int dim, int n, double* sum) {
+	double k6=20;
+	SumBatch (sqr(k6*4*xi[k])/4000);
+	PackArray<double> mul (n);
+	for (int k=0; k<n; k++)
+		mul[k] = 1;
+	for (int i=0; i<dim; i++) {
+		const double* xi = x + i*n;
+		double scale = sqrt(i+1.0);
+		for (int k=0; k<n; k++)
+			mul[k] *= cos(k6*xi[k]/scale);
+	}
+	for (int k=0; k<n; k++)
+		sum[k] = (sum[k]-mul[k]+1)/4.0;
+}
+
+void FloatTestEAEnv::calcBatch (const double* x0, int n, int func, double* result) {
+	ASSERT (func>=0 && func<functions);
+	ASSERT (mObjective==0 || mObjective==1);
+
+	PackArray<double> flipped;
+	const double* x = x0;
+	if (mObjective==1) {
+		flipped.make (dim*n);
+		for (int j=0; j<dim*n; j++)
+			flipped[j] = 1-x0[j];
+		x = flipped.getData ();
+	}
+
+	if (mKernels != TestKernels::EXACT) {
+		TestKernels::calc (mKernels, func, x, dim, n, result);
+		return;
+	}
+
+	switch (func) {
+	  case Sphere:		sphereTFBatch		(x, dim, n, result); break;
+	  case Ellipsoid:	ellipsoidTFBatch	(x, dim, n, result); break;
+	  case NegSphere:	negsphereTFBatch	(x, dim, n, result); break;
+	  case ZeroMin:		absSumTFBatch		(x, dim, n, result); break;
+	  case F4:			TF4Batch			(x, dim, n, result); break;
+	  case F5:			TF5Batch			(x, dim, n, result); break;
+	  case F6:			TF6Batch			(x, dim, n, result); break;
+	  case F7:			absSumTFBatch		(x, dim, n, result); break;
+	  case F8:			absSumTFBatch		(x, dim, n, result); break;
+	};
+}
+
+/*******************************************************************************
+ * Decodes the genes of the individuals to a matrix, and evaluates them all
+ * at once.
+ ******************************************************************************/
+void FloatTestEAEnv::evaluateBatch (const Individual* const* indivs, int n, double* fitness) {
+	bool resolved = (mGenePaths.size() == ((mGeneType==VECFLOAT)? 1 : dim));
+	PackArray<double> x (dim*n);
+	for (int k=0; k<n; k++) {
+		if (mGeneType==VECFLOAT) {
+			const FloatVectorGene* gene = resolved? static_cast<const FloatVectorGene*> (indivs[k]->getGene (mGenePaths[0]))
+				: namedGene<FloatVectorGene> (*indivs[k], "x");
+			const Vector& values = gene->getvalues();
+			for (int i=0; i<dim; i++)
+				x[i*n+k] = values[i];
+			continue;
+		}
+
+		for (int i=0; i<dim; i++) {
+			const AnyFloatGene* gene = resolved? static_cast<const AnyFloatGene*> (indivs[k]->getGene (mGenePaths[i]))
+				: namedGene<AnyFloatGene> (*indivs[k], format ("x%d", i));
+			x[i*n+k] = gene->getvalue();
+		}
+	}
+
+	calcBatch (x.getData (), n, func, fitness);
+}
+
 void FloatTestEAEnv::printMathematica2D () {
 	TextOStream out;
 	out.autoFlush ();
@@ -0,0 +1,415 @@
+/***************************************************************************
+ *   This file is part of the NeHeP library.                               *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <math.h>
+#include <string.h>
+#include <magic/mobject.h>
+#include <magic/mpararr.h>
+#include "nhp/testenv.h"
+#include "nhp/testkernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NHP_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+// The constants of the test functions, as in testenv.cc
+static const double testPi		= 3.14159;
+static const double kTF4		= 4;
+static const double kTF5		= -1000;
+static const double kTF6		= 20;
+
+// Reduction of the argument of sin and cos to [-pi/4,pi/4]. pi/2 is
+// split to three parts so that q*pio2_1 is exact for any reasonable q.
+static const double twoOverPi	= 6.36619772367581382433e-01;
+static const double pio2_1		= 1.57079632673412561417e+00;
+static const double pio2_2		= 6.07710050630396597660e-11;
+static const double pio2_3		= 2.02226624871116645580e-21;
+
+// Minimax polynomials of sin and cos in [-pi/4,pi/4] (from Cephes)
+static const double sin0 =  1.58962301576546568060E-10;
+static const double sin1 = -2.50507477628578072866E-8;
+static const double sin2 =  2.75573136213857245213E-6;
+static const double sin3 = -1.98412698295895385996E-4;
+static const double sin4 =  8.33333333332211858878E-3;
+static const double sin5 = -1.66666666666666307295E-1;
+static const double cos0 = -1.13585365213876817300E-11;
+static const double cos1 =  2.08757008419747316778E-9;
+static const double cos2 = -2.75573141792967388112E-7;
+static const double cos3 =  2.48015872888517045348E-5;
+static const double cos4 = -1.38888888888730564116E-3;
+static const double cos5 =  4.16666666666665929218E-2;
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//                          S c a l a r                                      //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/** Approximates sin(x) with shift=0 and cos(x) with shift=1. */
+static inline double approxSinCos (double x, int shift)
+{
+	double q = floor (x*twoOverPi + 0.5);
+	double r = ((x - q*pio2_1) - q*pio2_2) - q*pio2_3;
+	double z = r*r;
+	double s = r + r*z*(((((sin0*z + sin1)*z + sin2)*z + sin3)*z + sin4)*z + sin5);
+	double c = 1.0 - 0.5*z + z*z*(((((cos0*z + cos1)*z + cos2)*z + cos3)*z + cos4)*z + cos5);
+
+	// Quadrant of the argument; cos(x) = sin(x+pi/2)
+	int quadrant = int (q) + shift;
+	double v = (quadrant & 1)? c : s;
+	return (quadrant & 2)? -v : v;
+}
+
+#define ScalarSum(fx)\
+	for (int k=begin; k<n; k++)\
+		sum[k] = 0;\
+	for (int i=0; i<dim; i++) {\
+		const double* xi = x + i*n;\
+		for (int k=begin; k<n; k++)\
+			sum[k] += fx;\
+	}
+
+/** Calculates the sums (and the products for F6) of a test function
+ *  for the vectors from begin to n.
+ **/
+static void scalarSums (int func, const double* x, int dim, int n, int begin, double* sum, double* mul)
+{
+	switch (func) {
+	  case FloatTestEAEnv::Sphere:
+		  ScalarSum (xi[k]*xi[k]);
+		  break;
+	  case FloatTestEAEnv::Ellipsoid:
+		  ScalarSum (double(i+1)*double(i+1)*xi[k]*xi[k]);
+		  break;
+	  case FloatTestEAEnv::NegSphere:
+		  ScalarSum (-xi[k]*xi[k]);
+		  break;
+	  case FloatTestEAEnv::F4:
+		  ScalarSum ((kTF4*xi[k])*(kTF4*xi[k]) - kTF4*approxSinCos (2*testPi*xi[k]*kTF4, 1));
+		  break;
+	  case FloatTestEAEnv::F5:
+		  ScalarSum (-xi[k]*approxSinCos (sqrt (fabs (kTF5*xi[k])), 0));
+		  break;
+	  case FloatTestEAEnv::F6:
+		  ScalarSum ((kTF6*4*xi[k])*(kTF6*4*xi[k])/4000);
+		  for (int k=begin; k<n; k++)
+			  mul[k] = 1;
+		  for (int i=0; i<dim; i++) {
+			  const double* xi = x + i*n;
+			  double scale = kTF6/sqrt (i+1.0);
+			  for (int k=begin; k<n; k++)
+				  mul[k] *= approxSinCos (scale*xi[k], 1);
+		  }
+		  break;
+	  default:	// ZeroMin, F7, F8
+		  ScalarSum (fabs (xi[k]));
+	}
+}
+
+#ifdef NHP_X86_KERNELS
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//                            A V X 2                                        //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma GCC push_options
+#pragma GCC target ("avx2,fma")
+
+static inline __m256d avx2SinCos (__m256d x, int shift)
+{
+	__m256d q = _mm256_round_pd (_mm256_mul_pd (x, _mm256_set1_pd (twoOverPi)),
+								 _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256d r = _mm256_fnmadd_pd (q, _mm256_set1_pd (pio2_1), x);
+	r = _mm256_fnmadd_pd (q, _mm256_set1_pd (pio2_2), r);
+	r = _mm256_fnmadd_pd (q, _mm256_set1_pd (pio2_3), r);
+	__m256d z = _mm256_mul_pd (r, r);
+
+	__m256d p = _mm256_fmadd_pd (_mm256_set1_pd (sin0), z, _mm256_set1_pd (sin1));
+	p = _mm256_fmadd_pd (p, z, _mm256_set1_pd (sin2));
+	p = _mm256_fmadd_pd (p, z, _mm256_set1_pd (sin3));
+	p = _mm256_fmadd_pd (p, z, _mm256_set1_pd (sin4));
+	p = _mm256_fmadd_pd (p, z, _mm256_set1_pd (sin5));
+	__m256d s = _mm256_fmadd_pd (_mm256_mul_pd (r, z), p, r);
+
+	p = _mm256_fmadd_pd (_mm256_set1_pd (cos0), z, _mm256_set1_pd (cos1));
+	p = _mm256_fmadd_pd (p, z, _mm256_set1_pd (cos2));
+	p = _mm256_fmadd_pd (p, z, _mm256_set1_pd (cos3));
+	p = _mm256_fmadd_pd (p, z, _mm256_set1_pd (cos4));
+	p = _mm256_fmadd_pd (p, z, _mm256_set1_pd (cos5));
+	__m256d c = _mm256_fmadd_pd (_mm256_mul_pd (z, z), p,
+								 _mm256_fnmadd_pd (_mm256_set1_pd (0.5), z, _mm256_set1_pd (1.0)));
+
+	// Select by the quadrant, and flip the sign with its second bit
+	__m256i quadrant = _mm256_cvtepi32_epi64 (_mm_add_epi32 (_mm256_cvtpd_epi32 (q), _mm_set1_epi32 (shift)));
+	__m256i one = _mm256_set1_epi64x (1);
+	__m256i odd = _mm256_cmpeq_epi64 (_mm256_and_si256 (quadrant, one), one);
+	__m256d v = _mm256_blendv_pd (s, c, _mm256_castsi256_pd (odd));
+	__m256i sign = _mm256_slli_epi64 (_mm256_and_si256 (quadrant, _mm256_set1_epi64x (2)), 62);
+	return _mm256_xor_pd (v, _mm256_castsi256_pd (sign));
+}
+
+#define Avx2Sum(fx)\
+	for (int k=0; k<end; k+=4) {\
+		__m256d acc = _mm256_setzero_pd ();\
+		for (int i=0; i<dim; i++) {\
+			__m256d v = _mm256_loadu_pd (x + i*n + k);\
+			acc = _mm256_add_pd (acc, fx);\
+		}\
+		_mm256_storeu_pd (sum+k, acc);\
+	}
+
+/** Calculates the sums like @ref scalarSums() for as many vectors as
+ *  fit in whole registers, and returns their number.
+ **/
+static int avx2Sums (int func, const double* x, int dim, int n, double* sum, double* mul)
+{
+	int end = n - n%4;
+	__m256d absMask = _mm256_castsi256_pd (_mm256_set1_epi64x (0x7FFFFFFFFFFFFFFFLL));
+
+	switch (func) {
+	  case FloatTestEAEnv::Sphere:
+		  Avx2Sum (_mm256_mul_pd (v, v));
+		  break;
+	  case FloatTestEAEnv::Ellipsoid:
+		  Avx2Sum (_mm256_mul_pd (_mm256_set1_pd (double(i+1)*double(i+1)), _mm256_mul_pd (v, v)));
+		  break;
+	  case FloatTestEAEnv::NegSphere:
+		  Avx2Sum (_mm256_sub_pd (_mm256_setzero_pd (), _mm256_mul_pd (v, v)));
+		  break;
+	  case FloatTestEAEnv::F4: {
+		  __m256d kv = _mm256_set1_pd (kTF4), w = _mm256_set1_pd (2*testPi*kTF4);
+		  Avx2Sum (_mm256_fnmadd_pd (kv, avx2SinCos (_mm256_mul_pd (w, v), 1),
+									 _mm256_mul_pd (_mm256_mul_pd (kv, v), _mm256_mul_pd (kv, v))));
+		  break;
+	  }
+	  case FloatTestEAEnv::F5: {
+		  __m256d kv = _mm256_set1_pd (kTF5);
+		  Avx2Sum (_mm256_mul_pd (_mm256_sub_pd (_mm256_setzero_pd (), v),
+								  avx2SinCos (_mm256_sqrt_pd (_mm256_and_pd (_mm256_mul_pd (kv, v), absMask)), 0)));
+		  break;
+	  }
+	  case FloatTestEAEnv::F6: {
+		  __m256d kv = _mm256_set1_pd (kTF6*4), scale = _mm256_set1_pd (1.0/4000);
+		  Avx2Sum (_mm256_mul_pd (_mm256_mul_pd (_mm256_mul_pd (kv, v), _mm256_mul_pd (kv, v)), scale));
+		  for (int k=0; k<end; k+=4) {
+			  __m256d prod = _mm256_set1_pd (1.0);
+			  for (int i=0; i<dim; i++) {
+				  __m256d w = _mm256_set1_pd (kTF6/sqrt (i+1.0));
+				  prod = _mm256_mul_pd (prod, avx2SinCos (_mm256_mul_pd (w, _mm256_loadu_pd (x + i*n + k)), 1));
+			  }
+			  _mm256_storeu_pd (mul+k, prod);
+		  }
+		  break;
+	  }
+	  default:
+		  Avx2Sum (_mm256_and_pd (v, absMask));
+	}
+	return end;
+}
+
+#pragma GCC pop_options
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//                          A V X - 5 1 2                                    //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+#pragma GCC push_options
+#pragma GCC target ("avx512f")
+
+static inline __m512d avx512SinCos (__m512d x, int shift)
+{
+	__m512d q = _mm512_roundscale_pd (_mm512_mul_pd (x, _mm512_set1_pd (twoOverPi)),
+									  _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m512d r = _mm512_fnmadd_pd (q, _mm512_set1_pd (pio2_1), x);
+	r = _mm512_fnmadd_pd (q, _mm512_set1_pd (pio2_2), r);
+	r = _mm512_fnmadd_pd (q, _mm512_set1_pd (pio2_3), r);
+	__m512d z = _mm512_mul_pd (r, r);
+
+	__m512d p = _mm512_fmadd_pd (_mm512_set1_pd (sin0), z, _mm512_set1_pd (sin1));
+	p = _mm512_fmadd_pd (p, z, _mm512_set1_pd (sin2));
+	p = _mm512_fmadd_pd (p, z, _mm512_set1_pd (sin3));
+	p = _mm512_fmadd_pd (p, z, _mm512_set1_pd (sin4));
+	p = _mm512_fmadd_pd (p, z, _mm512_set1_pd (sin5));
+	__m512d s = _mm512_fmadd_pd (_mm512_mul_pd (r, z), p, r);
+
+	p = _mm512_fmadd_pd (_mm512_set1_pd (cos0), z, _mm512_set1_pd (cos1));
+	p = _mm512_fmadd_pd (p, z, _mm512_set1_pd (cos2));
+	p = _mm512_fmadd_pd (p, z, _mm512_set1_pd (cos3));
+	p = _mm512_fmadd_pd (p, z, _mm512_set1_pd (cos4));
+	p = _mm512_fmadd_pd (p, z, _mm512_set1_pd (cos5));
+	__m512d c = _mm512_fmadd_pd (_mm512_mul_pd (z, z), p,
+								 _mm512_fnmadd_pd (_mm512_set1_pd (0.5), z, _mm512_set1_pd (1.0)));
+
+	// Select by the quadrant, and flip the sign with its second bit
+	__m512i quadrant = _mm512_add_epi64 (_mm512_cvtepi32_epi64 (_mm512_cvtpd_epi32 (q)),
+										 _mm512_set1_epi64 (shift));
+	__mmask8 odd = _mm512_test_epi64_mask (quadrant, _mm512_set1_epi64 (1));
+	__m512d v = _mm512_mask_blend_pd (odd, s, c);
+	__m512i sign = _mm512_slli_epi64 (_mm512_and_si512 (quadrant, _mm512_set1_epi64 (2)), 62);
+	return _mm512_castsi512_pd (_mm512_xor_si512 (_mm512_castpd_si512 (v), sign));
+}
+
+static inline __m512d avx512Abs (__m512d v)
+{
+	return _mm512_castsi512_pd (_mm512_and_si512 (_mm512_castpd_si512 (v),
+												  _mm512_set1_epi64 (0x7FFFFFFFFFFFFFFFLL)));
+}
+
+#define Avx512Sum(fx)\
+	for (int k=0; k<end; k+=8) {\
+		__m512d acc = _mm512_setzero_pd ();\
+		for (int i=0; i<dim; i++) {\
+			__m512d v = _mm512_loadu_pd (x + i*n + k);\
+			acc = _mm512_add_pd (acc, fx);\
+		}\
+		_mm512_storeu_pd (sum+k, acc);\
+	}
+
+/** As @ref avx2Sums(), 8 vectors at a time. */
+static int avx512Sums (int func, const double* x, int dim, int n, double* sum, double* mul)
+{
+	int end = n - n%8;
+
+	switch (func) {
+	  case FloatTestEAEnv::Sphere:
+		  Avx512Sum (_mm512_mul_pd (v, v));
+		  break;
+	  case FloatTestEAEnv::Ellipsoid:
+		  Avx512Sum (_mm512_mul_pd (_mm512_set1_pd (double(i+1)*double(i+1)), _mm512_mul_pd (v, v)));
+		  break;
+	  case FloatTestEAEnv::NegSphere:
+		  Avx512Sum (_mm512_sub_pd (_mm512_setzero_pd (), _mm512_mul_pd (v, v)));
+		  break;
+	  case FloatTestEAEnv::F4: {
+		  __m512d kv = _mm512_set1_pd (kTF4), w = _mm512_set1_pd (2*testPi*kTF4);
+		  Avx512Sum (_mm512_fnmadd_pd (kv, avx512SinCos (_mm512_mul_pd (w, v), 1),
+									   _mm512_mul_pd (_mm512_mul_pd (kv, v), _mm512_mul_pd (kv, v))));
+		  break;
+	  }
+	  case FloatTestEAEnv::F5: {
+		  __m512d kv = _mm512_set1_pd (kTF5);
+		  Avx512Sum (_mm512_mul_pd (_mm512_sub_pd (_mm512_setzero_pd (), v),
+									avx512SinCos (_mm512_sqrt_pd (avx512Abs (_mm512_mul_pd (kv, v))), 0)));
+		  break;
+	  }
+	  case FloatTestEAEnv::F6: {
+		  __m512d kv = _mm512_set1_pd (kTF6*4), scale = _mm512_set1_pd (1.0/4000);
+		  Avx512Sum (_mm512_mul_pd (_mm512_mul_pd (_mm512_mul_pd (kv, v), _mm512_mul_pd (kv, v)), scale));
+		  for (int k=0; k<end; k+=8) {
+			  __m512d prod = _mm512_set1_pd (1.0);
+			  for (int i=0; i<dim; i++) {
+				  __m512d w = _mm512_set1_pd (kTF6/sqrt (i+1.0));
+				  prod = _mm512_mul_pd (prod, avx512SinCos (_mm512_mul_pd (w, _mm512_loadu_pd (x + i*n + k)), 1));
+			  }
+			  _mm512_storeu_pd (mul+k, prod);
+		  }
+		  break;
+	  }
+	  default:
+		  Avx512Sum (avx512Abs (v));
+	}
+	return end;
+}
+
+#pragma GCC pop_options
+
+#endif // NHP_X86_KERNELS
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//                       T e s t K e r n e l s                               //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+static const char* isaNames [] = {"exact", "scalar", "avx2", "avx512"};
+
+bool TestKernels::supported (int isa)
+{
+	switch (isa) {
+	  case EXACT:
+	  case SCALAR:
+		  return true;
+#ifdef NHP_X86_KERNELS
+	  case AVX2:
+		  return __builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma");
+	  case AVX512:
+		  return __builtin_cpu_supports ("avx512f");
+#endif
+	}
+	return false;
+}
+
+int TestKernels::best ()
+{
+	for (int isa=ISAS-1; isa>SCALAR; isa--)
+		if (supported (isa))
+			return isa;
+	return SCALAR;
+}
+
+const char* TestKernels::name (int isa)
+{
+	ASSERT (isa>=0 && isa<ISAS);
+	return isaNames [isa];
+}
+
+int TestKernels::find (const char* name)
+{
+	if (!strcmp (name, "fast"))
+		return best ();
+	for (int isa=0; isa<ISAS; isa++)
+		if (!strcmp (name, isaNames [isa]))
+			return isa;
+	return -1;
+}
+
+void TestKernels::calc (int isa, int func, const double* x, int dim, int n, double* result)
+{
+	ASSERT (isa>EXACT && isa<ISAS && supported (isa));
+	ASSERT (func>=0 && func<FloatTestEAEnv::functions);
+
+	PackArray<double> mul (n);
+	int done = 0;
+#ifdef NHP_X86_KERNELS
+	if (isa==AVX512)
+		done = avx512Sums (func, x, dim, n, result, mul.getData ());
+	else if (isa==AVX2)
+		done = avx2Sums (func, x, dim, n, result, mul.getData ());
+#endif
+
+	// The vectors that do not fill a register
+	scalarSums (func, x, dim, n, done, result, mul.getData ());
+
+	if (func==FloatTestEAEnv::F4)
+		for (int k=0; k<n; k++)
+			result[k] = (dim*10 + result[k])/50.0;
+	else if (func==FloatTestEAEnv::F6)
+		for (int k=0; k<n; k++)
+			result[k] = (result[k]-mul[k]+1)/4.0;
+}
@@ -0,0 +1,355 @@
+/***************************************************************************
+ *   This file is part of the NeHeP library.                               *
+ *                                                                         *
+ *   Copyright (C) 1997-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <magic/mexception.h>
+#include "nhp/workerpool.h"
+
+/** Returns a monotonic wall-clock time in seconds. */
+static double wallTime ()
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec*1E-9;
+}
+
+/*******************************************************************************
+ * Per-worker state: the deque of items for the work-stealing scheduler and
+ * the time spent in processing items.
+ *
+ * Since the items of a job are consecutive integers, the deque is a range
+ * [top, bottom). The owner takes items from the bottom and thieves take
+ * from the top.
+ ******************************************************************************/
+struct WorkerDeque {
+	pthread_mutex_t	lock;
+	int				top;
+	int				bottom;
+	unsigned int	seed;		// For choosing the victims
+	double			busy;		// Time spent in PoolTask::process() in the current job
+	char			padding[64];// Keep the deques of different workers in separate cache lines
+};
+
+/*******************************************************************************
+ * Helper thread of a WorkerPool. Just runs the worker loop of the pool.
+ ******************************************************************************/
+class PoolThread : public Thread {
+	WorkerPool*	rpPool;
+	int			mWorker;
+  public:
+					PoolThread	(WorkerPool& pool, int worker) : rpPool (&pool), mWorker (worker) {}
+	virtual void*	execute		() {rpPool->workerLoop (mWorker); return NULL;}
+};
+
+/*******************************************************************************
+ * Creates the pool and starts the helper threads. The helpers sleep until
+ * the first job is given with run().
+ ******************************************************************************/
+WorkerPool::WorkerPool (int threads, int sched)
+{
+	mThreadCount = (threads>0)? threads : processors ();
+	mRunTime     = 0.0;
+	mRemaining   = 0;
+	mpTask       = NULL;
+	mItems       = 0;
+	mChunk       = 1;
+	mNext        = 0;
+	mJob         = 0;
+	mBusy        = 0;
+	mQuit        = false;
+
+	pthread_mutex_init (&mMutex, NULL);
+	pthread_cond_init (&mWakeup, NULL);
+	pthread_cond_init (&mDone, NULL);
+	setScheduler (sched);
+
+	mpDeques = new WorkerDeque [mThreadCount];
+	for (int i=0; i<mThreadCount; i++) {
+		pthread_mutex_init (&mpDeques[i].lock, NULL);
+		mpDeques[i].top    = 0;
+		mpDeques[i].bottom = 0;
+		mpDeques[i].seed   = 2654435761u*(i+1);
+		mpDeques[i].busy   = 0.0;
+	}
+
+	// The calling thread is worker 0, so we need one helper less
+	mpThreads = new PoolThread* [mThreadCount];
+	mpThreads[0] = NULL;
+	for (int i=1; i<mThreadCount; i++) {
+		mpThreads[i] = new PoolThread (*this, i);
+		mpThreads[i]->start ();
+	}
+}
+
+/*******************************************************************************
+ * Tells the helper threads to quit and waits for them.
+ ******************************************************************************/
+WorkerPool::~WorkerPool ()
+{
+	pthread_mutex_lock (&mMutex);
+	mQuit = true;
+	pthread_cond_broadcast (&mWakeup);
+	pthread_mutex_unlock (&mMutex);
+
+	for (int i=1; i<mThreadCount; i++) {
+		mpThreads[i]->join ();
+		delete mpThreads[i];
+	}
+	delete [] mpThreads;
+
+	for (int i=0; i<mThreadCount; i++)
+		pthread_mutex_destroy (&mpDeques[i].lock);
+	delete [] mpDeques;
+
+	pthread_cond_destroy (&mDone);
+	pthread_cond_destroy (&mWakeup);
+	pthread_mutex_destroy (&mMutex);
+}
+
+void WorkerPool::setScheduler (int sched)
+{
+	ASSERTWITH (sched==CHUNKED || sched==STEALING, format ("Unknown scheduler %d", sched));
+	mScheduler = sched;
+}
+
+double WorkerPool::idleTime () const
+{
+	double busy = 0.0;
+	for (int i=0; i<mThreadCount; i++)
+		busy += mpDeques[i].busy;
+
+	double idle = mRunTime*mThreadCount - busy;
+	return (idle>0.0)? idle : 0.0;
+}
+
+int WorkerPool::processors ()
+{
+	long n = sysconf (_SC_NPROCESSORS_ONLN);
+	return (n>0)? int(n) : 1;
+}
+
+/*******************************************************************************
+ * Processes items 0..n-1 with the task in all workers of the pool.
+ *
+ * The calling thread works as worker 0 and returns only after all helpers
+ * have finished.
+ ******************************************************************************/
+void WorkerPool::run (PoolTask& task, /**< Job to execute.                               */
+					  int       n,    /**< Number of items in the job.                   */
+					  int       chunk /**< Maximum number of items processed at a time. */)
+{
+	mRunTime = 0.0;
+	for (int i=0; i<mThreadCount; i++)
+		mpDeques[i].busy = 0.0;
+
+	if (n<=0)
+		return;
+
+	// Default to a few chunks per worker, which balances the load
+	// reasonably without making the handouts too frequent. Stealing
+	// balances the load by itself, so it can use larger chunks.
+	if (chunk<=0)
+		chunk = n/(mThreadCount*((mScheduler==STEALING)? 16:4));
+	if (chunk<1)
+		chunk = 1;
+
+	double start = wallTime ();
+
+	// Without helpers there is no need for any synchronization
+	if (mThreadCount==1) {
+		for (int i=0; i<n; i+=chunk)
+			task.process (i, (i+chunk<n)? i+chunk:n, 0);
+		mRunTime = wallTime () - start;
+		mpDeques[0].busy = mRunTime;
+		return;
+	}
+
+	pthread_mutex_lock (&mMutex);
+	mpTask     = &task;
+	mItems     = n;
+	mChunk     = chunk;
+	mNext      = 0;
+	mRemaining = n;
+	mError     = "";
+	mBusy      = mThreadCount-1;
+
+	// Partition the items evenly to the deques of the workers
+	for (int i=0; i<mThreadCount; i++) {
+		pthread_mutex_lock (&mpDeques[i].lock);
+		mpDeques[i].top    = int ((long(n)*i)/mThreadCount);
+		mpDeques[i].bottom = int ((long(n)*(i+1))/mThreadCount);
+		pthread_mutex_unlock (&mpDeques[i].lock);
+	}
+
+	mJob++;
+	pthread_cond_broadcast (&mWakeup);
+	pthread_mutex_unlock (&mMutex);
+
+	// Work ourselves as well
+	String error;
+	try {
+		work (0);
+	} catch (exception& e) {
+		error = e.what();
+	}
+
+	// Wait for the helpers to finish their last chunks
+	pthread_mutex_lock (&mMutex);
+	while (mBusy>0)
+		pthread_cond_wait (&mDone, &mMutex);
+	mpTask = NULL;
+	if (isempty (error))
+		error = mError;
+	pthread_mutex_unlock (&mMutex);
+
+	mRunTime = wallTime () - start;
+
+	if (!isempty (error))
+		throw exception (format ("Worker failed: %s", (CONSTR) error));
+}
+
+void WorkerPool::work (int worker)
+{
+	try {
+		if (mScheduler==STEALING)
+			workStealing (worker);
+		else
+			workChunked (worker);
+	} catch (...) {
+		// Let the other workers stop instead of waiting for the
+		// items that will never be processed
+		__sync_lock_test_and_set (&mRemaining, 0);
+		__sync_lock_test_and_set (&mNext, mItems);
+		throw;
+	}
+}
+
+void WorkerPool::workChunked (int worker)
+{
+	while (true) {
+		int begin = __sync_fetch_and_add (&mNext, mChunk);
+		if (begin >= mItems)
+			break;
+		int end = begin+mChunk;
+
+		double start = wallTime ();
+		mpTask->process (begin, (end<mItems)? end:mItems, worker);
+		mpDeques[worker].busy += wallTime () - start;
+	}
+}
+
+/*******************************************************************************
+ * Processes the items in the worker's own deque, then steals from the
+ * others until all items of the job have been processed.
+ ******************************************************************************/
+void WorkerPool::workStealing (int worker)
+{
+	WorkerDeque& own = mpDeques[worker];
+
+	while (mRemaining > 0) {
+		// Take a chunk from the bottom of our own deque
+		pthread_mutex_lock (&own.lock);
+		int end   = own.bottom;
+		int begin = (end-mChunk > own.top)? end-mChunk : own.top;
+		own.bottom = begin;
+		pthread_mutex_unlock (&own.lock);
+
+		if (begin<end) {
+			double start = wallTime ();
+			mpTask->process (begin, end, worker);
+			own.busy += wallTime () - start;
+			__sync_sub_and_fetch (&mRemaining, end-begin);
+			continue;
+		}
+
+		// Our deque is empty, so try to steal from a random victim
+		own.seed = own.seed*1103515245u + 12345u;
+		int victim = int ((own.seed>>16) % (mThreadCount-1));
+		if (victim >= worker)
+			victim++;
+		if (!steal (victim, worker))
+			sched_yield ();
+	}
+}
+
+bool WorkerPool::steal (int victim, int thief)
+{
+	WorkerDeque& v = mpDeques[victim];
+
+	pthread_mutex_lock (&v.lock);
+	int available = v.bottom - v.top;
+	if (available <= 0) {
+		pthread_mutex_unlock (&v.lock);
+		return false;
+	}
+	int take  = (available+1)/2;
+	int begin = v.top;
+	v.top += take;
+	pthread_mutex_unlock (&v.lock);
+
+	// Our own deque is empty, as only we could have added anything to it
+	WorkerDeque& own = mpDeques[thief];
+	pthread_mutex_lock (&own.lock);
+	own.top    = begin;
+	own.bottom = begin+take;
+	pthread_mutex_unlock (&own.lock);
+
+	return true;
+}
+
+void WorkerPool::workerLoop (int worker)
+{
+	int seenJob = 0;
+
+	pthread_mutex_lock (&mMutex);
+	while (true) {
+		// Sleep until there is a new job or we are told to quit
+		while (!mQuit && mJob==seenJob)
+			pthread_cond_wait (&mWakeup, &mMutex);
+		if (mQuit)
+			break;
+		seenJob = mJob;
+		pthread_mutex_unlock (&mMutex);
+
+		String error;
+		try {
+			work (worker);
+		} catch (exception& e) {
+			error = e.what();
+		} catch (...) {
+			error = "unknown exception";
+		}
+
+		pthread_mutex_lock (&mMutex);
+		if (!isempty (error) && isempty (mError))
+			mError = error;
+
+		// The last helper wakes up the caller
+		if (--mBusy == 0)
+			pthread_cond_signal (&mDone);
+	}
+	pthread_mutex_unlock (&mMutex);
+}